@@ -4,11 +4,1046 @@
 #include <algorithm>
 #include <sstream>
 #include <cassert>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
 
 namespace mp {
 
     constexpr size_t MAX_SMALL_LENGTH = 20;
 
+    // Операнды, у которых меньший не короче KARATSUBA_THRESHOLD цифр
+    //   (limb), умножаются по Карацубе, не короче TOOM3_THRESHOLD -- по
+    //   Туму-Куку на три части, не короче NTT_THRESHOLD -- через
+    //   теоретико-числовое преобразование, короче -- столбиком. Подобрано
+    //   по замерам (g++ -O2, x86-64).
+    constexpr size_t KARATSUBA_THRESHOLD = 32;
+    constexpr size_t TOOM3_THRESHOLD = 128;
+    constexpr size_t NTT_THRESHOLD = 4096;
+
+    namespace detail {
+
+        // Числа -- массивы цифр (limb), младшие первыми. Цифра -- 64 бита,
+        //   если компилятор умеет 128-битные произведения, иначе (или с
+        //   MP_LIMB_32) 32 бита; остальной код от ширины цифры не зависит.
+#if defined(__SIZEOF_INT128__) && !defined(MP_LIMB_32)
+        using limb = uint64_t;
+        using double_limb = unsigned __int128;
+        constexpr unsigned LIMB_BITS = 64;
+#else
+        using limb = uint32_t;
+        using double_limb = uint64_t;
+        constexpr unsigned LIMB_BITS = 32;
+#endif
+        // Цифр в uint64_t (small)
+        constexpr size_t SMALL_LIMBS = 64 / LIMB_BITS;
+
+
+        // r = a + b (n цифр), возвращает перенос
+        inline limb add_n(limb* r, const limb* a, const limb* b, size_t n) {
+            limb carry = 0;
+            for (size_t i = 0; i < n; ++i) {
+                double_limb sum = static_cast<double_limb>(a[i]) + b[i] + carry;
+                r[i] = static_cast<limb>(sum);
+                carry = static_cast<limb>(sum >> LIMB_BITS);
+            }
+            return carry;
+        }
+
+
+        // r = a - b (n цифр), возвращает заем
+        inline limb sub_n(limb* r, const limb* a, const limb* b, size_t n) {
+            limb borrow = 0;
+            for (size_t i = 0; i < n; ++i) {
+                double_limb diff = static_cast<double_limb>(a[i]) - b[i] - borrow;
+                r[i] = static_cast<limb>(diff);
+                borrow = static_cast<limb>(diff >> LIMB_BITS) & 1u;
+            }
+            return borrow;
+        }
+
+
+        // r += a * b (n цифр), возвращает старшую цифру
+        inline limb addmul_1(limb* r, const limb* a, size_t n, limb b) {
+            limb carry = 0;
+            for (size_t i = 0; i < n; ++i) {
+                double_limb prod = static_cast<double_limb>(a[i]) * b + r[i] + carry;
+                r[i] = static_cast<limb>(prod);
+                carry = static_cast<limb>(prod >> LIMB_BITS);
+            }
+            return carry;
+        }
+
+
+        // r[0, rn) += a[0, an), an <= rn; перенос за r теряется
+        inline void add_to(limb* r, size_t rn, const limb* a, size_t an) {
+            limb carry = add_n(r, r, a, an);
+            for (size_t i = an; carry && i < rn; ++i) {
+                carry = ++r[i] == 0;
+            }
+        }
+
+
+        // r[0, rn) -= a[0, an), an <= rn; r не меньше a
+        inline void sub_from(limb* r, size_t rn, const limb* a, size_t an) {
+            limb borrow = sub_n(r, r, a, an);
+            for (size_t i = an; borrow && i < rn; ++i) {
+                borrow = r[i]-- == 0;
+            }
+        }
+
+
+        // Сравнение a (an цифр) и b (bn цифр) без учета нулей в начале
+        inline int compare(const limb* a, size_t an, const limb* b, size_t bn) {
+            while (an > 0 && a[an - 1] == 0) {
+                --an;
+            }
+            while (bn > 0 && b[bn - 1] == 0) {
+                --bn;
+            }
+            if (an != bn) {
+                return an < bn ? -1 : 1;
+            }
+            for (size_t i = an; i-- > 0;) {
+                if (a[i] != b[i]) {
+                    return a[i] < b[i] ? -1 : 1;
+                }
+            }
+            return 0;
+        }
+
+
+        // r = |a - b| (an цифр), an >= bn; возвращает true, если b > a
+        inline bool abs_sub(limb* r, const limb* a, size_t an, const limb* b, size_t bn) {
+            if (compare(a, an, b, bn) >= 0) {
+                std::copy(a, a + an, r);
+                sub_from(r, an, b, bn);
+                return false;
+            }
+            // b > a, значит цифры a старше bn нулевые
+            std::copy(b, b + bn, r);
+            std::fill(r + bn, r + an, 0);
+            sub_from(r, bn, a, bn);
+            return true;
+        }
+
+
+        // r = a << bits (n цифр), 0 < bits < LIMB_BITS, возвращает выдвинутые
+        //   биты
+        inline limb lshift(limb* r, const limb* a, size_t n, unsigned bits) {
+            limb out = 0;
+            for (size_t i = 0; i < n; ++i) {
+                limb next = a[i] >> (LIMB_BITS - bits);
+                r[i] = (a[i] << bits) | out;
+                out = next;
+            }
+            return out;
+        }
+
+
+        // r = a >> bits (n цифр), 0 < bits < LIMB_BITS; r <= a
+        inline void rshift(limb* r, const limb* a, size_t n, unsigned bits) {
+            for (size_t i = 0; i + 1 < n; ++i) {
+                r[i] = (a[i] >> bits) | (a[i + 1] << (LIMB_BITS - bits));
+            }
+            if (n > 0) {
+                r[n - 1] = a[n - 1] >> bits;
+            }
+        }
+
+
+        // r = a / d (n цифр) для нечетного d, если a делится на d нацело:
+        //   умножение на обратное к d по модулю 2^LIMB_BITS вместо деления
+        inline void divexact_1(limb* r, const limb* a, size_t n, limb d) {
+            assert(d % 2 == 1);
+            limb inverse = d; // верны 3 младших бита, каждый шаг удваивает
+            for (unsigned bits = 3; bits < LIMB_BITS; bits *= 2) {
+                inverse *= 2 - d * inverse;
+            }
+            limb borrow = 0;
+            for (size_t i = 0; i < n; ++i) {
+                limb x = a[i];
+                limb next = x < borrow;
+                limb q = (x - borrow) * inverse;
+                r[i] = q;
+                borrow = next + static_cast<limb>((static_cast<double_limb>(q) * d) >> LIMB_BITS);
+            }
+        }
+
+
+        // r[0, n + m) = a * b столбиком: строка на цифру b, одна
+        //   протяжка переноса на строку
+        inline void mul_basecase(limb* r, const limb* a, size_t n, const limb* b, size_t m) {
+            std::fill(r, r + n + m, 0);
+            for (size_t j = 0; j < m; ++j) {
+                r[n + j] = addmul_1(r + j, a, n, b[j]);
+            }
+        }
+
+
+        inline void mul(limb* r, const limb* a, size_t n, const limb* b, size_t m);
+
+
+        // Карацуба для n >= m > ceil(n / 2): a = a1 x + a0, b = b1 x + b0,
+        //   x = 2^(LIMB_BITS l), a * b = z2 x^2 + (z0 + z2 -+ |a0 - a1| |b0 - b1|) x + z0
+        inline void mul_karatsuba(limb* r, const limb* a, size_t n, const limb* b, size_t m) {
+            const size_t l = (n + 1) / 2;
+            const size_t h1 = n - l;
+            const size_t h2 = m - l;
+
+            std::vector<limb> tmp(4 * l + 1);
+            limb* da = tmp.data();
+            limb* db = da + l;
+            limb* middle = db + l; // 2 l + 1 цифр
+            bool negative = abs_sub(da, a, l, a + l, h1) != abs_sub(db, b, l, b + l, h2);
+
+            mul(r, a, l, b, l);
+            mul(r + 2 * l, a + l, h1, b + l, h2);
+
+            std::vector<limb> diff(2 * l);
+            mul(diff.data(), da, l, db, l);
+            std::copy(r, r + 2 * l, middle);
+            middle[2 * l] = 0;
+            add_to(middle, 2 * l + 1, r + 2 * l, h1 + h2);
+            if (negative) {
+                add_to(middle, 2 * l + 1, diff.data(), 2 * l);
+            } else {
+                sub_from(middle, 2 * l + 1, diff.data(), 2 * l);
+            }
+            // Старшая цифра может не поместиться, только если она 0
+            size_t tail = n + m - l;
+            add_to(r + l, tail, middle, std::min(2 * l + 1, tail));
+        }
+
+
+        // Тум-Кук на три части для n >= m > 2 ceil(n / 3): a = a2 x^2 +
+        //   a1 x + a0 и b так же, x = 2^(LIMB_BITS k). Произведение -- многочлен
+        //   c4 x^4 + ... + c0, его значения в 0, 1, -1, 2 и бесконечности --
+        //   пять умножений втрое более коротких чисел. Все c_i и
+        //   промежуточные суммы интерполяции неотрицательны; знак есть
+        //   только у значения в -1.
+        inline void mul_toom3(limb* r, const limb* a, size_t n, const limb* b, size_t m) {
+            const size_t k = (n + 2) / 3;
+            const size_t an = n - 2 * k;
+            const size_t bn = m - 2 * k;
+            const size_t size = 2 * k + 2; // значения и коэффициенты
+
+            // Значения множителей: в 1, -1 (модуль) и 2, по k + 1 цифр
+            auto evaluate = [k](const limb* x, size_t xn, limb* at1, limb* atm1, limb* at2) {
+                const limb* x0 = x;
+                const limb* x1 = x + k;
+                const limb* x2 = x + 2 * k;
+                std::copy(x0, x0 + k, at1);
+                at1[k] = 0;
+                add_to(at1, k + 1, x2, xn); // a0 + a2
+                bool negative = abs_sub(atm1, at1, k + 1, x1, k);
+                add_to(at1, k + 1, x1, k);
+                // a0 + 2 a1 + 4 a2 = 2 (2 a2 + a1) + a0
+                std::fill(at2, at2 + k + 1, 0);
+                at2[xn] = lshift(at2, x2, xn, 1);
+                add_to(at2, k + 1, x1, k);
+                lshift(at2, at2, k + 1, 1);
+                add_to(at2, k + 1, x0, k);
+                return negative;
+            };
+            std::vector<limb> values(6 * (k + 1));
+            limb* a1 = values.data();
+            limb* am1 = a1 + (k + 1);
+            limb* a2 = am1 + (k + 1);
+            limb* b1 = a2 + (k + 1);
+            limb* bm1 = b1 + (k + 1);
+            limb* b2 = bm1 + (k + 1);
+            bool negative = evaluate(a, an, a1, am1, a2) != evaluate(b, bn, b1, bm1, b2);
+
+            std::vector<limb> products(3 * size);
+            limb* v1 = products.data();
+            limb* vm1 = v1 + size;
+            limb* v2 = vm1 + size;
+            mul(v1, a1, k + 1, b1, k + 1);
+            mul(vm1, am1, k + 1, bm1, k + 1);
+            mul(v2, a2, k + 1, b2, k + 1);
+            // c0 и c4 сразу на своих местах
+            std::fill(r + 2 * k, r + 4 * k, 0);
+            mul(r, a, k, b, k);
+            if (an >= bn) {
+                mul(r + 4 * k, a + 2 * k, an, b + 2 * k, bn);
+            } else {
+                mul(r + 4 * k, b + 2 * k, bn, a + 2 * k, an);
+            }
+            const limb* c0 = r;
+            const limb* c4 = r + 4 * k;
+            const size_t c4n = an + bn;
+
+            // c1 + c3 = (v1 - v(-1)) / 2, c0 + c2 + c4 = (v1 + v(-1)) / 2
+            std::vector<limb> coeffs(3 * size);
+            limb* c1 = coeffs.data();
+            limb* c2 = c1 + size;
+            limb* c3 = c2 + size;
+            std::copy(v1, v1 + size, c1);
+            std::copy(v1, v1 + size, c2);
+            if (negative) {
+                add_to(c1, size, vm1, size);
+                sub_from(c2, size, vm1, size);
+            } else {
+                sub_from(c1, size, vm1, size);
+                add_to(c2, size, vm1, size);
+            }
+            rshift(c1, c1, size, 1);
+            rshift(c2, c2, size, 1);
+            sub_from(c2, size, c0, 2 * k);
+            sub_from(c2, size, c4, c4n);
+
+            // c1 + 4 c3 = (v2 - c0 - 4 c2 - 16 c4) / 2, затем
+            //   3 c3 = (c1 + 4 c3) - (c1 + c3)
+            // Сдвиги не выходят за size цифр: 4 c2 и 16 c4 меньше v2
+            sub_from(v2, size, c0, 2 * k);
+            lshift(c3, c2, size, 2);
+            sub_from(v2, size, c3, size);
+            std::fill(c3, c3 + size, 0);
+            c3[c4n] = lshift(c3, c4, c4n, 4);
+            sub_from(v2, size, c3, size);
+            rshift(v2, v2, size, 1);
+            sub_from(v2, size, c1, size);
+            divexact_1(c3, v2, size, 3);
+            sub_from(c1, size, c3, size);
+
+            // Коэффициенты, не поместившиеся в r, равны 0 в старших цифрах
+            const size_t total = n + m;
+            add_to(r + k, total - k, c1, std::min(size, total - k));
+            add_to(r + 2 * k, total - 2 * k, c2, std::min(size, total - 2 * k));
+            add_to(r + 3 * k, total - 3 * k, c3, std::min(size, total - 3 * k));
+        }
+
+
+        // Арифметика по модулю простого p < 2^30 в форме Монтгомери:
+        //   x хранится как x 2^32 mod p, значения всегда меньше p
+        struct NttPrime {
+            uint32_t p;
+            uint32_t neg_inverse; // -p^(-1) mod 2^32
+            uint32_t r2;          // 2^64 mod p
+
+            explicit NttPrime(uint32_t prime) : p(prime), neg_inverse(0), r2(0) {
+                uint32_t inverse = p;
+                for (int i = 0; i < 4; ++i) {
+                    inverse *= 2 - p * inverse;
+                }
+                neg_inverse = 0u - inverse;
+                r2 = static_cast<uint32_t>((uint64_t{1} << 63u) % p * 2 % p);
+            }
+
+            uint32_t mul(uint32_t a, uint32_t b) const {
+                uint64_t t = static_cast<uint64_t>(a) * b;
+                uint32_t m = static_cast<uint32_t>(t) * neg_inverse;
+                auto u = static_cast<uint32_t>((t + static_cast<uint64_t>(m) * p) >> 32u);
+                return u >= p ? u - p : u;
+            }
+
+            uint32_t add(uint32_t a, uint32_t b) const {
+                uint32_t s = a + b;
+                return s >= p ? s - p : s;
+            }
+
+            uint32_t sub(uint32_t a, uint32_t b) const {
+                uint32_t d = a + p - b;
+                return d >= p ? d - p : d;
+            }
+
+            // Из обычной формы в форму Монтгомери; x < 2^32
+            uint32_t to_montgomery(uint32_t x) const {
+                return mul(x, r2);
+            }
+
+            // Обычная форма, power -- тоже
+            uint32_t pow(uint32_t base, uint64_t power) const {
+                uint64_t result = 1 % p;
+                uint64_t x = base % p;
+                for (; power > 0; power >>= 1u) {
+                    if (power & 1u) {
+                        result = result * x % p;
+                    }
+                    x = x * x % p;
+                }
+                return static_cast<uint32_t>(result);
+            }
+        };
+
+
+        // Простые вида c 2^k + 1 с первообразным корнем 3. Длина
+        //   преобразования -- до 2^23, произведение простых больше 2^85,
+        //   поэтому свертка восстанавливается точно, пока меньший
+        //   множитель не длиннее 2^21 кусков. Цифры сворачиваются кусками
+        //   по 32 бита, по NTT_PIECES на цифру.
+        constexpr uint32_t NTT_PRIMES[3] = {998244353, 167772161, 469762049};
+        constexpr size_t NTT_PIECES = LIMB_BITS / 32;
+        constexpr size_t MAX_NTT_LENGTH = size_t{1} << 23u;
+        constexpr size_t MAX_NTT_OPERAND = size_t{1} << 21u;
+        // Блоки не длиннее этого (64 КиБ) преобразуются целиком в кеше
+        constexpr size_t NTT_BLOCK = size_t{1} << 14u;
+
+
+        // Корни для всех этапов: roots[h + j] = w^j, w -- корень степени
+        //   2 h из единицы (или обратный к нему), h = 1, 2, 4, ..., n / 2.
+        //   На каждом этапе корни идут подряд.
+        inline std::vector<uint32_t> ntt_roots(const NttPrime& prime, size_t n, bool inverse) {
+            std::vector<uint32_t> roots(std::max<size_t>(n, 2)); // NRVO
+            for (size_t h = 1; h < n; h *= 2) {
+                uint32_t w = prime.pow(3, (prime.p - 1) / (2 * h));
+                if (inverse) {
+                    w = prime.pow(w, prime.p - 2);
+                }
+                uint32_t step = prime.to_montgomery(w);
+                uint32_t root = prime.to_montgomery(1);
+                for (size_t j = 0; j < h; ++j) {
+                    roots[h + j] = root;
+                    root = prime.mul(root, step);
+                }
+            }
+            return roots;
+        }
+
+
+        // Этап преобразования с прореживанием по частоте для блоков
+        //   длиной 2 h, начиная с a[0, n)
+        inline void ntt_dif_stage(uint32_t* a, size_t n, size_t h, const uint32_t* roots, const NttPrime& prime) {
+            for (size_t start = 0; start < n; start += 2 * h) {
+                uint32_t* x = a + start;
+                uint32_t* y = x + h;
+                const uint32_t* w = roots + h;
+                for (size_t j = 0; j < h; ++j) {
+                    uint32_t u = x[j];
+                    uint32_t v = y[j];
+                    x[j] = prime.add(u, v);
+                    y[j] = prime.mul(prime.sub(u, v), w[j]);
+                }
+            }
+        }
+
+
+        inline void ntt_dit_stage(uint32_t* a, size_t n, size_t h, const uint32_t* roots, const NttPrime& prime) {
+            for (size_t start = 0; start < n; start += 2 * h) {
+                uint32_t* x = a + start;
+                uint32_t* y = x + h;
+                const uint32_t* w = roots + h;
+                for (size_t j = 0; j < h; ++j) {
+                    uint32_t u = x[j];
+                    uint32_t v = prime.mul(y[j], w[j]);
+                    x[j] = prime.add(u, v);
+                    y[j] = prime.sub(u, v);
+                }
+            }
+        }
+
+
+        // Прямое преобразование: результат в порядке с обращенными
+        //   битами номеров. Большие массивы делятся пополам после
+        //   первого этапа, так что остальные этапы идут в кеше.
+        inline void ntt_forward(uint32_t* a, size_t n, const uint32_t* roots, const NttPrime& prime) {
+            if (n <= NTT_BLOCK) {
+                for (size_t h = n / 2; h > 0; h /= 2) {
+                    ntt_dif_stage(a, n, h, roots, prime);
+                }
+                return;
+            }
+            ntt_dif_stage(a, n, n / 2, roots, prime);
+            ntt_forward(a, n / 2, roots, prime);
+            ntt_forward(a + n / 2, n / 2, roots, prime);
+        }
+
+
+        // Обратное к ntt_forward без деления на n: вход в порядке
+        //   с обращенными битами, результат -- в обычном
+        inline void ntt_inverse(uint32_t* a, size_t n, const uint32_t* roots, const NttPrime& prime) {
+            if (n <= NTT_BLOCK) {
+                for (size_t h = 1; h < n; h *= 2) {
+                    ntt_dit_stage(a, n, h, roots, prime);
+                }
+                return;
+            }
+            ntt_inverse(a, n / 2, roots, prime);
+            ntt_inverse(a + n / 2, n / 2, roots, prime);
+            ntt_dit_stage(a, n, n / 2, roots, prime);
+        }
+
+
+        // Свертка кусков цифр a и b по модулю prime длиной size (степень
+        //   2), результат в обычной форме
+        inline std::vector<uint32_t> ntt_convolution(
+            const limb* a,
+            size_t n,
+            const limb* b,
+            size_t m,
+            size_t size,
+            const NttPrime& prime
+        ) {
+            auto load = [&](const limb* x, size_t xn) {
+                std::vector<uint32_t> values(size); // NRVO
+                for (size_t i = 0; i < xn; ++i) {
+                    for (size_t k = 0; k < NTT_PIECES; ++k) {
+                        values[NTT_PIECES * i + k] = prime.to_montgomery(static_cast<uint32_t>(x[i] >> (32 * k)));
+                    }
+                }
+                return values;
+            };
+            auto roots = ntt_roots(prime, size, false);
+            std::vector<uint32_t> fa = load(a, n);
+            ntt_forward(fa.data(), size, roots.data(), prime);
+            if (a == b && n == m) {
+                for (auto& x : fa) {
+                    x = prime.mul(x, x);
+                }
+            } else {
+                std::vector<uint32_t> fb = load(b, m);
+                ntt_forward(fb.data(), size, roots.data(), prime);
+                for (size_t i = 0; i < size; ++i) {
+                    fa[i] = prime.mul(fa[i], fb[i]);
+                }
+            }
+            roots = ntt_roots(prime, size, true);
+            ntt_inverse(fa.data(), size, roots.data(), prime);
+            // Умножение на 1/size (в обычной форме) заодно выводит из формы
+            //   Монтгомери
+            uint32_t scale = prime.pow(static_cast<uint32_t>(size % prime.p), prime.p - 2);
+            for (auto& x : fa) {
+                x = prime.mul(x, scale);
+            }
+            return fa;
+        }
+
+
+        // Умножение через свертки по трем простым и китайскую теорему об
+        //   остатках (Гарнер): коэффициенты свертки меньше 2^86,
+        //   складываются с переносом в накопителе из трех 32-битных
+        //   кусков.
+        inline void mul_ntt(limb* r, const limb* a, size_t n, const limb* b, size_t m) {
+            const size_t pieces = NTT_PIECES * (n + m);
+            size_t size = 1;
+            while (size < pieces - 1) {
+                size *= 2;
+            }
+            NttPrime p0(NTT_PRIMES[0]);
+            NttPrime p1(NTT_PRIMES[1]);
+            NttPrime p2(NTT_PRIMES[2]);
+            auto r0 = ntt_convolution(a, n, b, m, size, p0);
+            auto r1 = ntt_convolution(a, n, b, m, size, p1);
+            auto r2 = ntt_convolution(a, n, b, m, size, p2);
+
+            const uint64_t m0 = p0.p;
+            const uint64_t m01 = m0 * p1.p;
+            const uint64_t inv0 = p1.pow(p0.p % p1.p, p1.p - 2);                      // 1/m0 mod p1
+            const uint64_t inv01 = p2.pow(static_cast<uint32_t>(m01 % p2.p), p2.p - 2); // 1/m01 mod p2
+
+            std::fill(r, r + n + m, 0);
+            uint32_t acc[3] = {0, 0, 0};
+            for (size_t i = 0; i < pieces; ++i) {
+                if (i < size) {
+                    // x = r0 + m0 t1 + m01 t2, 0 <= t1 < p1, 0 <= t2 < p2
+                    uint64_t t1 = (r1[i] + p1.p - r0[i] % p1.p) % p1.p * inv0 % p1.p;
+                    uint64_t x01 = r0[i] + m0 * t1;
+                    uint64_t t2 = (r2[i] + p2.p - x01 % p2.p) % p2.p * inv01 % p2.p;
+                    // acc += x01 + m01 t2
+                    uint64_t low = (m01 & 0xFFFFFFFFu) * t2 + static_cast<uint32_t>(x01) + acc[0];
+                    uint64_t high = (m01 >> 32u) * t2 + (x01 >> 32u) + acc[1] + (low >> 32u);
+                    acc[0] = static_cast<uint32_t>(low);
+                    acc[1] = static_cast<uint32_t>(high);
+                    acc[2] += static_cast<uint32_t>(high >> 32u);
+                }
+                r[i / NTT_PIECES] |= static_cast<limb>(acc[0]) << (32 * (i % NTT_PIECES));
+                acc[0] = acc[1];
+                acc[1] = acc[2];
+                acc[2] = 0;
+            }
+        }
+
+
+        // r[0, n + m) = a * b, n >= m >= 1; r не пересекается с a и b
+        inline void mul(limb* r, const limb* a, size_t n, const limb* b, size_t m) {
+            if (m < KARATSUBA_THRESHOLD) {
+                mul_basecase(r, a, n, b, m);
+                return;
+            }
+            if (m >= NTT_THRESHOLD && NTT_PIECES * m <= MAX_NTT_OPERAND
+                && NTT_PIECES * (n + m) <= MAX_NTT_LENGTH) {
+                mul_ntt(r, a, n, b, m);
+                return;
+            }
+            if (m >= TOOM3_THRESHOLD && m > 2 * ((n + 2) / 3)) {
+                mul_toom3(r, a, n, b, m);
+                return;
+            }
+            if (m > (n + 1) / 2) {
+                mul_karatsuba(r, a, n, b, m);
+                return;
+            }
+            // Сильно разные длины: a режется на куски по m цифр
+            std::fill(r, r + n + m, 0);
+            std::vector<limb> part(2 * m);
+            for (size_t pos = 0; pos < n; pos += m) {
+                size_t len = std::min(m, n - pos);
+                mul(part.data(), b, m, a + pos, len);
+                add_to(r + pos, n + m - pos, part.data(), m + len);
+            }
+        }
+
+
+        // r[0, n) -= a * b, возвращает заем из старшей цифры
+        inline limb submul_1(limb* r, const limb* a, size_t n, limb b) {
+            limb borrow = 0;
+            for (size_t i = 0; i < n; ++i) {
+                double_limb prod = static_cast<double_limb>(a[i]) * b + borrow;
+                auto low = static_cast<limb>(prod);
+                borrow = static_cast<limb>(prod >> LIMB_BITS) + (r[i] < low);
+                r[i] -= low;
+            }
+            return borrow;
+        }
+
+
+        inline unsigned leading_zeros(limb x) {
+            unsigned zeros = 0;
+            for (limb bit = limb{1} << (LIMB_BITS - 1); bit && !(x & bit); bit >>= 1u) {
+                ++zeros;
+            }
+            return zeros;
+        }
+
+
+        // Деление на цифру через обратное (Мёллер, Гранлунд): для d со
+        //   старшим битом 1 хранится v = floor((B^2 - 1) / d) - B, B =
+        //   2^LIMB_BITS, и частное двух цифр на d находится умножением и
+        //   одной-двумя поправками вместо деления двойных цифр.
+        inline limb reciprocal(limb d) {
+            return static_cast<limb>(~double_limb{0} / d);
+        }
+
+
+        // (u1 B + u0) / d, u1 < d, старший бит d единица; остаток -- в rem
+        inline limb div_2by1(limb u1, limb u0, limb d, limb v, limb* rem) {
+            double_limb q = static_cast<double_limb>(v) * u1 + ((static_cast<double_limb>(u1) << LIMB_BITS) | u0);
+            auto q1 = static_cast<limb>(q >> LIMB_BITS) + 1;
+            auto q0 = static_cast<limb>(q);
+            limb r = u0 - q1 * d;
+            if (r > q0) {
+                --q1;
+                r += d;
+            }
+            if (r >= d) {
+                ++q1;
+                r -= d;
+            }
+            *rem = r;
+            return q1;
+        }
+
+
+        // q = a / d (n цифр), возвращает остаток. Делимое и d сдвигаются
+        //   так, чтобы старший бит d был 1; q может совпадать с a.
+        inline limb divrem_1(limb* q, const limb* a, size_t n, limb d) {
+            if (n == 0) {
+                return 0;
+            }
+            const unsigned shift = leading_zeros(d);
+            d <<= shift;
+            const limb v = reciprocal(d);
+            limb rem = 0;
+            if (shift == 0) {
+                for (size_t i = n; i-- > 0;) {
+                    q[i] = div_2by1(rem, a[i], d, v, &rem);
+                }
+                return rem;
+            }
+            rem = a[n - 1] >> (LIMB_BITS - shift);
+            for (size_t i = n; i-- > 0;) {
+                limb u0 = a[i] << shift;
+                if (i > 0) {
+                    u0 |= a[i - 1] >> (LIMB_BITS - shift);
+                }
+                q[i] = div_2by1(rem, u0, d, v, &rem);
+            }
+            return rem >> shift;
+        }
+
+
+        // Деление столбиком (Кнут, алгоритм D): q[0, n - m + 1) = a / b,
+        //   r[0, m) = a % b; n >= m >= 2, старшая цифра b не 0. Делитель
+        //   сдвигается так, чтобы старший бит был 1: тогда оценка цифры
+        //   частного по двум старшим цифрам ошибается не больше чем на 2.
+        inline void divrem_knuth(limb* q, limb* r, const limb* a, size_t n, const limb* b, size_t m) {
+            const unsigned shift = leading_zeros(b[m - 1]);
+            std::vector<limb> divisor(b, b + m);
+            std::vector<limb> rest(a, a + n);
+            rest.push_back(0);
+            if (shift > 0) {
+                lshift(divisor.data(), b, m, shift);
+                rest[n] = lshift(rest.data(), a, n, shift);
+            }
+            const limb top = divisor[m - 1];
+            const limb next = divisor[m - 2];
+            const limb top_inverse = reciprocal(top);
+
+            for (size_t j = n - m + 1; j-- > 0;) {
+                limb* window = rest.data() + j;
+                limb qhat = 0;
+                limb rhat = 0;
+                bool rhat_overflow = false;
+                if (window[m] >= top) {
+                    // Старшие цифры равны: оценка B - 1
+                    qhat = ~limb{0};
+                    rhat = window[m - 1] + top;
+                    rhat_overflow = rhat < top;
+                } else {
+                    qhat = div_2by1(window[m], window[m - 1], top, top_inverse, &rhat);
+                }
+                while (!rhat_overflow
+                       && static_cast<double_limb>(qhat) * next
+                              > ((static_cast<double_limb>(rhat) << LIMB_BITS) | window[m - 2])) {
+                    --qhat;
+                    rhat += top;
+                    rhat_overflow = rhat < top;
+                }
+                limb borrow = submul_1(window, divisor.data(), m, qhat);
+                if (window[m] < borrow) {
+                    // Оценка на 1 больше: прибавляем делитель обратно
+                    --qhat;
+                    window[m] += add_n(window, window, divisor.data(), m);
+                }
+                window[m] -= borrow;
+                q[j] = qhat;
+            }
+            if (shift > 0) {
+                rshift(r, rest.data(), m, shift);
+                r[m - 1] |= rest[m] << (LIMB_BITS - shift);
+            } else {
+                std::copy(rest.begin(), rest.begin() + m, r);
+            }
+        }
+
+
+        // r[0, n) -= 1, возвращает заем
+        inline limb sub_1(limb* r, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                if (r[i]-- != 0) {
+                    return 0;
+                }
+            }
+            return 1;
+        }
+
+
+        // Делители не короче DIV_DC_THRESHOLD цифр делятся рекурсивно
+        //   (Burnikel--Ziegler): старшая половина частного находится по
+        //   старшей половине делителя, остаток поправляется вычитанием ее
+        //   произведения на младшую половину, затем так же младшая
+        //   половина частного. Деление дороже умножения в постоянное
+        //   число раз.
+        constexpr size_t DIV_DC_THRESHOLD = 64;
+
+
+        inline limb divrem_dc(limb* q, limb* a, const limb* b, size_t n);
+
+
+        // q[0, k) = a[0, m + k) / b (m цифр, старший бит 1), k <= m,
+        //   остаток -- в a[0, m). Возвращает старшую цифру частного (0 или
+        //   1). Частное по старшим k цифрам делителя может быть больше
+        //   настоящего, но не более чем на 2, поэтому поправок немного.
+        inline limb divrem_block(limb* q, limb* a, const limb* b, size_t m, size_t k) {
+            limb q_high = divrem_dc(q, a + m - k, b + m - k, k);
+            if (k == m) {
+                return q_high;
+            }
+            std::vector<limb> product(m);
+            if (k >= m - k) {
+                mul(product.data(), q, k, b, m - k);
+            } else {
+                mul(product.data(), b, m - k, q, k);
+            }
+            limb borrow = sub_n(a, a, product.data(), m);
+            if (q_high) {
+                borrow += sub_n(a + k, a + k, b, m - k);
+            }
+            while (borrow) {
+                q_high -= sub_1(q, k);
+                borrow -= add_n(a, a, b, m);
+            }
+            return q_high;
+        }
+
+
+        // q[0, n) = a[0, 2 n) / b (n цифр, старший бит 1), остаток -- в
+        //   a[0, n). Возвращает старшую цифру частного (0 или 1).
+        inline limb divrem_dc(limb* q, limb* a, const limb* b, size_t n) {
+            if (n < DIV_DC_THRESHOLD) {
+                std::vector<limb> quotient(n + 1);
+                std::vector<limb> remainder(n);
+                if (n == 1) {
+                    remainder[0] = divrem_1(quotient.data(), a, 2, b[0]);
+                } else {
+                    divrem_knuth(quotient.data(), remainder.data(), a, 2 * n, b, n);
+                }
+                std::copy(quotient.begin(), quotient.begin() + n, q);
+                std::copy(remainder.begin(), remainder.end(), a);
+                return quotient[n];
+            }
+            const size_t lo = n / 2;
+            const size_t hi = n - lo;
+            limb q_high = divrem_block(q + lo, a + lo, b, n, hi);
+            // Остаток меньше b, поэтому младшая половина частного меньше B^lo
+            limb q_low = divrem_block(q, a, b, n, lo);
+            assert(q_low == 0);
+            (void)q_low;
+            return q_high;
+        }
+
+
+        // q[0, n - m + 1) = a / b, r[0, m) = a % b; n >= m >= 1, старшая
+        //   цифра b не 0
+        inline void divrem(limb* q, limb* r, const limb* a, size_t n, const limb* b, size_t m) {
+            if (m == 1) {
+                r[0] = divrem_1(q, a, n, b[0]);
+                return;
+            }
+            if (m < DIV_DC_THRESHOLD) {
+                divrem_knuth(q, r, a, n, b, m);
+                return;
+            }
+            // Нормализованное делимое делится кусками частного по m цифр,
+            //   начиная со старших; самый старший кусок может быть короче
+            const unsigned shift = leading_zeros(b[m - 1]);
+            std::vector<limb> divisor(b, b + m);
+            std::vector<limb> dividend(n + 1);
+            if (shift > 0) {
+                lshift(divisor.data(), b, m, shift);
+                dividend[n] = lshift(dividend.data(), a, n, shift);
+            } else {
+                std::copy(a, a + n, dividend.begin());
+            }
+            std::vector<limb> quotient(n - m + 2);
+            size_t pos = n + 1 - m;
+            size_t k = pos % m > 0 ? pos % m : m;
+            pos -= k;
+            quotient[pos + k] = divrem_block(quotient.data() + pos, dividend.data() + pos, divisor.data(), m, k);
+            while (pos > 0) {
+                pos -= m;
+                limb q_high = divrem_block(quotient.data() + pos, dividend.data() + pos, divisor.data(), m, m);
+                assert(q_high == 0);
+                (void)q_high;
+            }
+            std::copy(quotient.begin(), quotient.begin() + (n - m + 1), q);
+            if (shift > 0) {
+                rshift(r, dividend.data(), m, shift);
+            } else {
+                std::copy(dividend.begin(), dividend.begin() + m, r);
+            }
+        }
+
+
+        inline size_t trimmed(const limb* a, size_t n) {
+            while (n > 0 && a[n - 1] == 0) {
+                --n;
+            }
+            return n;
+        }
+
+
+        // Перевод в десятичную запись делением пополам: число меньше
+        //   10^(2 k) делится на 10^k, частное и остаток переводятся
+        //   отдельно в k цифр каждый. Степени 10^(D 2^i) вычисляются
+        //   возведением в квадрат один раз и хранятся до конца программы.
+        //   D -- сколько десятичных цифр помещается в цифру: 19 или 9.
+        constexpr size_t DECIMAL_CHUNK_DIGITS = LIMB_BITS == 64 ? 19 : 9;
+        constexpr limb DECIMAL_CHUNK = static_cast<limb>(
+            LIMB_BITS == 64 ? 10000000000000000000ull : 1000000000ull
+        ); // 10^D
+        // Числа не длиннее стольких цифр переводятся делением на 10^D
+        constexpr size_t TO_STRING_THRESHOLD = 24;
+        // Половины чисел не короче стольких цифр переводятся параллельно
+        constexpr size_t TO_STRING_PARALLEL_THRESHOLD = 16384;
+
+
+        // 10^(D 2^i)
+        inline const std::vector<limb>& decimal_power(size_t i) {
+            static std::mutex mutex;
+            static std::deque<std::vector<limb>> powers;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (powers.empty()) {
+                powers.push_back({DECIMAL_CHUNK});
+            }
+            while (powers.size() <= i) {
+                const auto& last = powers.back();
+                std::vector<limb> square(2 * last.size());
+                mul(square.data(), last.data(), last.size(), last.data(), last.size());
+                square.resize(trimmed(square.data(), square.size()));
+                powers.push_back(std::move(square));
+            }
+            return powers[i];
+        }
+
+
+        // Пишет в out ровно digits цифр a (с нулями в начале), начиная со
+        //   старших; a < 10^digits
+        inline void to_decimal_chunks(const limb* a, size_t n, char* out, size_t digits) {
+            std::vector<limb> rest(a, a + n);
+            char* pos = out + digits;
+            while (pos > out) {
+                limb chunk = divrem_1(rest.data(), rest.data(), rest.size(), DECIMAL_CHUNK);
+                rest.resize(trimmed(rest.data(), rest.size()));
+                for (size_t i = 0; i < DECIMAL_CHUNK_DIGITS && pos > out; ++i) {
+                    *--pos = static_cast<char>('0' + chunk % 10);
+                    chunk /= 10;
+                }
+            }
+        }
+
+
+        // Пишет D 2^(level + 1) цифр a; a < 10^(D 2^(level + 1)).
+        //   threads -- сколько еще раз можно делить работу между потоками.
+        inline void to_decimal(const limb* a, size_t n, size_t level, char* out, unsigned threads) {
+            n = trimmed(a, n);
+            const size_t half = DECIMAL_CHUNK_DIGITS << level;
+            if (n <= TO_STRING_THRESHOLD || level == 0) {
+                to_decimal_chunks(a, n, out, 2 * half);
+                return;
+            }
+            const auto& power = decimal_power(level);
+            if (n < power.size()) {
+                std::fill(out, out + half, '0');
+                to_decimal(a, n, level - 1, out + half, threads);
+                return;
+            }
+            std::vector<limb> quotient(n - power.size() + 1);
+            std::vector<limb> remainder(power.size());
+            divrem(quotient.data(), remainder.data(), a, n, power.data(), power.size());
+            if (threads > 0 && n >= TO_STRING_PARALLEL_THRESHOLD) {
+                // Степени для обеих половин вычисляются до разделения
+                decimal_power(level - 1);
+                std::thread high([&] {
+                    to_decimal(quotient.data(), quotient.size(), level - 1, out, threads - 1);
+                });
+                to_decimal(remainder.data(), remainder.size(), level - 1, out + half, threads - 1);
+                high.join();
+                return;
+            }
+            to_decimal(quotient.data(), quotient.size(), level - 1, out, threads);
+            to_decimal(remainder.data(), remainder.size(), level - 1, out + half, threads);
+        }
+
+
+        inline std::string to_decimal(const limb* a, size_t n) {
+            n = trimmed(a, n);
+            if (n == 0) {
+                return "0";
+            }
+            // Наименьший уровень, для которого a < 10^(D 2^(level + 1))
+            size_t level = 0;
+            while (compare(a, n, decimal_power(level + 1).data(), decimal_power(level + 1).size()) >= 0) {
+                ++level;
+            }
+            unsigned threads = 0;
+            for (unsigned cores = std::thread::hardware_concurrency(); cores > 1; cores /= 2) {
+                ++threads;
+            }
+            std::string digits((DECIMAL_CHUNK_DIGITS * 2) << level, '0');
+            to_decimal(a, n, level, &digits[0], std::min(threads, 3u));
+            return digits.substr(std::min(digits.find_first_not_of('0'), digits.size() - 1));
+        }
+
+
+        // Перевод из десятичной записи: цифры читаются кусками по
+        //   D, куски -- цифры по основанию 10^D (старшие первыми),
+        //   которые склеиваются пополам: старшая половина умножается на
+        //   10^(D 2^i) из decimal_power и к ней прибавляется
+        //   младшая.
+        // Не больше стольких кусков склеиваются по схеме Горнера
+        constexpr size_t FROM_STRING_THRESHOLD = 32;
+
+
+        // r = r * m + c (n цифр), возвращает старшую цифру
+        inline limb mul_1_add(limb* r, size_t n, limb m, limb c) {
+            for (size_t i = 0; i < n; ++i) {
+                double_limb cur = static_cast<double_limb>(r[i]) * m + c;
+                r[i] = static_cast<limb>(cur);
+                c = static_cast<limb>(cur >> LIMB_BITS);
+            }
+            return c;
+        }
+
+
+        // r[0, n) = значение n кусков chunks
+        inline void from_decimal_chunks(limb* r, const limb* chunks, size_t n) {
+            std::fill(r, r + n, 0);
+            if (n <= FROM_STRING_THRESHOLD) {
+                size_t used = 0;
+                for (size_t i = 0; i < n; ++i) {
+                    limb carry = mul_1_add(r, used, DECIMAL_CHUNK, chunks[i]);
+                    if (carry) {
+                        r[used++] = carry;
+                    }
+                }
+                return;
+            }
+            // Младшая половина -- 2^level кусков, 2^level < n <= 2^(level + 1)
+            size_t level = 0;
+            while ((size_t{2} << level) < n) {
+                ++level;
+            }
+            const size_t low_size = size_t{1} << level;
+            const size_t high_size = n - low_size;
+            std::vector<limb> high(high_size);
+            from_decimal_chunks(high.data(), chunks, high_size);
+            from_decimal_chunks(r, chunks + high_size, low_size);
+
+            const auto& power = decimal_power(level);
+            size_t hn = trimmed(high.data(), high_size);
+            if (hn == 0) {
+                return;
+            }
+            std::vector<limb> product(hn + power.size());
+            if (hn >= power.size()) {
+                mul(product.data(), high.data(), hn, power.data(), power.size());
+            } else {
+                mul(product.data(), power.data(), power.size(), high.data(), hn);
+            }
+            // Значение меньше 10^(D n), поэтому помещается в n цифр
+            add_to(r, n, product.data(), trimmed(product.data(), product.size()));
+        }
+
+
+        // Значение chunks, за которыми следуют tail_digits (< D) цифр tail
+        inline std::vector<limb> from_decimal(const std::vector<limb>& chunks, limb tail, size_t tail_digits) {
+            std::vector<limb> r(chunks.size() + 1); // NRVO
+            from_decimal_chunks(r.data(), chunks.data(), chunks.size());
+            if (tail_digits > 0) {
+                limb scale = 1;
+                for (size_t i = 0; i < tail_digits; ++i) {
+                    scale *= 10;
+                }
+                r.back() = mul_1_add(r.data(), chunks.size(), scale, tail);
+            }
+            r.resize(trimmed(r.data(), r.size()));
+            return r;
+        }
+
+
+        // Значение count цифр '0'..'9'
+        inline std::vector<limb> from_decimal(const char* digits, size_t count) {
+            std::vector<limb> chunks(count / DECIMAL_CHUNK_DIGITS);
+            for (auto& chunk : chunks) {
+                for (size_t i = 0; i < DECIMAL_CHUNK_DIGITS; ++i) {
+                    chunk = chunk * 10 + static_cast<limb>(*digits++ - '0');
+                }
+            }
+            limb tail = 0;
+            for (size_t i = 0; i < count % DECIMAL_CHUNK_DIGITS; ++i) {
+                tail = tail * 10 + static_cast<limb>(*digits++ - '0');
+            }
+            return from_decimal(chunks, tail, count % DECIMAL_CHUNK_DIGITS);
+        }
+
+    } // namespace detail
+
     class bignum {
     public:
         bignum() : bigval(nullptr), small(0) {}
@@ -27,7 +1062,7 @@ namespace mp {
             , small(other.small)
         {
             if (other.bigval) {
-                bigval = new std::vector<uint32_t>(*other.bigval);
+                bigval = new std::vector<detail::limb>(*other.bigval);
             }
         }
 
@@ -38,7 +1073,7 @@ namespace mp {
                 bigval = nullptr;
                 small = other.small;
                 if (other.bigval) {
-                    bigval = new std::vector<uint32_t>(*other.bigval);
+                    bigval = new std::vector<detail::limb>(*other.bigval);
                 }
             }
             return *this;
@@ -48,15 +1083,14 @@ namespace mp {
         explicit bignum(const std::string& decimals)
             : bignum()
         {
-            if (decimals.size() < MAX_SMALL_LENGTH) {
-                std::istringstream iss(decimals);
-                iss >> small;
-            } else {
-                bigval = new std::vector<uint32_t>(1, 0);
-                for (char decimal : decimals) {
-                    *this *= 10u;
-                    *this += static_cast<uint32_t>(decimal - '0');
+            size_t start = !decimals.empty() && decimals[0] == '+';
+            size_t count = decimals.size() - start;
+            if (count < MAX_SMALL_LENGTH) {
+                for (size_t i = start; i < decimals.size(); ++i) {
+                    small = small * 10 + static_cast<uint64_t>(decimals[i] - '0');
                 }
+            } else {
+                assign(detail::from_decimal(decimals.data() + start, count));
             }
         }
 
@@ -65,21 +1099,7 @@ namespace mp {
             if (!bigval) {
                 return std::to_string(small);
             }
-            std::string res = {0};
-            for (auto it = bigval->rbegin(); it != bigval->rend(); ++it) {
-                mul_decimals(res, {6, 9, 2, 7, 6, 9, 4, 9, 2, 4}); // 2^32 = 4294967296
-                std::string str = std::to_string(*it);
-                std::reverse(str.begin(), str.end());
-                for (auto& d : str) {
-                    d -= '0';
-                }
-                sum_decimals(res, str);
-            }
-            for (auto& d : res) {
-                d += '0';
-            }
-            std::reverse(res.begin(), res.end());
-            return res;
+            return detail::to_decimal(bigval->data(), bigval->size());
         }
 
 
@@ -87,7 +1107,7 @@ namespace mp {
             if (!bigval) {
                 return small;
             }
-            return bigval->front();
+            return static_cast<uint32_t>(bigval->front());
         }
 
 
@@ -106,25 +1126,11 @@ namespace mp {
             if (!bigval) {
                 init_big();
             }
-            uint32_t rem = 0;
-            size_t new_size = std::max(bigval->size(), rhs.bigval->size()) + 1;
-            for (size_t i = 0; i < new_size; ++i) {
-                uint64_t sum = rem;
-                if (i < rhs.bigval->size()) {
-                    sum += rhs.bigval->at(i);
-                }
-                if (i < bigval->size()) {
-                    sum += bigval->at(i);
-                }
-                bigval->at(i) = static_cast<uint32_t>(sum);
-                rem = static_cast<uint32_t>(sum >> 32u);
-                if (i + 1 == bigval->size()) {
-                    bigval->push_back(0);
-                }
-            }
-            while (bigval->size() > 1 && bigval->back() == 0) {
-                bigval->pop_back();
-            }
+            // rhs может совпадать с *this: размер берется до resize
+            size_t size = rhs.bigval->size();
+            bigval->resize(std::max(bigval->size(), size) + 1);
+            detail::add_to(bigval->data(), bigval->size(), rhs.bigval->data(), size);
+            trim();
             return *this;
         }
 
@@ -136,26 +1142,15 @@ namespace mp {
             if (!bigval) {
                 init_big();
             }
-            std::vector<uint64_t> result(bigval->size() + rhs.bigval->size() + 2);
-            for (size_t i = 0; i < bigval->size(); ++i) {
-                for (size_t j = 0; j < rhs.bigval->size(); ++j) {
-                    result[i + j] += static_cast<uint64_t>(bigval->at(i)) * rhs.bigval->at(j);
-                }
-                uint32_t rem = 0;
-                for (uint64_t & j : result) {
-                    j += rem;
-                    rem = j >> 32u;
-                    j = static_cast<uint32_t>(j);
-                }
+            const std::vector<detail::limb>* a = bigval;
+            const std::vector<detail::limb>* b = rhs.bigval;
+            if (a->size() < b->size()) {
+                std::swap(a, b);
             }
-            bigval->resize(result.size());
-            for (size_t i = 0; i < bigval->size(); ++i) {
-                bigval->at(i) = result[i];
-            }
-            while (bigval->size() > 1 && bigval->back() == 0) {
-                bigval->pop_back();
-            }
-
+            std::vector<detail::limb> result(a->size() + b->size());
+            detail::mul(result.data(), a->data(), a->size(), b->data(), b->size());
+            bigval->swap(result);
+            trim();
             return *this;
         }
 
@@ -172,25 +1167,35 @@ namespace mp {
                 init_big();
             }
 
-            if (mul > std::numeric_limits<uint32_t>::max()) {
-                bignum tmp = *this;
-                tmp *= static_cast<uint32_t>(mul);
-                *this *= mul >> 32u;
-                bigval->push_back(0);
-                return *this += tmp;
-            }
-
-            uint32_t rem = 0;
-            for (auto& digit : *bigval) {
-                uint64_t prod = mul;
-                prod *= digit;
-                prod += rem;
-                digit = static_cast<uint32_t>(prod);
-                rem = static_cast<uint32_t>(prod >> 32u);
+            detail::limb limbs[detail::SMALL_LIMBS];
+            to_limbs(mul, limbs);
+            size_t n = bigval->size();
+            size_t m = detail::trimmed(limbs, detail::SMALL_LIMBS);
+            if (m == 0) {
+                bigval->assign(1, 0);
+                return *this;
             }
-            if (rem > 0) {
-                bigval->push_back(rem);
+            std::vector<detail::limb> result(n + m);
+            if (n >= m) {
+                detail::mul(result.data(), bigval->data(), n, limbs, m);
+            } else {
+                detail::mul(result.data(), limbs, m, bigval->data(), n);
             }
+            bigval->swap(result);
+            trim();
+            return *this;
+        }
+
+
+        // Деление на ноль бросает std::domain_error
+        bignum& operator/=(const bignum& rhs) {
+            divide(*this, rhs, this, nullptr);
+            return *this;
+        }
+
+
+        bignum& operator%=(const bignum& rhs) {
+            divide(*this, rhs, nullptr, this);
             return *this;
         }
 
@@ -204,93 +1209,113 @@ namespace mp {
                 init_big();
             }
 
-            bool overflow = add > std::numeric_limits<uint32_t>::max();
-            uint64_t low = static_cast<uint32_t>(add);
-            uint32_t back = bigval->back();
+            detail::limb limbs[detail::SMALL_LIMBS];
+            to_limbs(add, limbs);
+            bigval->resize(std::max(bigval->size(), detail::SMALL_LIMBS) + 1);
+            detail::add_to(bigval->data(), bigval->size(), limbs, detail::SMALL_LIMBS);
+            trim();
+            return *this;
+        }
 
-            if (overflow) {
-                bigval->pop_back();
-                if (bigval->empty()) {
-                    bigval->push_back(0);
-                }
-                add >>= 32u;
-            }
 
-            uint32_t rem = add;
-            for (auto& digit32 : *bigval) {
-                uint64_t sum = rem;
-                auto& t = bigval;
-                (void) t;
-                sum += digit32;
-                digit32 = static_cast<uint32_t>(sum);
-                rem = static_cast<uint32_t>(sum >> 32u);
-            }
-            if (rem > 0) {
-                bigval->push_back(rem);
-            }
+    private:
+        friend std::istream& operator>>(std::istream& in, bignum& num);
+        friend std::pair<bignum, bignum> divmod(const bignum& lhs, const bignum& rhs);
 
-            if (overflow) {
-                bigval->push_back(back);
-                *this += low;
-            }
 
-            return *this;
+        // value по цифрам, младшие первыми
+        static void to_limbs(uint64_t value, detail::limb* limbs) {
+            for (size_t i = 0; i < detail::SMALL_LIMBS; ++i) {
+                limbs[i] = static_cast<detail::limb>(value >> (detail::LIMB_BITS * i));
+            }
         }
 
 
-    private:
-        void init_big() {
-            assert(!bigval);
-            bigval = new std::vector<uint32_t>{
-                static_cast<uint32_t>(small),
-                static_cast<uint32_t>(small >> 32u)
-            };
+        void trim() {
+            bigval->resize(std::max<size_t>(detail::trimmed(bigval->data(), bigval->size()), 1));
         }
 
 
-        static void mul_decimals(
-                std::string& num1,
-                const std::string& num2
-        ) {
-            std::string result(num1.size() + num2.size(), 0);
-            for (size_t i = 0; i < num1.size(); ++i) {
-                for (size_t j = 0; j < num2.size(); ++j) {
-                    result[i + j] += num1[i] *  num2[j];
-                }
-
-                for (size_t j = 0; j < result.size() - 1; ++j) {
-                    result[j + 1] += result[j] / 10;
-                    result[j] = result[j] % 10;
-                }
+        // Значение из цифр limbs; короткое хранится в small
+        void assign(std::vector<detail::limb>&& limbs) {
+            limbs.resize(detail::trimmed(limbs.data(), limbs.size()));
+            if (limbs.size() > detail::SMALL_LIMBS) {
+                delete bigval;
+                bigval = new std::vector<detail::limb>(std::move(limbs));
+                small = 0;
+                return;
             }
-            while (result.size() > 1 && result.back() == 0) {
-                result.pop_back();
+            uint64_t value = 0;
+            for (size_t i = 0; i < limbs.size(); ++i) {
+                value |= static_cast<uint64_t>(limbs[i]) << (detail::LIMB_BITS * i);
             }
-            num1 = result;
+            assign_small(value);
         }
 
 
-        static void sum_decimals(
-                std::string& num1,
-                const std::string& num2
-        ) {
-            for (size_t i = 0; i < num2.size(); ++i) {
-                num1[i] += num2[i];
-                if (i + 1 == num1.size()) {
-                    num1.push_back(0);
+        void assign_small(uint64_t value) {
+            delete bigval;
+            bigval = nullptr;
+            small = value;
+        }
+
+
+        // quotient = lhs / rhs, remainder = lhs % rhs; любой из них может
+        //   быть nullptr или совпадать с lhs или rhs
+        static void divide(const bignum& lhs, const bignum& rhs, bignum* quotient, bignum* remainder) {
+            if (!rhs) {
+                throw std::domain_error("division by zero");
+            }
+            if (!lhs.bigval && !rhs.bigval) {
+                uint64_t q = lhs.small / rhs.small;
+                uint64_t r = lhs.small % rhs.small;
+                if (quotient) {
+                    quotient->assign_small(q);
                 }
+                if (remainder) {
+                    remainder->assign_small(r);
+                }
+                return;
             }
-            for (size_t j = 0; j < num1.size() - 1; ++j) {
-                num1[j + 1] += num1[j] / 10;
-                num1[j] = num1[j] % 10;
+
+            detail::limb lhs_small[detail::SMALL_LIMBS];
+            detail::limb rhs_small[detail::SMALL_LIMBS];
+            to_limbs(lhs.small, lhs_small);
+            to_limbs(rhs.small, rhs_small);
+            const detail::limb* a = lhs.bigval ? lhs.bigval->data() : lhs_small;
+            const detail::limb* b = rhs.bigval ? rhs.bigval->data() : rhs_small;
+            size_t n = detail::trimmed(a, lhs.bigval ? lhs.bigval->size() : detail::SMALL_LIMBS);
+            size_t m = detail::trimmed(b, rhs.bigval ? rhs.bigval->size() : detail::SMALL_LIMBS);
+
+            std::vector<detail::limb> q;
+            std::vector<detail::limb> r;
+            if (n < m) {
+                r.assign(a, a + n);
+            } else if (m == 1) {
+                q.resize(n);
+                r.push_back(detail::divrem_1(q.data(), a, n, b[0]));
+            } else {
+                q.resize(n - m + 1);
+                r.resize(m);
+                detail::divrem(q.data(), r.data(), a, n, b, m);
+            }
+            if (quotient) {
+                quotient->assign(std::move(q));
             }
-            while (num1.size() > 1 && num1.back() == 0) {
-                num1.pop_back();
+            if (remainder) {
+                remainder->assign(std::move(r));
             }
         }
 
 
-        std::vector<uint32_t>* bigval;
+        void init_big() {
+            assert(!bigval);
+            bigval = new std::vector<detail::limb>(detail::SMALL_LIMBS);
+            to_limbs(small, bigval->data());
+        }
+
+
+        std::vector<detail::limb>* bigval;
         uint64_t small; // small object optimization
     };
 
@@ -312,19 +1337,76 @@ namespace mp {
 
 
 
+    inline bignum operator/(const bignum& lhs, const bignum& rhs) {
+        bignum res = lhs;
+        res /= rhs;
+        return res;
+    }
+
+
+
+    inline bignum operator%(const bignum& lhs, const bignum& rhs) {
+        bignum res = lhs;
+        res %= rhs;
+        return res;
+    }
+
+
+
+    // Частное и остаток за одно деление
+    inline std::pair<bignum, bignum> divmod(const bignum& lhs, const bignum& rhs) {
+        std::pair<bignum, bignum> res;
+        bignum::divide(lhs, rhs, &res.first, &res.second);
+        return res;
+    }
+
+
+
     inline std::ostream& operator<<(std::ostream& out, const bignum& num) {
         return out << num.to_string();
     }
 
 
 
+    // Цифры читаются прямо из буфера потока и сразу собираются в куски
+    //   по DECIMAL_CHUNK_DIGITS; чтение останавливается на первом символе, не являющемся
+    //   цифрой
     inline std::istream& operator>>(std::istream& in, bignum& num) {
-        std::string s;
-        if (in.peek() == '+') {
-            in.get();
+        std::istream::sentry sentry(in);
+        if (!sentry) {
+            return in;
+        }
+        std::streambuf* buf = in.rdbuf();
+        using traits = std::istream::traits_type;
+        if (buf->sgetc() == '+') {
+            buf->sbumpc();
+        }
+
+        std::vector<detail::limb> chunks;
+        detail::limb chunk = 0;
+        size_t chunk_digits = 0;
+        bool any = false;
+        int c = buf->sgetc();
+        for (; c != traits::eof() && c >= '0' && c <= '9'; c = buf->snextc()) {
+            any = true;
+            if (chunk_digits == 0 && chunk == 0 && chunks.empty() && c == '0') {
+                continue; // нули в начале
+            }
+            chunk = chunk * 10 + static_cast<detail::limb>(c - '0');
+            if (++chunk_digits == detail::DECIMAL_CHUNK_DIGITS) {
+                chunks.push_back(chunk);
+                chunk = 0;
+                chunk_digits = 0;
+            }
+        }
+        if (c == traits::eof()) {
+            in.setstate(std::ios_base::eofbit);
+        }
+        if (!any) {
+            in.setstate(std::ios_base::failbit);
+            return in;
         }
-        in >> s;
-        num = bignum(s);
+        num.assign(detail::from_decimal(chunks, chunk, chunk_digits));
         return in;
     }
 
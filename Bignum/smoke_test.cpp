@@ -158,6 +158,122 @@ void check_const()
     assert(n3.to_string() == "10");
 }
 
+// (10^k - 1) * (10^j - 1), k >= j: 9..9 8 9..9 0..0 1
+std::string nines_product(size_t k, size_t j)
+{
+    return std::string(j - 1, '9') + "8" + std::string(k - j, '9') + std::string(j - 1, '0') + "1";
+}
+
+void check_big_multiplication()
+{
+    // Karatsuba starts at 32 limbs (617 digits with 64-bit limbs); 1500
+    //   by 700 digits is cut into balanced pieces
+    for (size_t k : {700, 1500}) {
+        mp::bignum n1(std::string(k, '9'));
+        assert((n1 * n1).to_string() == nines_product(k, k));
+        for (size_t j : {20, 700}) {
+            mp::bignum n2(std::string(j, '9'));
+            assert((n1 * n2).to_string() == nines_product(k, j));
+            assert((n2 * n1).to_string() == nines_product(k, j));
+        }
+    }
+
+    // Toom-3 starts at 128 limbs (2467 digits)
+    mp::bignum n4(std::string(2500, '9'));
+    assert((n4 * n4).to_string() == nines_product(2500, 2500));
+
+    mp::bignum n3(std::string(800, '9'));
+    n3 *= n3;
+    assert(n3.to_string() == nines_product(800, 800));
+
+    // NTT starts at 4096 limbs (78914 digits)
+    mp::bignum n5(std::string(80000, '9'));
+    assert((n5 * n5).to_string() == nines_product(80000, 80000));
+}
+
+void check_to_string()
+{
+    // 10^(2^16) and its square: powers of ten on chunk boundaries
+    mp::bignum n1(10);
+    for (int i = 0; i < 16; ++i) {
+        n1 *= n1;
+    }
+    assert(n1.to_string() == "1" + std::string(65536, '0'));
+    n1 += 1;
+    assert((n1 * n1).to_string()
+        == "1" + std::string(65535, '0') + "2" + std::string(65535, '0') + "1");
+
+    mp::bignum n2(std::string("33232930569601"));
+    n2 *= 33232930569601;
+    assert(n2.to_string() == "1104427674243920646305299201");
+
+    std::string digits;
+    for (int i = 1; i <= 5000; ++i) {
+        digits += std::to_string(i * 7919 % 10007);
+    }
+    assert(mp::bignum(digits).to_string() == digits);
+}
+
+void check_big_io()
+{
+    // Longer than 32 chunks of 19 digits: parsed by halves
+    std::string digits;
+    for (int i = 1; i <= 3000; ++i) {
+        digits += std::to_string(i * 7919 % 10007);
+    }
+    std::istringstream istr1("  +000" + digits + " 42");
+    mp::bignum n1;
+    mp::bignum n2;
+    istr1 >> n1 >> n2;
+    assert(n1.to_string() == digits);
+    assert(n2.to_string() == "42");
+    assert(istr1.eof());
+
+    mp::bignum n3("+" + std::string(30, '0') + "123");
+    assert(n3.to_string() == "123");
+    assert(std::uint32_t(n3) == 123);
+
+    std::istringstream istr2("x");
+    istr2 >> n3;
+    assert(istr2.fail());
+    assert(n3.to_string() == "123");
+}
+
+void check_division()
+{
+    mp::bignum n1(std::string("1234567890123"));
+    assert((n1 / mp::bignum(1000)).to_string() == "1234567890");
+    assert((n1 % mp::bignum(1000)).to_string() == "123");
+
+    // One limb divisor
+    mp::bignum n2(std::string(100, '9'));
+    assert((n2 / mp::bignum(9)).to_string() == std::string(100, '1'));
+    assert((n2 % mp::bignum(10)).to_string() == "9");
+
+    // Divisors of 21 limbs: Knuth, of 208 limbs: divided by halves
+    for (size_t k : {400, 4000}) {
+        mp::bignum n3(std::string(k, '9'));
+        mp::bignum n4(nines_product(k, k));
+        n4 += 12345u;
+        auto qr = mp::divmod(n4, n3);
+        assert(qr.first.to_string() == std::string(k, '9'));
+        assert(qr.second.to_string() == "12345");
+        assert((n3 / n4).to_string() == "0");
+        assert((n3 % n4).to_string() == std::string(k, '9'));
+        n3 /= n3;
+        assert(n3.to_string() == "1");
+    }
+
+    bool thrown = false;
+    try {
+        n1 /= mp::bignum(0);
+    } catch (const std::domain_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(n1.to_string() == "1234567890123");
+}
+
 std::pair<uint32_t, uint32_t> get_monom(const std::string& str, size_t& pos) {
     char* next = nullptr;
     uint32_t coeff = std::strtoull(str.c_str() + pos, &next, 0);
@@ -192,4 +308,8 @@ int main()
     check_io();
     check_operators();
     check_const();
+    check_big_multiplication();
+    check_to_string();
+    check_big_io();
+    check_division();
 }
@@ -0,0 +1,423 @@
+#include "archive.hpp"
+#include "huffman.hpp"
+#include "search.hpp"
+#include "tune.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+namespace {
+
+    constexpr char MAGIC[4] = {'H', 'F', 'A', 'R'};
+    constexpr uint8_t VERSION = 4;
+    constexpr uint64_t HEADER_SIZE = ARCHIVE_HEADER_SIZE;
+    static_assert(HEADER_SIZE == sizeof(MAGIC) + 1, "magic and version");
+    constexpr uint64_t FOOTER_SIZE = 8 + 8 + sizeof(MAGIC);
+    constexpr uint64_t BLOCK_ENTRY_SIZE = 8 + 4 + 4 + 4 + 1 + 1;
+    // Шаг, с которым выбираются границы блоков
+    constexpr uint32_t SPLIT_SEGMENT_SIZE = 16u << 10u;
+
+
+    // Запись чисел в little-endian
+    struct ByteWriter {
+        std::vector<uint8_t> data;
+
+        void put(uint64_t value, int bytes) {
+            for (int i = 0; i < bytes; ++i) {
+                data.push_back(static_cast<uint8_t>(value >> (8u * i)));
+            }
+        }
+
+        void put(const std::string& str) {
+            data.insert(data.end(), str.begin(), str.end());
+        }
+    };
+
+
+    // Чтение чисел в little-endian с проверкой границ
+    struct ByteReader {
+        const uint8_t* pos;
+        const uint8_t* end;
+
+        uint64_t get(int bytes) {
+            check(bytes);
+            uint64_t value = 0;
+            for (int i = 0; i < bytes; ++i) {
+                value |= static_cast<uint64_t>(*pos++) << (8u * i);
+            }
+            return value;
+        }
+
+        std::vector<uint8_t> get_bytes(size_t size) {
+            check(size);
+            std::vector<uint8_t> bytes(pos, pos + size);
+            pos += size;
+            return bytes;
+        }
+
+        // Число записей не меньше чем по entry_size байтов каждая:
+        //    испорченный счетчик не должен выделять память под них
+        uint64_t get_count(int bytes, uint64_t entry_size) {
+            uint64_t count = get(bytes);
+            if (count > static_cast<uint64_t>(end - pos) / entry_size) {
+                throw archive_error("corrupted archive directory");
+            }
+            return count;
+        }
+
+        std::string get_string(size_t size) {
+            auto bytes = get_bytes(size);
+            return std::string(bytes.begin(), bytes.end());
+        }
+
+        void check(size_t size) const {
+            if (static_cast<size_t>(end - pos) < size) {
+                throw archive_error("corrupted archive directory");
+            }
+        }
+    };
+
+
+    using Histogram = std::array<uint64_t, 256>;
+
+
+    // Оценка размера сжатого блока в битах: энтропия данных (не меньше
+    //    бита на символ), таблица кодов и запись в каталоге.
+    double estimate_block_bits(const Histogram& hist, uint64_t size) {
+        double bits = 0;
+        uint64_t alphabet = 0;
+        for (uint64_t freq : hist) {
+            if (freq > 0) {
+                bits -= freq * std::log2(static_cast<double>(freq) / size);
+                ++alphabet;
+            }
+        }
+        double table_bits = 8 * (alphabet + 2) + 2 * alphabet;
+        return std::max(bits, static_cast<double>(size)) + table_bits + 8 * BLOCK_ENTRY_SIZE;
+    }
+
+
+    // Выгоднее ли закончить блок перед сегментом, чем дописать сегмент в блок
+    bool should_split(
+        const Histogram& block,
+        uint64_t block_size,
+        const Histogram& segment,
+        uint64_t segment_size
+    ) {
+        Histogram merged;
+        for (size_t symbol = 0; symbol < 256; ++symbol) {
+            merged[symbol] = block[symbol] + segment[symbol];
+        }
+        double apart = estimate_block_bits(block, block_size)
+            + estimate_block_bits(segment, segment_size);
+        return apart < estimate_block_bits(merged, block_size + segment_size);
+    }
+
+
+    std::vector<uint8_t> read_at(std::istream& istr, uint64_t offset, uint64_t size) {
+        std::vector<uint8_t> data(size);
+        istr.seekg(offset);
+        istr.read(reinterpret_cast<char*>(data.data()), size);
+        if (static_cast<uint64_t>(istr.gcount()) != size) {
+            throw archive_error("unexpected end of archive");
+        }
+        return data;
+    }
+
+} // \ARCHIVE
+
+
+std::string member_name(const std::string& file) {
+    auto path = std::filesystem::path(file).relative_path().lexically_normal();
+    if (path.empty() || *path.begin() == "..") {
+        path = std::filesystem::path(file).filename();
+    }
+    return path.generic_string();
+}
+
+
+uint32_t default_block_size() {
+    uint32_t block_size = tuned_config().block_size;
+    return block_size > 0 ? block_size : DEFAULT_BLOCK_SIZE;
+}
+
+
+void write_archive_header(std::ostream& ostr) {
+    ostr.write(MAGIC, sizeof(MAGIC));
+    ostr.put(static_cast<char>(VERSION));
+}
+
+
+void write_archive_directory(
+    std::ostream& ostr,
+    const std::vector<ArchiveMember>& members,
+    uint64_t offset
+) {
+    ByteWriter dir;
+    dir.put(members.size(), 4);
+    for (const auto& member : members) {
+        dir.put(member.name.size(), 2);
+        dir.put(member.name);
+        dir.put(member.raw_size, 8);
+        dir.put(member.blocks.size(), 4);
+        for (const auto& block : member.blocks) {
+            dir.put(block.offset, 8);
+            dir.put(block.raw_size, 4);
+            dir.put(block.size, 4);
+            dir.put(block.summary.size(), 4);
+            dir.data.insert(dir.data.end(), block.summary.begin(), block.summary.end());
+            dir.put(filter_code(block.plan.filter), 1);
+            dir.put(static_cast<uint8_t>(block.plan.coder), 1);
+        }
+    }
+
+    ByteWriter footer;
+    footer.put(offset, 8);
+    footer.put(dir.data.size(), 8);
+    footer.data.insert(footer.data.end(), MAGIC, MAGIC + sizeof(MAGIC));
+
+    ostr.write(reinterpret_cast<const char*>(dir.data.data()), dir.data.size());
+    ostr.write(reinterpret_cast<const char*>(footer.data.data()), footer.data.size());
+}
+
+
+void create_archive(
+    std::ostream& ostr,
+    const std::vector<std::string>& files,
+    uint32_t block_size,
+    bool split,
+    const BlockOptions& options
+) {
+    write_archive_header(ostr);
+    uint64_t offset = HEADER_SIZE;
+
+    std::vector<ArchiveMember> members;
+    for (const auto& file : files) {
+        std::ifstream fin(file, std::ios::binary);
+        if (!fin) {
+            throw archive_error("cannot open " + file);
+        }
+
+        ArchiveMember member{member_name(file), 0, {}};
+        auto write_block = [&](const std::vector<uint8_t>& data) {
+            BlockPlan plan;
+            auto block = compress_block(data.data(), data.size(), options, &plan);
+            ostr.write(reinterpret_cast<char*>(block.data()), block.size());
+
+            member.blocks.push_back({
+                offset,
+                static_cast<uint32_t>(data.size()),
+                static_cast<uint32_t>(block.size()),
+                trigram_summary(data.data(), data.size()),
+                plan
+            });
+            member.raw_size += data.size();
+            offset += block.size();
+        };
+
+        // Данные читаются сегментами; перед добавлением сегмента к блоку
+        //    решаем, не выгоднее ли начать с него новый блок.
+        std::vector<uint8_t> pending;
+        Histogram pending_hist{};
+        std::vector<char> segment(std::min(SPLIT_SEGMENT_SIZE, block_size));
+        while (fin.read(segment.data(), segment.size()), fin.gcount() > 0) {
+            auto segment_size = static_cast<uint64_t>(fin.gcount());
+            auto segment_data = reinterpret_cast<const uint8_t*>(segment.data());
+            auto segment_hist = byte_histogram(segment_data, segment_size);
+
+            if (pending.size() + segment_size > block_size
+                || (split && !pending.empty()
+                    && should_split(pending_hist, pending.size(), segment_hist, segment_size))) {
+                write_block(pending);
+                pending.clear();
+                pending_hist = {};
+            }
+            pending.insert(pending.end(), segment_data, segment_data + segment_size);
+            for (size_t symbol = 0; symbol < 256; ++symbol) {
+                pending_hist[symbol] += segment_hist[symbol];
+            }
+        }
+        if (!pending.empty()) {
+            write_block(pending);
+        }
+        members.push_back(std::move(member));
+    }
+
+    write_archive_directory(ostr, members, offset);
+    if (!ostr) {
+        throw archive_error("write error");
+    }
+}
+
+
+bool is_archive(std::istream& istr) {
+    istr.clear();
+    istr.seekg(0, std::istream::end);
+    auto size = static_cast<uint64_t>(istr.tellg());
+    if (!istr || size < HEADER_SIZE + FOOTER_SIZE) {
+        istr.clear();
+        return false;
+    }
+    auto header = read_at(istr, 0, HEADER_SIZE);
+    auto footer = read_at(istr, size - FOOTER_SIZE, FOOTER_SIZE);
+    return std::equal(MAGIC, MAGIC + sizeof(MAGIC), header.begin())
+        && std::equal(MAGIC, MAGIC + sizeof(MAGIC), footer.end() - sizeof(MAGIC));
+}
+
+
+std::vector<ArchiveMember> list_archive(std::istream& istr) {
+    if (!is_archive(istr)) {
+        throw archive_error("not an archive");
+    }
+    istr.seekg(0, std::istream::end);
+    auto size = static_cast<uint64_t>(istr.tellg());
+
+    auto header = read_at(istr, 0, HEADER_SIZE);
+    auto footer = read_at(istr, size - FOOTER_SIZE, FOOTER_SIZE);
+    uint8_t version = header.back();
+    if (version == 0 || version > VERSION) {
+        throw archive_error("unsupported archive version");
+    }
+
+    ByteReader footer_reader{footer.data(), footer.data() + footer.size()};
+    uint64_t dir_offset = footer_reader.get(8);
+    uint64_t dir_size = footer_reader.get(8);
+    if (dir_offset < HEADER_SIZE || dir_size > size - FOOTER_SIZE - dir_offset) {
+        throw archive_error("corrupted archive footer");
+    }
+
+    auto dir = read_at(istr, dir_offset, dir_size);
+    ByteReader reader{dir.data(), dir.data() + dir.size()};
+    // Наименьшие записи: файл без имени и блоков, блок с пустой сводкой
+    const uint64_t member_entry_size = 2 + 8 + 4;
+    const uint64_t block_entry_size = 8 + 4 + 4 + (version >= 2 ? 4 : 0) + (version >= 3 ? 1 : 0)
+        + (version >= 4 ? 1 : 0);
+    std::vector<ArchiveMember> members(reader.get_count(4, member_entry_size)); // NRVO
+    for (auto& member : members) {
+        member.name = reader.get_string(reader.get(2));
+        member.raw_size = reader.get(8);
+        member.blocks.resize(reader.get_count(4, block_entry_size));
+        for (auto& block : member.blocks) {
+            block.offset = reader.get(8);
+            block.raw_size = static_cast<uint32_t>(reader.get(4));
+            block.size = static_cast<uint32_t>(reader.get(4));
+            if (version >= 2) {
+                block.summary = reader.get_bytes(reader.get(4));
+            }
+            if (version >= 3) {
+                block.plan.filter = filter_from_code(static_cast<uint8_t>(reader.get(1)));
+            }
+            if (version >= 4) {
+                auto coder = reader.get(1);
+                if (coder > static_cast<uint8_t>(BlockCoder::STORED)) {
+                    throw archive_error("unknown block coder");
+                }
+                block.plan.coder = static_cast<BlockCoder>(coder);
+            }
+            if (block.offset < HEADER_SIZE || block.offset + block.size > dir_offset) {
+                throw archive_error("corrupted archive directory");
+            }
+        }
+    }
+    return members;
+}
+
+
+std::vector<uint8_t> read_block(
+    std::istream& istr,
+    const ArchiveBlock& block,
+    unsigned threads
+) {
+    auto compressed = read_at(istr, block.offset, block.size);
+    return decompress_block(compressed.data(), compressed.size(), block.raw_size, block.plan, threads);
+}
+
+
+void extract_member(
+    std::istream& istr,
+    const ArchiveMember& member,
+    std::ostream& ostr,
+    unsigned threads
+) {
+    for (const auto& block : member.blocks) {
+        auto decoded = read_block(istr, block, threads);
+        ostr.write(reinterpret_cast<char*>(decoded.data()), decoded.size());
+    }
+    if (!ostr) {
+        throw archive_error("write error");
+    }
+}
+
+
+void extract_archive(
+    const std::string& archive,
+    const std::string& dir,
+    const std::vector<std::string>& names,
+    unsigned threads
+) {
+    std::vector<ArchiveMember> members;
+    {
+        std::ifstream fin(archive, std::ios::binary);
+        for (auto& member : list_archive(fin)) {
+            if (names.empty()
+                || std::find(names.begin(), names.end(), member.name) != names.end()) {
+                members.push_back(std::move(member));
+            }
+        }
+    }
+    for (const auto& name : names) {
+        auto same_name = [&](const ArchiveMember& m) { return m.name == name; };
+        if (std::none_of(members.begin(), members.end(), same_name)) {
+            throw archive_error("no such member: " + name);
+        }
+    }
+
+    // Потоки делятся между файлами; если файл один, его блоки
+    //    декодируются параллельно.
+    unsigned workers_count = std::min<size_t>(resolve_threads(threads), members.size());
+    unsigned block_threads = workers_count > 1 ? 1 : threads;
+
+    std::atomic<size_t> next{0};
+    std::vector<std::exception_ptr> errors(workers_count);
+    auto worker = [&](size_t id) {
+        try {
+            std::ifstream fin(archive, std::ios::binary);
+            for (size_t i = next++; i < members.size(); i = next++) {
+                const auto& member = members[i];
+                auto path = std::filesystem::path(member.name).lexically_normal();
+                if (path.is_absolute() || path.empty() || *path.begin() == "..") {
+                    throw archive_error("unsafe member name: " + member.name);
+                }
+                path = std::filesystem::path(dir) / path;
+                if (path.has_parent_path()) {
+                    std::filesystem::create_directories(path.parent_path());
+                }
+                std::ofstream fout(path, std::ios::binary);
+                extract_member(fin, member, fout, block_threads);
+            }
+        } catch (...) {
+            errors[id] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t id = 1; id < workers_count; ++id) {
+        workers.emplace_back(worker, id);
+    }
+    if (workers_count > 0) {
+        worker(0);
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    for (const auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "block.hpp"
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Архив из нескольких файлов. Каждый файл хранится как последовательность
+//   независимо сжатых блоков, в конце архива -- центральный каталог.
+//
+//   Формат:
+//     "HFAR" версия(1)
+//     блоки (каждый -- поток в формате encode)
+//     каталог: число файлов(4), для каждого файла
+//         длина имени(2) имя размер(8) число блоков(4),
+//         для каждого блока: смещение(8) исходный размер(4) сжатый размер(4)
+//             размер сводки(4) сводка (см. search.hpp; с версии 2)
+//             преобразование (см. filter.hpp; с версии 3)
+//             кодер (см. block.hpp; с версии 4)
+//     смещение каталога(8) размер каталога(8) "HFAR"
+//   Все числа хранятся в little-endian.
+
+constexpr uint32_t DEFAULT_BLOCK_SIZE = 1u << 20u;
+
+// Размер блока из настроек autotune (см. tune.hpp), иначе DEFAULT_BLOCK_SIZE
+uint32_t default_block_size();
+
+struct ArchiveBlock {
+    uint64_t offset;
+    uint32_t raw_size;
+    uint32_t size;
+    std::vector<uint8_t> summary;
+    BlockPlan plan;
+};
+
+struct ArchiveMember {
+    std::string name;
+    uint64_t raw_size;
+    std::vector<ArchiveBlock> blocks;
+};
+
+class archive_error : public std::runtime_error {
+public:
+    explicit archive_error(const std::string& what) : std::runtime_error(what) {}
+};
+
+// Имя файла в архиве: относительный путь без ".."
+std::string member_name(const std::string& file);
+
+// block_size -- максимальный размер блока. Если split, границы блоков
+//    выбираются так, чтобы уменьшить оценку сжатого размера: блок
+//    заканчивается там, где меняется статистика данных. options задает
+//    способ сжатия блоков.
+void create_archive(
+    std::ostream& ostr,
+    const std::vector<std::string>& files,
+    uint32_t block_size = default_block_size(),
+    bool split = true,
+    const BlockOptions& options = {}
+);
+
+// Запись архива по частям: заголовок, затем блоки (в потоке начиная
+//   со смещения ARCHIVE_HEADER_SIZE), затем каталог.
+constexpr uint64_t ARCHIVE_HEADER_SIZE = 5;
+void write_archive_header(std::ostream& ostr);
+void write_archive_directory(
+    std::ostream& ostr,
+    const std::vector<ArchiveMember>& members,
+    uint64_t directory_offset
+);
+
+bool is_archive(std::istream& istr);
+
+std::vector<ArchiveMember> list_archive(std::istream& istr);
+
+std::vector<uint8_t> read_block(
+    std::istream& istr,
+    const ArchiveBlock& block,
+    unsigned threads = 0
+);
+
+void extract_member(
+    std::istream& istr,
+    const ArchiveMember& member,
+    std::ostream& ostr,
+    unsigned threads = 0
+);
+
+// Извлекает файлы names (все, если names пуст) в каталог dir.
+//    Разные файлы извлекаются параллельно.
+void extract_archive(
+    const std::string& archive,
+    const std::string& dir,
+    const std::vector<std::string>& names,
+    unsigned threads = 0
+);
@@ -0,0 +1,148 @@
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "deflate.hpp"
+#include "filter.hpp"
+#include "huffman.hpp"
+#include "perf.hpp"
+#include "wide.hpp"
+#include "words.hpp"
+
+using namespace std;
+
+// Замер скорости кодирования и декодирования:
+//    ./bench [FILE...]
+// По умолчанию используются текстовые файлы из smoke_test.
+// Если доступны аппаратные счетчики, печатаются их значения на байт
+// исходных данных (в среднем по REPEATS запускам).
+
+namespace {
+
+    constexpr int REPEATS = 5;
+
+    template <class F>
+    void measure(const string& what, uint64_t size, F&& f) {
+        f(); // прогрев
+        PerfCounters counters;
+        counters.start();
+        for (int i = 0; i < REPEATS; ++i) {
+            f();
+        }
+        PerfSample sample = counters.stop();
+        sample.seconds /= REPEATS;
+        for (auto& count : sample.counts) {
+            count /= REPEATS;
+        }
+        print_perf(cout, "  " + what, sample, size);
+    }
+
+    void check(const vector<uint8_t>& decoded, const vector<uint8_t>& data) {
+        if (decoded != data) {
+            cout << "  MISMATCH\n";
+        }
+    }
+
+    void bench_file(const string& name) {
+        ifstream fin(name, ios::binary);
+        vector<uint8_t> data{istreambuf_iterator<char>(fin), istreambuf_iterator<char>()};
+        cout << name << " (" << data.size() << " bytes)\n";
+        if (data.empty()) {
+            return;
+        }
+
+        vector<uint8_t> compressed;
+        measure("encode", data.size(), [&] {
+            compressed = compress(data.data(), data.size());
+        });
+        cout << "  ratio: " << static_cast<double>(compressed.size()) / data.size() << '\n';
+
+        for (auto loop : {EncodeLoop::SCALAR, EncodeLoop::SERIAL}) {
+            vector<uint8_t> other;
+            measure(loop == EncodeLoop::SCALAR ? "encode, lanes without avx2" : "encode, serial", data.size(), [&] {
+                other = compress(data.data(), data.size(), loop);
+            });
+            check(other, compressed);
+        }
+
+        vector<uint8_t> generic;
+        measure("decode, generic loop", data.size(), [&] {
+            generic = decompress(compressed.data(), compressed.size(), 1, 0, DecodeLoop::GENERIC);
+        });
+        check(generic, data);
+
+        unsigned cores = max(thread::hardware_concurrency(), 1u);
+        for (unsigned threads : {1u, cores}) {
+            vector<uint8_t> decompressed;
+            measure("decode, " + to_string(threads) + " threads", data.size(), [&] {
+                decompressed = decompress(compressed.data(), compressed.size(), threads);
+            });
+            check(decompressed, data);
+            if (cores == 1) {
+                break;
+            }
+        }
+
+        vector<uint8_t> words;
+        measure("encode words", data.size(), [&] {
+            words = compress_words(data.data(), data.size());
+        });
+        cout << "  ratio: " << static_cast<double>(words.size()) / data.size() << '\n';
+        vector<uint8_t> decompressed;
+        measure("decode words", data.size(), [&] {
+            decompressed = decompress(words.data(), words.size());
+        });
+        check(decompressed, data);
+
+        vector<uint8_t> wide;
+        measure("encode wide", data.size(), [&] {
+            wide = compress_wide(data.data(), data.size());
+        });
+        cout << "  ratio: " << static_cast<double>(wide.size()) / data.size() << '\n';
+        measure("decode wide", data.size(), [&] {
+            decompressed = decompress(wide.data(), wide.size());
+        });
+        check(decompressed, data);
+
+        // Один поток, один блок DEFLATE на весь файл
+        for (bool lz : {false, true}) {
+            vector<uint8_t> deflated;
+            measure(lz ? "deflate lz" : "deflate huffman", data.size(), [&] {
+                deflated.clear();
+                deflate_chunk(data.data(), 0, data.size(), lz, true, &deflated);
+            });
+            cout << "  ratio: " << static_cast<double>(deflated.size()) / data.size() << '\n';
+        }
+        measure("crc32", data.size(), [&] {
+            crc32(data.data(), data.size());
+        });
+
+        // Преобразования должны стоить много меньше кодирования
+        vector<uint8_t> filtered(data.size());
+        vector<uint8_t> restored(data.size());
+        for (const char* name : {"delta4", "xor8", "split8"}) {
+            Filter filter = parse_filter(name);
+            measure(string("filter ") + name, data.size(), [&] {
+                apply_filter(filter, data.data(), data.size(), filtered.data());
+            });
+            measure(string("unfilter ") + name, data.size(), [&] {
+                undo_filter(filter, filtered.data(), filtered.size(), restored.data());
+            });
+            check(restored, data);
+        }
+    }
+
+} // \BENCH
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        bench_file("smoke_test/pg16527.in");
+        bench_file("smoke_test/verbose_example.in");
+    }
+    for (int i = 1; i < argc; ++i) {
+        bench_file(argv[i]);
+    }
+    return 0;
+}
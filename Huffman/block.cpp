@@ -0,0 +1,327 @@
+#include "block.hpp"
+#include "archive.hpp"
+#include "canonical.hpp"
+#include "huffman.hpp"
+#include "wide.hpp"
+#include "words.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    // Образец -- несколько кусков, равномерно разбросанных по блоку
+    constexpr uint64_t SAMPLE_SLICES = 4;
+    constexpr uint64_t SLICE_SIZE = 16 * 1024;
+    // Кусок образца для пробного кодирования словами
+    constexpr uint64_t WORDS_TRIAL_SIZE = 32 * 1024;
+    constexpr double TEXT_FRACTION = 0.95;
+    // Энтропия, выше которой код Хаффмана почти не сжимает
+    constexpr double INCOMPRESSIBLE = 7.9;
+    // Преобразование выбирается, если уменьшает энтропию хотя бы на столько
+    constexpr double MIN_FILTER_GAIN = 0.1;
+    // Без пробного кодирования словами: слова выбираются для текста с
+    //    такими долей повторов и разрывом энтропий нулевого и первого порядков
+    constexpr double WORDS_REPEATS = 0.5;
+    constexpr double WORDS_ORDER_GAP = 1.0;
+    // Слова выбираются, если уменьшают пробный результат хотя бы в столько раз
+    constexpr double WORDS_GAIN = 0.9;
+    // Наибольшая таблица выбора способа -- пары байтов в order1_entropy;
+    //    буферы преобразований образца не больше нее (пробное кодирование
+    //    словами при подсчете памяти выключено)
+    constexpr uint64_t SNIFF_TABLE_MEMORY = 256 * 256 * sizeof(uint32_t);
+    // Вершина дерева байтов в куче: вес, два указателя, символ и служебные
+    //    байты распределителя
+    constexpr uint64_t TREE_NODE_MEMORY = 48;
+    // Дерево из 511 вершин и коды 256 байтов (вектор и его буфер)
+    constexpr uint64_t ENCODE_TABLES_MEMORY = 511 * TREE_NODE_MEMORY + 256 * 64;
+    // Дерево и таблица декодирования байтов (не шире 12 бит) с указателями
+    //    на вершины длинных кодов
+    constexpr uint64_t BYTE_DECODE_MEMORY =
+        511 * TREE_NODE_MEMORY + (uint64_t{1} << 12u) * (sizeof(uint16_t) + sizeof(void*));
+    // Таблица декодирования слов, канонические коды с порядком символов,
+    //    длины кодов и ссылки на слова заголовка
+    constexpr uint64_t WORD_DECODE_MEMORY =
+        (uint64_t{1} << MAX_WORD_CODE_LENGTH) * sizeof(DecodeEntry)
+        + (256 + MAX_WORDS) * (2 * sizeof(uint32_t) + 1) + MAX_WORDS * sizeof(std::string_view);
+
+    const Filter SNIFF_FILTERS[] = {
+        {FilterKind::DELTA, 1}, {FilterKind::DELTA, 2}, {FilterKind::DELTA, 4},
+        {FilterKind::DELTA, 8}, {FilterKind::XOR, 4}, {FilterKind::XOR, 8},
+        {FilterKind::SPLIT, 2}, {FilterKind::SPLIT, 4}, {FilterKind::SPLIT, 8},
+    };
+
+
+    double entropy(const std::array<uint64_t, 256>& hist, uint64_t size) {
+        double bits = 0;
+        for (uint64_t freq : hist) {
+            if (freq > 0) {
+                bits -= freq * std::log2(static_cast<double>(freq) / size);
+            }
+        }
+        return size > 0 ? bits / size : 0;
+    }
+
+
+    bool is_text_byte(uint8_t byte) {
+        return (byte >= 0x20 && byte < 0x7f) || byte == '\n' || byte == '\r'
+            || byte == '\t' || byte >= 0x80; // UTF-8
+    }
+
+
+    // Условная энтропия байта при известном предыдущем. На малом образце
+    //    занижена, поэтому сравнивается только с энтропией нулевого порядка.
+    double order1_entropy(const uint8_t* data, uint64_t size) {
+        if (size < 2) {
+            return 0;
+        }
+        std::vector<uint32_t> pairs(256 * 256);
+        std::array<uint64_t, 256> contexts{};
+        for (uint64_t i = 1; i < size; ++i) {
+            ++pairs[data[i - 1] * 256u + data[i]];
+            ++contexts[data[i - 1]];
+        }
+        double bits = 0;
+        for (size_t pair = 0; pair < pairs.size(); ++pair) {
+            if (pairs[pair] > 0) {
+                bits -= pairs[pair] * std::log2(static_cast<double>(pairs[pair]) / contexts[pair >> 8u]);
+            }
+        }
+        return bits / (size - 1);
+    }
+
+
+    // Доля позиций, с которых начинаются 4 байта, уже встречавшиеся
+    //    в образце (по последнему вхождению с тем же хешем)
+    double repeat_density(const uint8_t* data, uint64_t size) {
+        if (size < 8) {
+            return 0;
+        }
+        constexpr unsigned HASH_BITS = 14;
+        std::vector<uint32_t> last(1u << HASH_BITS); // позиция + 1
+        uint64_t repeats = 0;
+        for (uint64_t i = 0; i + 4 <= size; ++i) {
+            uint32_t word;
+            std::memcpy(&word, data + i, 4);
+            uint32_t hash = (word * 2654435761u) >> (32 - HASH_BITS);
+            uint32_t previous = last[hash];
+            if (previous > 0 && std::memcmp(data + previous - 1, data + i, 4) == 0) {
+                ++repeats;
+            }
+            last[hash] = static_cast<uint32_t>(i + 1);
+        }
+        return static_cast<double>(repeats) / (size - 3);
+    }
+
+} // \BLOCK
+
+
+std::string plan_name(const BlockPlan& plan) {
+    std::string coder;
+    switch (plan.coder) {
+        case BlockCoder::HUFFMAN: coder = "huffman"; break;
+        case BlockCoder::WORDS: coder = "words"; break;
+        case BlockCoder::STORED: coder = "stored"; break;
+    }
+    if (plan.filter.kind == FilterKind::NONE) {
+        return coder;
+    }
+    return filter_name(plan.filter) + "+" + coder;
+}
+
+
+BlockPlan sniff_block(
+    const uint8_t* data,
+    uint64_t size,
+    std::chrono::nanoseconds budget,
+    SniffReport* report,
+    bool try_words
+) {
+    auto start = Clock::now();
+    auto in_time = [&] { return Clock::now() - start < budget; };
+    SniffReport sniff;
+
+    // Куски образца начинаются на границах 8 байтов, чтобы не сбивать
+    //    преобразования слов
+    std::vector<uint8_t> copy;
+    const uint8_t* sample = data;
+    uint64_t sample_size = size;
+    if (size > SAMPLE_SLICES * SLICE_SIZE) {
+        copy.resize(SAMPLE_SLICES * SLICE_SIZE);
+        for (uint64_t k = 0; k < SAMPLE_SLICES; ++k) {
+            uint64_t offset = (size - SLICE_SIZE) * k / (SAMPLE_SLICES - 1) / 8 * 8;
+            std::memcpy(copy.data() + k * SLICE_SIZE, data + offset, SLICE_SIZE);
+        }
+        sample = copy.data();
+        sample_size = copy.size();
+    }
+
+    auto hist = byte_histogram(sample, sample_size);
+    uint64_t text = 0;
+    for (size_t byte = 0; byte < 256; ++byte) {
+        if (is_text_byte(static_cast<uint8_t>(byte))) {
+            text += hist[byte];
+        }
+    }
+    sniff.text = sample_size > 0 ? static_cast<double>(text) / sample_size : 0;
+    sniff.order0 = entropy(hist, sample_size);
+    double best = sniff.order0;
+    BlockPlan plan;
+
+    if (in_time()) {
+        sniff.order1 = order1_entropy(sample, sample_size);
+        sniff.repeats = repeat_density(sample, sample_size);
+    }
+
+    if (sniff.text >= TEXT_FRACTION) {
+        if (try_words) {
+            // Слова -- более тяжелый кодер: пробуем на куске образца, если
+            //    есть время, иначе решаем по повторам и энтропиям
+            uint64_t trial_size = std::min(sample_size, WORDS_TRIAL_SIZE);
+            if (in_time() && trial_size > 0) {
+                auto words = compress_words(sample, trial_size);
+                auto bytes = compress(sample, trial_size);
+                sniff.words = static_cast<double>(words.size()) / bytes.size();
+                if (sniff.words < WORDS_GAIN) {
+                    plan.coder = BlockCoder::WORDS;
+                }
+            } else if (sniff.repeats >= WORDS_REPEATS
+                       && sniff.order0 - sniff.order1 >= WORDS_ORDER_GAP) {
+                plan.coder = BlockCoder::WORDS;
+            }
+        }
+    } else {
+        std::vector<uint8_t> filtered(sample_size);
+        for (Filter filter : SNIFF_FILTERS) {
+            if (!in_time()) {
+                break;
+            }
+            apply_filter(filter, sample, sample_size, filtered.data());
+            double bits = entropy(byte_histogram(filtered.data(), sample_size), sample_size);
+            if (sniff.filtered < 0 || bits < sniff.filtered) {
+                sniff.filtered = bits;
+                if (bits < best - MIN_FILTER_GAIN) {
+                    best = bits;
+                    plan.filter = filter;
+                }
+            }
+        }
+    }
+
+    if (plan.coder == BlockCoder::HUFFMAN && best > INCOMPRESSIBLE) {
+        plan = {{}, BlockCoder::STORED};
+    }
+    sniff.plan = plan;
+    sniff.time = Clock::now() - start;
+    if (report) {
+        *report = sniff;
+    }
+    return plan;
+}
+
+
+std::vector<uint8_t> compress_block(
+    const uint8_t* data,
+    uint64_t size,
+    const BlockOptions& options,
+    BlockPlan* plan,
+    SniffReport* report
+) {
+    *plan = options.plan;
+    if (options.automatic) {
+        auto budget = std::chrono::nanoseconds(options.budget) * size / (1u << 20u);
+        *plan = sniff_block(data, size, budget, report, options.words);
+    }
+
+    std::vector<uint8_t> filtered;
+    const uint8_t* input = data;
+    if (plan->filter.kind != FilterKind::NONE) {
+        filtered.resize(size);
+        apply_filter(plan->filter, data, size, filtered.data());
+        input = filtered.data();
+    }
+
+    std::vector<uint8_t> compressed;
+    switch (plan->coder) {
+        case BlockCoder::HUFFMAN:
+            compressed = compress(input, size);
+            break;
+        case BlockCoder::WORDS:
+            compressed = compress_words(input, size);
+            break;
+        case BlockCoder::STORED:
+            compressed.assign(input, input + size);
+            break;
+    }
+    if (options.automatic && plan->coder != BlockCoder::STORED && compressed.size() >= size) {
+        *plan = {{}, BlockCoder::STORED};
+        compressed.assign(data, data + size);
+        if (report) {
+            report->plan = *plan;
+        }
+    }
+    return compressed;
+}
+
+
+uint64_t compress_scratch_memory(uint64_t size, const BlockOptions& options) {
+    uint64_t memory = ENCODE_TABLES_MEMORY;
+    if (options.automatic || options.plan.filter.kind != FilterKind::NONE) {
+        memory += size;
+    }
+    if (options.automatic) {
+        // Копия образца делается, только если блок больше образца
+        if (size > SAMPLE_SLICES * SLICE_SIZE) {
+            memory += SAMPLE_SLICES * SLICE_SIZE;
+        }
+        memory += SNIFF_TABLE_MEMORY;
+    }
+    return memory;
+}
+
+
+uint64_t decompress_scratch_memory(uint64_t raw_size, const BlockPlan& plan) {
+    uint64_t memory = plan.filter.kind != FilterKind::NONE ? raw_size : 0;
+    switch (plan.coder) {
+        case BlockCoder::HUFFMAN: memory += BYTE_DECODE_MEMORY; break;
+        case BlockCoder::WORDS: memory += WORD_DECODE_MEMORY; break;
+        case BlockCoder::STORED: break;
+    }
+    return memory;
+}
+
+
+std::vector<uint8_t> decompress_block(
+    const uint8_t* data,
+    uint64_t size,
+    uint64_t raw_size,
+    const BlockPlan& plan,
+    unsigned threads
+) {
+    // decompress различает потоки по заголовку; другой вид потока, чем
+    //    в каталоге, не уложился бы в decompress_scratch_memory
+    bool words = is_word_stream(data, size);
+    if ((plan.coder == BlockCoder::WORDS && !words)
+        || (plan.coder == BlockCoder::HUFFMAN && (words || is_wide_stream(data, size)))) {
+        throw archive_error("corrupted block");
+    }
+    std::vector<uint8_t> decoded;
+    if (plan.coder == BlockCoder::STORED) {
+        decoded.assign(data, data + size);
+    } else {
+        decoded = decompress(data, size, threads, raw_size);
+    }
+    if (decoded.size() != raw_size) {
+        throw archive_error("corrupted block");
+    }
+    if (plan.filter.kind == FilterKind::NONE) {
+        return decoded;
+    }
+    std::vector<uint8_t> raw(decoded.size());
+    undo_filter(plan.filter, decoded.data(), decoded.size(), raw.data());
+    return raw;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "filter.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Способ сжатия одного блока архива: преобразование (см. filter.hpp)
+//   и кодер. HUFFMAN и WORDS -- поток в формате encode с алфавитом байтов
+//   или слов (decompress различает их по заголовку), STORED -- данные
+//   без сжатия.
+
+enum class BlockCoder : uint8_t { HUFFMAN, WORDS, STORED };
+
+struct BlockPlan {
+    Filter filter;
+    BlockCoder coder = BlockCoder::HUFFMAN;
+};
+
+// Имена вида huffman, delta4+huffman, words, stored
+std::string plan_name(const BlockPlan& plan);
+
+// Признаки образца блока, по которым выбран способ сжатия. Энтропии --
+//   в битах на байт; признаки, до которых не дошло время, равны -1.
+struct SniffReport {
+    double text = 0;        // доля байтов, встречающихся в тексте
+    double order0 = 0;      // энтропия байтов
+    double order1 = -1;     // оценка энтропии байта при известном предыдущем
+    double repeats = -1;    // доля позиций, где 4 байта уже встречались
+    double filtered = -1;   // энтропия байтов после лучшего преобразования
+    double words = -1;      // отношение размеров кодирования словами и байтами
+    BlockPlan plan;
+    std::chrono::nanoseconds time{0};
+};
+
+// Время на выбор способа для блока из мегабайта данных
+constexpr std::chrono::microseconds DEFAULT_SNIFF_BUDGET{2000};
+
+// Способ сжатия блоков: plan или, если automatic, выбираемый для каждого
+//   блока по образцу данных не дольше budget на мегабайт. Без words
+//   кодер слов не выбирается: его словарь и символы не ограничены
+//   размером таблиц, поэтому под бюджетом памяти он выключен.
+struct BlockOptions {
+    BlockPlan plan;
+    bool automatic = false;
+    std::chrono::microseconds budget = DEFAULT_SNIFF_BUDGET;
+    bool words = true;
+};
+
+// Выбирает способ по образцу блока: сначала частоты байтов (доля текста,
+//   энтропия), затем, пока есть время, оценка энтропии первого порядка и
+//   доля повторов, затем пробное кодирование словами для текста или
+//   энтропия после каждого преобразования для двоичных данных. Без
+//   try_words кодирование словами не пробуется и не выбирается.
+BlockPlan sniff_block(
+    const uint8_t* data,
+    uint64_t size,
+    std::chrono::nanoseconds budget,
+    SniffReport* report = nullptr,
+    bool try_words = true
+);
+
+// Сжимает блок способом из options, выбранный способ -- в *plan. Если при
+//   автоматическом выборе сжатый блок не меньше исходного, он хранится
+//   без сжатия.
+std::vector<uint8_t> compress_block(
+    const uint8_t* data,
+    uint64_t size,
+    const BlockOptions& options,
+    BlockPlan* plan,
+    SniffReport* report = nullptr
+);
+
+// Наибольший объем временных буферов compress_block для блока из size
+//   байтов сверх самого блока и результата: копия под преобразование,
+//   буферы выбора способа и дерево с кодами. Кодер слов не учитывается,
+//   поэтому options.words должно быть выключено.
+uint64_t compress_scratch_memory(uint64_t size, const BlockOptions& options);
+
+// То же для decompress_block: буфер под обратное преобразование
+//   и таблицы декодирования
+uint64_t decompress_scratch_memory(uint64_t raw_size, const BlockPlan& plan);
+
+// Бросает archive_error, если размер результата не равен raw_size или
+//   поток не того вида, что указан в plan
+std::vector<uint8_t> decompress_block(
+    const uint8_t* data,
+    uint64_t size,
+    uint64_t raw_size,
+    const BlockPlan& plan,
+    unsigned threads = 0
+);
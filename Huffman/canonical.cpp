@@ -0,0 +1,125 @@
+#include "canonical.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <stdexcept>
+
+namespace {
+
+    // Длины кодов Хаффмана без ограничения
+    std::vector<uint8_t> huffman_lengths(const std::vector<uint64_t>& freqs) {
+        using Item = std::pair<uint64_t, uint32_t>; // вес, номер вершины
+        std::priority_queue<Item, std::vector<Item>, std::greater<>> nodes;
+        std::vector<uint32_t> parent;
+        for (size_t symbol = 0; symbol < freqs.size(); ++symbol) {
+            parent.push_back(0);
+            if (freqs[symbol] > 0) {
+                nodes.push({freqs[symbol], static_cast<uint32_t>(symbol)});
+            }
+        }
+
+        std::vector<uint8_t> lengths(freqs.size()); // NRVO
+        if (nodes.size() == 1) {
+            lengths[nodes.top().second] = 1;
+            return lengths;
+        }
+
+        while (nodes.size() > 1) {
+            auto zero = nodes.top();
+            nodes.pop();
+            auto one = nodes.top();
+            nodes.pop();
+            auto id = static_cast<uint32_t>(parent.size());
+            parent.push_back(0);
+            parent[zero.second] = parent[one.second] = id;
+            nodes.push({zero.first + one.first, id});
+        }
+
+        // Внутренние вершины создаются после своих детей, поэтому глубину
+        //    можно вычислять от корня к листьям в обратном порядке.
+        std::vector<uint8_t> depth(parent.size());
+        for (size_t id = parent.size() - 1; id-- > freqs.size();) {
+            depth[id] = depth[parent[id]] + 1;
+        }
+        for (size_t symbol = 0; symbol < freqs.size(); ++symbol) {
+            if (freqs[symbol] > 0) {
+                lengths[symbol] = depth[parent[symbol]] + 1;
+            }
+        }
+        return lengths;
+    }
+
+} // \CANONICAL
+
+
+std::vector<uint8_t> limited_code_lengths(
+    const std::vector<uint64_t>& freqs,
+    uint8_t max_length
+) {
+    // Пока коды слишком длинные, сглаживаем частоты: редкие символы
+    //    становятся относительно чаще, и дерево выравнивается.
+    std::vector<uint64_t> scaled = freqs;
+    while (true) {
+        auto lengths = huffman_lengths(scaled);
+        if (lengths.empty() || *std::max_element(lengths.begin(), lengths.end()) <= max_length) {
+            return lengths;
+        }
+        for (auto& freq : scaled) {
+            if (freq > 0) {
+                freq = (freq >> 1u) | 1u;
+            }
+        }
+    }
+}
+
+
+std::vector<uint32_t> canonical_codes(const std::vector<uint8_t>& lengths) {
+    std::vector<uint32_t> order(lengths.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t lhs, uint32_t rhs) {
+        return lengths[lhs] < lengths[rhs];
+    });
+
+    std::vector<uint32_t> codes(lengths.size()); // NRVO
+    uint32_t code = 0;
+    uint8_t length = 0;
+    for (uint32_t symbol : order) {
+        if (lengths[symbol] == 0) {
+            continue;
+        }
+        if (length > 0) {
+            ++code;
+        }
+        code <<= (lengths[symbol] - length);
+        length = lengths[symbol];
+        codes[symbol] = code;
+    }
+    return codes;
+}
+
+
+std::vector<DecodeEntry> build_decode_table(
+    const std::vector<uint8_t>& lengths,
+    uint8_t table_bits
+) {
+    std::vector<DecodeEntry> table(size_t{1} << table_bits, DecodeEntry{0, 0}); // NRVO
+    auto codes = canonical_codes(lengths);
+    for (size_t symbol = 0; symbol < lengths.size(); ++symbol) {
+        uint8_t length = lengths[symbol];
+        if (length == 0 || length > table_bits) {
+            continue;
+        }
+        size_t first = static_cast<size_t>(codes[symbol]) << (table_bits - length);
+        size_t last = static_cast<size_t>(codes[symbol] + 1) << (table_bits - length);
+        if (last > table.size()) {
+            throw std::runtime_error("corrupted code lengths");
+        }
+        std::fill(
+            table.begin() + first,
+            table.begin() + last,
+            DecodeEntry{static_cast<uint16_t>(symbol), length}
+        );
+    }
+    return table;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// Канонические коды Хаффмана с ограниченной длиной для алфавитов
+//   размером до 65536 символов и табличное декодирование.
+
+struct DecodeEntry {
+    uint16_t symbol;
+    uint8_t length; // 0 -- код не существует
+};
+
+// Длины кодов не длиннее max_length. Символы с нулевой частотой
+//   получают длину 0. Требуется: число символов <= 2^max_length.
+std::vector<uint8_t> limited_code_lengths(
+    const std::vector<uint64_t>& freqs,
+    uint8_t max_length
+);
+
+// Канонические коды: символы упорядочены по (длина, номер символа)
+std::vector<uint32_t> canonical_codes(const std::vector<uint8_t>& lengths);
+
+// Таблица из 2^table_bits элементов: по первым table_bits битам
+//   потока -- символ и длина его кода. Все длины <= table_bits. Если
+//   коды не помещаются в таблицу (длины не образуют префиксный код),
+//   бросает std::runtime_error.
+std::vector<DecodeEntry> build_decode_table(
+    const std::vector<uint8_t>& lengths,
+    uint8_t table_bits
+);
+
+
+// Запись кодов, начиная со старших битов
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>* out) : out_(out) {}
+
+    void put(uint32_t code, uint8_t length) {
+        acc_ = (acc_ << length) | code;
+        bits_ += length;
+        while (bits_ >= 8) {
+            bits_ -= 8;
+            out_->push_back(static_cast<uint8_t>(acc_ >> bits_));
+        }
+    }
+
+    // Дописывает неполный последний байт нулями
+    void flush() {
+        if (bits_ > 0) {
+            out_->push_back(static_cast<uint8_t>(acc_ << (8 - bits_)));
+            bits_ = 0;
+        }
+    }
+
+private:
+    std::vector<uint8_t>* out_;
+    uint64_t acc_ = 0;
+    uint8_t bits_ = 0;
+};
+
+
+// Чтение битов, начиная со старших; за концом буфера -- нули
+class BitReader {
+public:
+    BitReader(const uint8_t* data, uint64_t size)
+        : pos_(data), end_(data + size)
+    {
+        refill();
+    }
+
+    // Следующие n бит (n <= 32) без продвижения
+    uint32_t peek(uint8_t n) const {
+        return static_cast<uint32_t>(acc_ >> (64 - n));
+    }
+
+    void skip(uint8_t n) {
+        acc_ <<= n;
+        bits_ -= n;
+        if (bits_ < 32) {
+            refill();
+        }
+    }
+
+    // Прочитаны ли биты за концом буфера: испорченный поток
+    //   декодируется нулями, и это видно только здесь
+    bool overrun() const {
+        return padding_ > bits_;
+    }
+
+private:
+    void refill() {
+        if (end_ - pos_ >= 8) {
+            // Загружаем 8 байт разом, берем столько, сколько помещается
+            uint64_t word;
+            std::memcpy(&word, pos_, sizeof(word));
+            word = __builtin_bswap64(word);
+            acc_ |= word >> bits_;
+            uint8_t taken = (64 - bits_) >> 3u;
+            pos_ += taken;
+            bits_ += taken * 8;
+            return;
+        }
+        while (bits_ <= 56) {
+            uint64_t byte = 0;
+            if (pos_ < end_) {
+                byte = *pos_++;
+            } else {
+                padding_ += 8;
+            }
+            acc_ |= byte << (56 - bits_);
+            bits_ += 8;
+        }
+    }
+
+    const uint8_t* pos_;
+    const uint8_t* end_;
+    uint64_t acc_ = 0;
+    uint8_t bits_ = 0; // число загруженных битов в acc_
+    uint64_t padding_ = 0; // загружено нулевых битов за концом буфера
+};
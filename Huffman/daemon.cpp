@@ -0,0 +1,282 @@
+#include "daemon.hpp"
+#include "wide.hpp"
+#include "words.hpp"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+    constexpr size_t HEADER_SIZE = 1 + 4;
+    constexpr int BACKLOG = 128;
+
+    enum Status : uint8_t {
+        OK = 0,
+        ERROR = 1,
+    };
+
+
+    std::string system_error(const std::string& what) {
+        return what + ": " + std::strerror(errno);
+    }
+
+
+    void put_header(uint8_t* header, uint8_t code, uint32_t size) {
+        header[0] = code;
+        for (size_t i = 0; i < 4; ++i) {
+            header[1 + i] = static_cast<uint8_t>(size >> (8 * i));
+        }
+    }
+
+
+    uint32_t get_size(const uint8_t* header) {
+        uint32_t size = 0;
+        for (size_t i = 0; i < 4; ++i) {
+            size |= static_cast<uint32_t>(header[1 + i]) << (8 * i);
+        }
+        return size;
+    }
+
+
+    void write_all(int fd, const uint8_t* data, size_t size, int flags = 0) {
+        while (size > 0) {
+            ssize_t written = send(fd, data, size, flags | MSG_NOSIGNAL);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                throw daemon_error(system_error("send"));
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+
+
+    // false, если соединение закрыто до первого байта
+    bool read_all(int fd, uint8_t* data, size_t size) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t got = recv(fd, data + done, size - done, 0);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                throw daemon_error(system_error("recv"));
+            }
+            if (got == 0) {
+                if (done == 0) {
+                    return false;
+                }
+                throw daemon_error("connection closed in the middle of a message");
+            }
+            done += static_cast<size_t>(got);
+        }
+        return true;
+    }
+
+
+    void send_message(int fd, uint8_t code, const uint8_t* data, size_t size) {
+        uint8_t header[HEADER_SIZE];
+        put_header(header, code, static_cast<uint32_t>(size));
+        write_all(fd, header, sizeof(header), size > 0 ? MSG_MORE : 0);
+        write_all(fd, data, size);
+    }
+
+
+    sockaddr_un socket_address(const std::string& path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            throw daemon_error("socket path too long: " + path);
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return address;
+    }
+
+
+    std::vector<uint8_t> process(
+        DaemonOp op,
+        const std::vector<uint8_t>& payload,
+        const TrainedTable* trained
+    ) {
+        switch (op) {
+            case DaemonOp::COMPRESS:
+                return compress(payload.data(), payload.size());
+            case DaemonOp::DECOMPRESS: {
+                // Размер из заголовка проверяется до того, как под
+                //   результат выделена память
+                uint64_t raw_size = 0;
+                if (is_word_stream(payload.data(), payload.size())) {
+                    raw_size = word_raw_size(payload.data(), payload.size());
+                } else if (is_wide_stream(payload.data(), payload.size())) {
+                    raw_size = wide_raw_size(payload.data(), payload.size());
+                }
+                if (raw_size > MAX_PAYLOAD_SIZE) {
+                    throw daemon_error("response too large");
+                }
+                return decompress(payload.data(), payload.size(), 1);
+            }
+            case DaemonOp::COMPRESS_TRAINED:
+            case DaemonOp::DECOMPRESS_TRAINED:
+                if (!trained) {
+                    throw daemon_error("no trained table");
+                }
+                if (op == DaemonOp::COMPRESS_TRAINED) {
+                    return trained->compress(payload.data(), payload.size());
+                }
+                return trained->decompress(payload.data(), payload.size());
+        }
+        throw daemon_error("unknown operation");
+    }
+
+
+    // Обслуживает запросы соединения, пока клиент его не закроет.
+    //   Буфер запроса переиспользуется между запросами.
+    void serve(int fd, const TrainedTable* trained, std::vector<uint8_t>* payload) {
+        uint8_t header[HEADER_SIZE];
+        while (read_all(fd, header, sizeof(header))) {
+            uint32_t size = get_size(header);
+            if (size > MAX_PAYLOAD_SIZE) {
+                // Данные не читаются, поэтому соединение не продолжить
+                const std::string message = "request too large";
+                send_message(fd, ERROR, reinterpret_cast<const uint8_t*>(message.data()), message.size());
+                return;
+            }
+            payload->resize(size);
+            if (size > 0 && !read_all(fd, payload->data(), size)) {
+                return;
+            }
+
+            std::vector<uint8_t> result;
+            std::string message;
+            try {
+                result = process(static_cast<DaemonOp>(header[0]), *payload, trained);
+                if (result.size() > MAX_PAYLOAD_SIZE) {
+                    message = "response too large";
+                }
+            } catch (const std::exception& e) {
+                // Любая ошибка запроса -- ответ клиенту, а не падение демона
+                message = e.what();
+            }
+            if (message.empty()) {
+                send_message(fd, OK, result.data(), result.size());
+            } else {
+                send_message(fd, ERROR, reinterpret_cast<const uint8_t*>(message.data()), message.size());
+            }
+        }
+    }
+
+} // \DAEMON
+
+
+void run_daemon(
+    const std::string& socket_path,
+    unsigned threads,
+    const TrainedTable* trained
+) {
+    sockaddr_un address = socket_address(socket_path);
+
+    // Сокет, оставшийся от прошлого запуска, заменяется; другие файлы -- нет
+    struct stat info{};
+    if (lstat(socket_path.c_str(), &info) == 0) {
+        if (!S_ISSOCK(info.st_mode)) {
+            throw daemon_error("not a socket: " + socket_path);
+        }
+        unlink(socket_path.c_str());
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        throw daemon_error(system_error("socket"));
+    }
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+        || listen(listener, BACKLOG) < 0) {
+        std::string message = system_error(socket_path);
+        close(listener);
+        throw daemon_error(message);
+    }
+
+    // Потоки принимают соединения сами: ядро отдает каждое одному из них
+    auto worker = [&] {
+        std::vector<uint8_t> payload;
+        while (true) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                return;
+            }
+            try {
+                serve(fd, trained, &payload);
+            } catch (const std::exception&) {
+                // Клиент оборвал соединение -- обслуживаем следующих
+            }
+            close(fd);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < resolve_threads(threads); ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    std::string message = system_error("accept");
+    shutdown(listener, SHUT_RDWR);
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    close(listener);
+    throw daemon_error(message);
+}
+
+
+DaemonClient::DaemonClient(const std::string& socket_path) {
+    sockaddr_un address = socket_address(socket_path);
+    fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd_ < 0) {
+        throw daemon_error(system_error("socket"));
+    }
+    if (connect(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        std::string message = system_error(socket_path);
+        close(fd_);
+        throw daemon_error(message);
+    }
+}
+
+
+DaemonClient::~DaemonClient() {
+    close(fd_);
+}
+
+
+std::vector<uint8_t> DaemonClient::request(DaemonOp op, const uint8_t* data, uint64_t size) {
+    if (size > MAX_PAYLOAD_SIZE) {
+        throw daemon_error("request too large");
+    }
+    send_message(fd_, static_cast<uint8_t>(op), data, size);
+
+    uint8_t header[HEADER_SIZE];
+    if (!read_all(fd_, header, sizeof(header))) {
+        throw daemon_error("connection closed by server");
+    }
+    uint32_t response_size = get_size(header);
+    if (response_size > MAX_PAYLOAD_SIZE) {
+        throw daemon_error("response too large");
+    }
+    std::vector<uint8_t> response(response_size); // NRVO
+    if (response_size > 0 && !read_all(fd_, response.data(), response_size)) {
+        throw daemon_error("connection closed by server");
+    }
+    if (header[0] != OK) {
+        throw daemon_error(std::string(response.begin(), response.end()));
+    }
+    return response;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "huffman.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Сервер сжатия на Unix-сокете: потоки-обработчики и обученная таблица
+//   создаются один раз и обслуживают запросы без запуска процессов.
+//
+//   Протокол (числа в little-endian), по соединению -- сколько угодно
+//   запросов подряд:
+//     запрос: операция(1) размер(4) данные
+//     ответ: статус(1) размер(4) данные (при статусе 1 -- текст ошибки)
+
+enum class DaemonOp : uint8_t {
+    COMPRESS = 'c',           // compress
+    DECOMPRESS = 'd',         // decompress
+    COMPRESS_TRAINED = 'C',   // TrainedTable::compress
+    DECOMPRESS_TRAINED = 'D', // TrainedTable::decompress
+};
+
+// Наибольший размер данных запроса и ответа
+constexpr uint32_t MAX_PAYLOAD_SIZE = 64u << 20u;
+
+class daemon_error : public std::runtime_error {
+public:
+    explicit daemon_error(const std::string& what) : std::runtime_error(what) {}
+};
+
+// Слушает socket_path и обслуживает соединения в threads потоках
+//   (0 -- по числу ядер), каждый поток -- по одному соединению. Без
+//   trained операции с обученной таблицей возвращают ошибку. Возвращается
+//   только при ошибке сокета.
+void run_daemon(
+    const std::string& socket_path,
+    unsigned threads,
+    const TrainedTable* trained = nullptr
+);
+
+class DaemonClient {
+public:
+    explicit DaemonClient(const std::string& socket_path);
+    ~DaemonClient();
+
+    DaemonClient(const DaemonClient&) = delete;
+    DaemonClient& operator=(const DaemonClient&) = delete;
+
+    // Бросает daemon_error, если сервер вернул ошибку
+    std::vector<uint8_t> request(DaemonOp op, const uint8_t* data, uint64_t size);
+
+private:
+    int fd_;
+};
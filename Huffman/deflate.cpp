@@ -0,0 +1,530 @@
+#include "deflate.hpp"
+#include "canonical.hpp"
+#include "huffman.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace {
+
+    constexpr unsigned END_OF_BLOCK = 256;
+    constexpr unsigned LITERAL_CODES = 286;
+    constexpr unsigned DISTANCE_CODES = 30;
+    constexpr unsigned CODE_LENGTH_CODES = 19;
+    constexpr uint8_t MAX_CODE_LENGTH = 15;
+    constexpr uint8_t MAX_CODE_LENGTH_LENGTH = 7;
+    constexpr uint64_t MAX_STORED = 65535;
+    // Заголовок несжатого блока после выравнивания: длина и ее дополнение
+    constexpr uint64_t STORED_HEADER_SIZE = 5;
+
+    constexpr uint32_t MIN_MATCH = 3;
+    constexpr uint32_t MAX_MATCH = 258;
+    constexpr unsigned HASH_BITS = 15;
+    // Сколько предыдущих позиций с тем же хешем проверяется
+    constexpr unsigned MAX_CHAIN = 16;
+    // Совпадение из 3 байтов дальше этого короче не становится (как в zlib)
+    constexpr uint32_t TOO_FAR = 4096;
+
+    constexpr uint16_t LENGTH_BASE[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    constexpr uint8_t LENGTH_EXTRA[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    constexpr uint16_t DISTANCE_BASE[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+    };
+    constexpr uint8_t DISTANCE_EXTRA[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+    // Порядок длин кодов длин в заголовке блока
+    constexpr uint8_t CODE_LENGTH_ORDER[CODE_LENGTH_CODES] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+
+
+    // Таблицы CRC-32 для обработки 8 байтов за шаг: TABLES[k][b] --
+    //    CRC байта b, за которым следуют k нулевых байтов
+    using CrcTables = std::array<std::array<uint32_t, 256>, 8>;
+
+    CrcTables make_crc_tables() {
+        CrcTables tables{};
+        for (uint32_t byte = 0; byte < 256; ++byte) {
+            uint32_t crc = byte;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1u) ^ (crc & 1u ? 0xedb88320u : 0);
+            }
+            tables[0][byte] = crc;
+        }
+        for (uint32_t byte = 0; byte < 256; ++byte) {
+            for (size_t k = 1; k < tables.size(); ++k) {
+                uint32_t previous = tables[k - 1][byte];
+                tables[k][byte] = (previous >> 8u) ^ tables[0][previous & 0xffu];
+            }
+        }
+        return tables;
+    }
+
+    const CrcTables CRC_TABLES = make_crc_tables();
+
+
+    // Умножение вектора на матрицу над GF(2) (как в zlib)
+    uint32_t gf2_times(const uint32_t* matrix, uint32_t vector) {
+        uint32_t sum = 0;
+        for (; vector != 0; vector >>= 1u, ++matrix) {
+            if (vector & 1u) {
+                sum ^= *matrix;
+            }
+        }
+        return sum;
+    }
+
+    void gf2_square(uint32_t* square, const uint32_t* matrix) {
+        for (int n = 0; n < 32; ++n) {
+            square[n] = gf2_times(matrix, matrix[n]);
+        }
+    }
+
+
+    // Запись битов, начиная с младших (порядок DEFLATE)
+    class LsbWriter {
+    public:
+        explicit LsbWriter(std::vector<uint8_t>* out) : out_(out) {}
+
+        // n <= 32
+        void put(uint32_t bits, unsigned n) {
+            acc_ |= static_cast<uint64_t>(bits) << bits_;
+            bits_ += n;
+            if (bits_ >= 32) {
+                for (int i = 0; i < 4; ++i) {
+                    out_->push_back(static_cast<uint8_t>(acc_ >> (8u * i)));
+                }
+                acc_ >>= 32u;
+                bits_ -= 32;
+            }
+        }
+
+        // Дописывает неполный последний байт нулями
+        void align() {
+            for (; bits_ > 0; bits_ = bits_ > 8 ? bits_ - 8 : 0) {
+                out_->push_back(static_cast<uint8_t>(acc_));
+                acc_ >>= 8u;
+            }
+        }
+
+    private:
+        std::vector<uint8_t>* out_;
+        uint64_t acc_ = 0;
+        unsigned bits_ = 0;
+    };
+
+
+    // Код Хаффмана алфавита DEFLATE: коды записываются начиная со
+    //    старшего бита, поэтому хранятся перевернутыми
+    struct DeflateCode {
+        std::vector<uint8_t> lengths;
+        std::vector<uint32_t> codes;
+
+        DeflateCode(std::vector<uint64_t> freqs, uint8_t max_length) {
+            // Как в zlib: хотя бы два символа, чтобы код был полным
+            //    и каждый символ занимал хотя бы бит
+            size_t used = freqs.size() - std::count(freqs.begin(), freqs.end(), 0);
+            for (size_t symbol = 0; used < 2; ++symbol) {
+                if (freqs[symbol] == 0) {
+                    freqs[symbol] = 1;
+                    ++used;
+                }
+            }
+            lengths = limited_code_lengths(freqs, max_length);
+            codes = canonical_codes(lengths);
+            for (size_t symbol = 0; symbol < codes.size(); ++symbol) {
+                uint32_t reversed = 0;
+                for (uint8_t bit = 0; bit < lengths[symbol]; ++bit) {
+                    reversed |= ((codes[symbol] >> bit) & 1u) << (lengths[symbol] - 1 - bit);
+                }
+                codes[symbol] = reversed;
+            }
+        }
+
+        void put(LsbWriter& writer, unsigned symbol) const {
+            writer.put(codes[symbol], lengths[symbol]);
+        }
+
+        // Число используемых длин: не меньше least
+        size_t used(size_t least) const {
+            size_t count = lengths.size();
+            while (count > least && lengths[count - 1] == 0) {
+                --count;
+            }
+            return count;
+        }
+    };
+
+
+    // Литерал (distance == 0) или совпадение
+    struct Token {
+        uint16_t value;
+        uint16_t distance;
+    };
+
+
+    unsigned length_code(uint32_t length) {
+        auto it = std::upper_bound(std::begin(LENGTH_BASE), std::end(LENGTH_BASE), length);
+        return static_cast<unsigned>(it - std::begin(LENGTH_BASE)) - 1;
+    }
+
+    unsigned distance_code(uint32_t distance) {
+        auto it = std::upper_bound(std::begin(DISTANCE_BASE), std::end(DISTANCE_BASE), distance);
+        return static_cast<unsigned>(it - std::begin(DISTANCE_BASE)) - 1;
+    }
+
+
+    // Длина общего начала a и b, не больше max_length; сравнивается
+    //    по 8 байтов
+    uint32_t match_length(const uint8_t* a, const uint8_t* b, uint32_t max_length) {
+        uint32_t length = 0;
+        while (length + 8 <= max_length) {
+            uint64_t x;
+            uint64_t y;
+            std::memcpy(&x, a + length, 8);
+            std::memcpy(&y, b + length, 8);
+            if (x != y) {
+                return length + (__builtin_ctzll(x ^ y) >> 3u); // little-endian
+            }
+            length += 8;
+        }
+        while (length < max_length && a[length] == b[length]) {
+            ++length;
+        }
+        return length;
+    }
+
+
+    // Жадный поиск совпадений по цепочкам позиций с одинаковым хешем
+    //    трех байтов. Позиции data[0, prefix) только добавляются в словарь.
+    std::vector<Token> find_matches(const uint8_t* data, uint64_t prefix, uint64_t size) {
+        const uint64_t end = prefix + size;
+        std::vector<int64_t> head(1u << HASH_BITS, -1);
+        std::vector<int64_t> previous(DEFLATE_WINDOW, -1);
+        auto hash = [&](uint64_t pos) {
+            uint32_t bytes = data[pos] << 16u | data[pos + 1] << 8u | data[pos + 2];
+            return (bytes * 2654435761u) >> (32 - HASH_BITS);
+        };
+        auto insert = [&](uint64_t pos) {
+            if (pos + MIN_MATCH <= end) {
+                uint32_t h = hash(pos);
+                previous[pos % DEFLATE_WINDOW] = head[h];
+                head[h] = static_cast<int64_t>(pos);
+            }
+        };
+        for (uint64_t pos = 0; pos < prefix; ++pos) {
+            insert(pos);
+        }
+
+        std::vector<Token> tokens;
+        tokens.reserve(size);
+        uint64_t pos = prefix;
+        while (pos < end) {
+            uint32_t best_length = 0;
+            uint32_t best_distance = 0;
+            if (pos + MIN_MATCH <= end) {
+                auto max_length = static_cast<uint32_t>(std::min<uint64_t>(MAX_MATCH, end - pos));
+                int64_t candidate = head[hash(pos)];
+                for (unsigned chain = 0; chain < MAX_CHAIN && candidate >= 0; ++chain) {
+                    auto distance = static_cast<uint32_t>(pos - candidate);
+                    if (distance > DEFLATE_WINDOW) {
+                        break;
+                    }
+                    const uint8_t* a = data + candidate;
+                    const uint8_t* b = data + pos;
+                    if (a[best_length] == b[best_length]) {
+                        uint32_t length = match_length(a, b, max_length);
+                        if (length > best_length) {
+                            best_length = length;
+                            best_distance = distance;
+                            if (length == max_length) {
+                                break;
+                            }
+                        }
+                    }
+                    int64_t next = previous[candidate % DEFLATE_WINDOW];
+                    // Старое значение, перезаписанное более новой позицией
+                    if (next >= candidate) {
+                        break;
+                    }
+                    candidate = next;
+                }
+            }
+
+            if (best_length > MIN_MATCH || (best_length == MIN_MATCH && best_distance <= TOO_FAR)) {
+                tokens.push_back({static_cast<uint16_t>(best_length), static_cast<uint16_t>(best_distance)});
+                for (uint32_t i = 0; i < best_length; ++i) {
+                    insert(pos + i);
+                }
+                pos += best_length;
+            } else {
+                tokens.push_back({data[pos], 0});
+                insert(pos);
+                ++pos;
+            }
+        }
+        return tokens;
+    }
+
+
+    // Длины кодов литералов и расстояний, сжатые повторами:
+    //    16 -- предыдущая длина 3-6 раз, 17 -- 3-10 нулей, 18 -- 11-138 нулей
+    struct CodeLengthSymbol {
+        uint8_t symbol;
+        uint8_t extra;
+    };
+
+    std::vector<CodeLengthSymbol> encode_lengths(const std::vector<uint8_t>& lengths) {
+        std::vector<CodeLengthSymbol> symbols;
+        size_t i = 0;
+        while (i < lengths.size()) {
+            uint8_t length = lengths[i];
+            size_t run = 1;
+            while (i + run < lengths.size() && lengths[i + run] == length) {
+                ++run;
+            }
+            i += run;
+            if (length == 0) {
+                for (; run >= 11; run -= std::min<size_t>(run, 138)) {
+                    symbols.push_back({18, static_cast<uint8_t>(std::min<size_t>(run, 138) - 11)});
+                }
+                if (run >= 3) {
+                    symbols.push_back({17, static_cast<uint8_t>(run - 3)});
+                    run = 0;
+                }
+            } else {
+                symbols.push_back({length, 0});
+                --run;
+                for (; run >= 3; run -= std::min<size_t>(run, 6)) {
+                    symbols.push_back({16, static_cast<uint8_t>(std::min<size_t>(run, 6) - 3)});
+                }
+            }
+            for (; run > 0; --run) {
+                symbols.push_back({length, 0});
+            }
+        }
+        return symbols;
+    }
+
+
+    // Заголовок блока с динамическими кодами
+    void write_dynamic_header(
+        LsbWriter& writer,
+        bool last,
+        const DeflateCode& literals,
+        const DeflateCode& distances
+    ) {
+        size_t literal_count = literals.used(257);
+        size_t distance_count = distances.used(1);
+        std::vector<uint8_t> lengths(literals.lengths.begin(), literals.lengths.begin() + literal_count);
+        lengths.insert(lengths.end(), distances.lengths.begin(), distances.lengths.begin() + distance_count);
+        auto symbols = encode_lengths(lengths);
+
+        std::vector<uint64_t> freqs(CODE_LENGTH_CODES);
+        for (auto symbol : symbols) {
+            ++freqs[symbol.symbol];
+        }
+        DeflateCode code_lengths(freqs, MAX_CODE_LENGTH_LENGTH);
+        size_t order_count = CODE_LENGTH_CODES;
+        while (order_count > 4 && code_lengths.lengths[CODE_LENGTH_ORDER[order_count - 1]] == 0) {
+            --order_count;
+        }
+
+        writer.put(last ? 1 : 0, 1);
+        writer.put(2, 2); // динамические коды
+        writer.put(static_cast<uint32_t>(literal_count - 257), 5);
+        writer.put(static_cast<uint32_t>(distance_count - 1), 5);
+        writer.put(static_cast<uint32_t>(order_count - 4), 4);
+        for (size_t i = 0; i < order_count; ++i) {
+            writer.put(code_lengths.lengths[CODE_LENGTH_ORDER[i]], 3);
+        }
+        for (auto symbol : symbols) {
+            code_lengths.put(writer, symbol.symbol);
+            if (symbol.symbol == 16) {
+                writer.put(symbol.extra, 2);
+            } else if (symbol.symbol == 17) {
+                writer.put(symbol.extra, 3);
+            } else if (symbol.symbol == 18) {
+                writer.put(symbol.extra, 7);
+            }
+        }
+    }
+
+
+    // Несжатые блоки по MAX_STORED байтов; пустой блок, если size == 0
+    void write_stored(
+        LsbWriter& writer,
+        const uint8_t* data,
+        uint64_t size,
+        bool last,
+        std::vector<uint8_t>* out
+    ) {
+        uint64_t pos = 0;
+        do {
+            auto length = static_cast<uint32_t>(std::min(size - pos, MAX_STORED));
+            writer.put(last && pos + length == size ? 1 : 0, 1);
+            writer.put(0, 2);
+            writer.align();
+            writer.put(length | (~length << 16u), 32);
+            out->insert(out->end(), data + pos, data + pos + length);
+            pos += length;
+        } while (pos < size);
+    }
+
+
+    uint64_t stored_size(uint64_t size) {
+        return size + STORED_HEADER_SIZE * std::max<uint64_t>((size + MAX_STORED - 1) / MAX_STORED, 1);
+    }
+
+} // \DEFLATE
+
+
+uint32_t crc32(const uint8_t* data, uint64_t size, uint32_t crc) {
+    const auto& t = CRC_TABLES;
+    crc = ~crc;
+    for (; size >= 8; size -= 8, data += 8) {
+        uint32_t low = crc ^ (data[0] | data[1] << 8u | data[2] << 16u | static_cast<uint32_t>(data[3]) << 24u);
+        crc = t[7][low & 0xffu] ^ t[6][(low >> 8u) & 0xffu] ^ t[5][(low >> 16u) & 0xffu]
+            ^ t[4][low >> 24u] ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+    }
+    for (; size > 0; --size, ++data) {
+        crc = (crc >> 8u) ^ t[0][(crc ^ *data) & 0xffu];
+    }
+    return ~crc;
+}
+
+
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t size2) {
+    if (size2 == 0) {
+        return crc1;
+    }
+    // odd -- оператор дописывания одного нулевого бита, затем
+    //    последовательно -- 2, 4, 8, ... бит
+    uint32_t even[32];
+    uint32_t odd[32];
+    odd[0] = 0xedb88320u;
+    for (int n = 1; n < 32; ++n) {
+        odd[n] = 1u << (n - 1);
+    }
+    gf2_square(even, odd);
+    gf2_square(odd, even);
+    while (true) {
+        gf2_square(even, odd);
+        if (size2 & 1u) {
+            crc1 = gf2_times(even, crc1);
+        }
+        size2 >>= 1u;
+        if (size2 == 0) {
+            break;
+        }
+        gf2_square(odd, even);
+        if (size2 & 1u) {
+            crc1 = gf2_times(odd, crc1);
+        }
+        size2 >>= 1u;
+        if (size2 == 0) {
+            break;
+        }
+    }
+    return crc1 ^ crc2;
+}
+
+
+void write_gzip_header(std::ostream& ostr) {
+    // Метод deflate, без флагов и времени, ОС неизвестна
+    const uint8_t header[GZIP_HEADER_SIZE] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 255};
+    ostr.write(reinterpret_cast<const char*>(header), sizeof(header));
+}
+
+
+void write_gzip_trailer(std::ostream& ostr, uint32_t crc, uint64_t size) {
+    uint8_t trailer[GZIP_TRAILER_SIZE];
+    for (int i = 0; i < 4; ++i) {
+        trailer[i] = static_cast<uint8_t>(crc >> (8u * i));
+        trailer[4 + i] = static_cast<uint8_t>(size >> (8u * i));
+    }
+    ostr.write(reinterpret_cast<const char*>(trailer), sizeof(trailer));
+}
+
+
+void deflate_chunk(
+    const uint8_t* data,
+    uint64_t prefix,
+    uint64_t size,
+    bool lz,
+    bool last,
+    std::vector<uint8_t>* out
+) {
+    LsbWriter writer(out);
+    if (size == 0) {
+        write_stored(writer, data, 0, last, out);
+        return;
+    }
+    const uint64_t start = out->size();
+
+    std::vector<uint64_t> literal_freqs(LITERAL_CODES);
+    std::vector<uint64_t> distance_freqs(DISTANCE_CODES);
+    std::vector<Token> tokens;
+    const uint8_t* chunk = data + prefix;
+    if (lz) {
+        tokens = find_matches(data, prefix, size);
+        for (Token token : tokens) {
+            if (token.distance == 0) {
+                ++literal_freqs[token.value];
+            } else {
+                ++literal_freqs[257 + length_code(token.value)];
+                ++distance_freqs[distance_code(token.distance)];
+            }
+        }
+    } else {
+        auto hist = byte_histogram(chunk, size);
+        std::copy(hist.begin(), hist.end(), literal_freqs.begin());
+    }
+    literal_freqs[END_OF_BLOCK] = 1;
+
+    DeflateCode literals(literal_freqs, MAX_CODE_LENGTH);
+    DeflateCode distances(distance_freqs, MAX_CODE_LENGTH);
+    write_dynamic_header(writer, last, literals, distances);
+    if (lz) {
+        for (Token token : tokens) {
+            if (token.distance == 0) {
+                literals.put(writer, token.value);
+                continue;
+            }
+            unsigned length = length_code(token.value);
+            literals.put(writer, 257 + length);
+            writer.put(token.value - LENGTH_BASE[length], LENGTH_EXTRA[length]);
+            unsigned distance = distance_code(token.distance);
+            distances.put(writer, distance);
+            writer.put(token.distance - DISTANCE_BASE[distance], DISTANCE_EXTRA[distance]);
+        }
+    } else {
+        for (uint64_t i = 0; i < size; ++i) {
+            literals.put(writer, chunk[i]);
+        }
+    }
+    literals.put(writer, END_OF_BLOCK);
+
+    if (last) {
+        writer.align();
+    } else {
+        write_stored(writer, chunk, 0, false, out);
+    }
+
+    // Несжимаемый кусок выгоднее хранить как есть
+    if (out->size() - start > stored_size(size)) {
+        out->resize(start);
+        LsbWriter stored(out);
+        write_stored(stored, chunk, size, last, out);
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+// Сжатие в формате gzip (RFC 1952) с блоками DEFLATE (RFC 1951) с
+//   динамическими кодами Хаффмана, которые читает обычный gzip -d.
+//
+//   Как в pigz, данные делятся на куски, которые сжимаются независимо
+//   и параллельно: каждый кусок -- один блок DEFLATE, после него --
+//   пустой несжатый блок, выравнивающий поток на границу байта, так что
+//   куски просто записываются друг за другом. CRC-32 кусков считаются
+//   там же и объединяются. Без lz блок содержит только литералы (как
+//   gzip --huffman-only); с lz -- еще и совпадения длиной 3-258 байтов
+//   на расстоянии до 32 КиБ, в том числе с концом предыдущего куска.
+//   Кусок, который так не сжимается, хранится несжатыми блоками.
+
+// Наибольшее расстояние совпадения и размер словаря из предыдущего куска
+constexpr uint32_t DEFLATE_WINDOW = 32 * 1024;
+
+uint32_t crc32(const uint8_t* data, uint64_t size, uint32_t crc = 0);
+
+// CRC-32 конкатенации данных с CRC crc1 и данных длины size2 с CRC crc2
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t size2);
+
+// Заголовок gzip без имени файла и времени
+constexpr uint64_t GZIP_HEADER_SIZE = 10;
+constexpr uint64_t GZIP_TRAILER_SIZE = 8;
+void write_gzip_header(std::ostream& ostr);
+// crc и size -- CRC-32 и размер (по модулю 2^32) всех исходных данных
+void write_gzip_trailer(std::ostream& ostr, uint32_t crc, uint64_t size);
+
+// Дописывает в out кусок data[prefix, prefix + size): блок DEFLATE
+//   (последний в потоке, если last) и, если не last, пустой несжатый
+//   блок, либо несжатые блоки, если так короче. data[0, prefix) -- конец предыдущего куска, на который могут
+//   ссылаться совпадения (prefix <= DEFLATE_WINDOW).
+void deflate_chunk(
+    const uint8_t* data,
+    uint64_t prefix,
+    uint64_t size,
+    bool lz,
+    bool last,
+    std::vector<uint8_t>* out
+);
@@ -0,0 +1,376 @@
+#include "filter.hpp"
+#include "archive.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+    template <size_t W> struct WordOf;
+    template <> struct WordOf<1> { using type = uint8_t; };
+    template <> struct WordOf<2> { using type = uint16_t; };
+    template <> struct WordOf<4> { using type = uint32_t; };
+    template <> struct WordOf<8> { using type = uint64_t; };
+
+    // Слова читаются в порядке байтов машины (little-endian, как и load_bits)
+    template <size_t W>
+    typename WordOf<W>::type load(const uint8_t* p) {
+        typename WordOf<W>::type word;
+        std::memcpy(&word, p, W);
+        return word;
+    }
+
+    template <size_t W>
+    void store(uint8_t* p, typename WordOf<W>::type word) {
+        std::memcpy(p, &word, W);
+    }
+
+
+#ifdef __SSE2__
+
+    template <size_t W, bool Xor>
+    __m128i combine(__m128i a, __m128i b) {
+        if constexpr (Xor) {
+            return _mm_xor_si128(a, b);
+        } else if constexpr (W == 1) {
+            return _mm_add_epi8(a, b);
+        } else if constexpr (W == 2) {
+            return _mm_add_epi16(a, b);
+        } else if constexpr (W == 4) {
+            return _mm_add_epi32(a, b);
+        } else {
+            return _mm_add_epi64(a, b);
+        }
+    }
+
+    template <size_t W, bool Xor>
+    __m128i uncombine(__m128i a, __m128i b) {
+        if constexpr (Xor) {
+            return _mm_xor_si128(a, b);
+        } else if constexpr (W == 1) {
+            return _mm_sub_epi8(a, b);
+        } else if constexpr (W == 2) {
+            return _mm_sub_epi16(a, b);
+        } else if constexpr (W == 4) {
+            return _mm_sub_epi32(a, b);
+        } else {
+            return _mm_sub_epi64(a, b);
+        }
+    }
+
+    // Последнее слово регистра во всех словах
+    template <size_t W>
+    __m128i broadcast_last(__m128i x) {
+        if constexpr (W == 1) {
+            x = _mm_unpackhi_epi8(x, x);
+        }
+        if constexpr (W <= 2) {
+            x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+        if constexpr (W <= 4) {
+            return _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+        } else {
+            return _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 2, 3, 2));
+        }
+    }
+
+#endif
+
+
+    // Разность (Xor -- исключающее или) каждого слова с предыдущим.
+    //   Возвращает число обработанных байтов: остаток короче слова
+    //   копируется вызывающим. out может совпадать с in.
+    template <size_t W, bool Xor>
+    uint64_t encode_words(const uint8_t* in, uint64_t size, uint8_t* out) {
+        using Word = typename WordOf<W>::type;
+        uint64_t bytes = size / W * W;
+        uint64_t i = 0;
+        Word before = 0;
+#ifdef __SSE2__
+        __m128i prev = _mm_setzero_si128();
+        for (; i + 16 <= bytes; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            __m128i shifted = _mm_or_si128(_mm_slli_si128(x, W), _mm_srli_si128(prev, 16 - W));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), uncombine<W, Xor>(x, shifted));
+            prev = x;
+        }
+        uint8_t last[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(last), prev);
+        before = load<W>(last + 16 - W);
+#endif
+        for (; i < bytes; i += W) {
+            Word word = load<W>(in + i);
+            store<W>(out + i, Xor ? word ^ before : static_cast<Word>(word - before));
+            before = word;
+        }
+        return bytes;
+    }
+
+
+    // Обратное преобразование: префиксные суммы (или xor) слов.
+    //   Lane = 1 -- слова складываются побайтово, без переносов.
+    //   out может совпадать с in.
+    template <size_t W, bool Xor, size_t Lane = W>
+    uint64_t decode_words(const uint8_t* in, uint64_t size, uint8_t* out) {
+        using Word = typename WordOf<W>::type;
+        uint64_t bytes = size / W * W;
+        uint64_t i = 0;
+#ifdef __SSE2__
+        // Префиксные суммы внутри регистра за log2(16 / W) сдвигов,
+        //    затем прибавляется последнее слово предыдущего регистра
+        __m128i carry = _mm_setzero_si128();
+        for (; i + 16 <= bytes; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            x = combine<Lane, Xor>(x, _mm_slli_si128(x, W));
+            if constexpr (2 * W < 16) {
+                x = combine<Lane, Xor>(x, _mm_slli_si128(x, 2 * W));
+            }
+            if constexpr (4 * W < 16) {
+                x = combine<Lane, Xor>(x, _mm_slli_si128(x, 4 * W));
+            }
+            if constexpr (8 * W < 16) {
+                x = combine<Lane, Xor>(x, _mm_slli_si128(x, 8 * W));
+            }
+            x = combine<Lane, Xor>(x, carry);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), x);
+            carry = broadcast_last<W>(x);
+        }
+#endif
+        for (; i < bytes && Lane == 1 && W > 1; ++i) {
+            out[i] = static_cast<uint8_t>(in[i] + (i >= W ? out[i - W] : 0));
+        }
+        for (; i < bytes; i += W) {
+            Word before = i > 0 ? load<W>(out + i - W) : 0;
+            Word word = load<W>(in + i);
+            store<W>(out + i, Xor ? word ^ before : static_cast<Word>(word + before));
+        }
+        return bytes;
+    }
+
+
+#ifdef __SSE2__
+
+    // Номер плоскости, которая после разбиения оказывается в регистре p:
+    //    биты p в обратном порядке
+    constexpr size_t plane_of(size_t p, size_t width) {
+        size_t plane = 0;
+        for (size_t bit = 1; bit < width; bit <<= 1u) {
+            plane = (plane << 1u) | ((p & bit) ? 1 : 0);
+        }
+        return plane;
+    }
+
+#endif
+
+
+    // Разбиение записей по плоскостям. Блок из 16 записей загружается
+    //    в W регистров; каждый шаг разделяет четные и нечетные байты
+    //    групп регистров, после log2(W) шагов в каждом регистре
+    //    оказываются 16 байтов одной плоскости.
+    template <size_t W>
+    uint64_t split_planes(const uint8_t* in, uint64_t size, uint8_t* out) {
+        uint64_t records = size / W;
+        uint64_t i = 0;
+#ifdef __SSE2__
+        const __m128i low = _mm_set1_epi16(0x00ff);
+        for (; i + 16 <= records; i += 16) {
+            __m128i r[W];
+            for (size_t k = 0; k < W; ++k) {
+                r[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * W + 16 * k));
+            }
+            // Без полной развертки регистры r и t попадают в память
+#pragma GCC unroll 8
+            for (size_t group = W; group >= 2; group /= 2) {
+#pragma GCC unroll 8
+                for (size_t g = 0; g < W; g += group) {
+                    __m128i t[W];
+                    for (size_t k = 0; k < group / 2; ++k) {
+                        __m128i a = r[g + 2 * k];
+                        __m128i b = r[g + 2 * k + 1];
+                        t[k] = _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+                        t[group / 2 + k] = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+                    }
+                    for (size_t k = 0; k < group; ++k) {
+                        r[g + k] = t[k];
+                    }
+                }
+            }
+            for (size_t p = 0; p < W; ++p) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + plane_of(p, W) * records + i), r[p]);
+            }
+        }
+#endif
+        for (; i < records; ++i) {
+            for (size_t j = 0; j < W; ++j) {
+                out[j * records + i] = in[i * W + j];
+            }
+        }
+        return records * W;
+    }
+
+
+    // Обратное разбиению: шаги в обратном порядке чередуют байты
+    template <size_t W>
+    uint64_t merge_planes(const uint8_t* in, uint64_t size, uint8_t* out) {
+        uint64_t records = size / W;
+        uint64_t i = 0;
+#ifdef __SSE2__
+        for (; i + 16 <= records; i += 16) {
+            __m128i r[W];
+            for (size_t p = 0; p < W; ++p) {
+                r[p] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + plane_of(p, W) * records + i));
+            }
+#pragma GCC unroll 8
+            for (size_t group = 2; group <= W; group *= 2) {
+#pragma GCC unroll 8
+                for (size_t g = 0; g < W; g += group) {
+                    __m128i t[W];
+                    for (size_t k = 0; k < group / 2; ++k) {
+                        __m128i even = r[g + k];
+                        __m128i odd = r[g + group / 2 + k];
+                        t[2 * k] = _mm_unpacklo_epi8(even, odd);
+                        t[2 * k + 1] = _mm_unpackhi_epi8(even, odd);
+                    }
+                    for (size_t k = 0; k < group; ++k) {
+                        r[g + k] = t[k];
+                    }
+                }
+            }
+            for (size_t k = 0; k < W; ++k) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * W + 16 * k), r[k]);
+            }
+        }
+#endif
+        for (; i < records; ++i) {
+            for (size_t j = 0; j < W; ++j) {
+                out[i * W + j] = in[j * records + i];
+            }
+        }
+        return records * W;
+    }
+
+
+    template <template <size_t> class Kernel>
+    uint64_t by_width(uint8_t width, const uint8_t* in, uint64_t size, uint8_t* out) {
+        switch (width) {
+            case 1: return Kernel<1>::run(in, size, out);
+            case 2: return Kernel<2>::run(in, size, out);
+            case 4: return Kernel<4>::run(in, size, out);
+            case 8: return Kernel<8>::run(in, size, out);
+            default: throw std::invalid_argument("bad filter width");
+        }
+    }
+
+    template <size_t W> struct EncodeDelta { static constexpr auto run = encode_words<W, false>; };
+    template <size_t W> struct DecodeDelta { static constexpr auto run = decode_words<W, false>; };
+    template <size_t W> struct EncodeXor { static constexpr auto run = encode_words<W, true>; };
+    template <size_t W> struct DecodeXor { static constexpr auto run = decode_words<W, true>; };
+    template <size_t W> struct Split { static constexpr auto run = split_planes<W>; };
+    template <size_t W> struct Merge { static constexpr auto run = merge_planes<W>; };
+    template <size_t W> struct UndoPlaneDelta { static constexpr auto run = decode_words<W, false, 1>; };
+
+
+    void transform(Filter filter, bool undo, const uint8_t* in, uint64_t size, uint8_t* out) {
+        uint64_t done = 0;
+        switch (filter.kind) {
+            case FilterKind::NONE:
+                break;
+            case FilterKind::DELTA:
+                done = undo
+                    ? by_width<DecodeDelta>(filter.width, in, size, out)
+                    : by_width<EncodeDelta>(filter.width, in, size, out);
+                break;
+            case FilterKind::XOR:
+                done = undo
+                    ? by_width<DecodeXor>(filter.width, in, size, out)
+                    : by_width<EncodeXor>(filter.width, in, size, out);
+                break;
+            case FilterKind::SPLIT:
+                // Разность байтов в плоскости -- то же, что побайтовая
+                //    разность записей, поэтому она снимается после слияния
+                if (undo) {
+                    done = by_width<Merge>(filter.width, in, size, out);
+                    by_width<UndoPlaneDelta>(filter.width, out, done, out);
+                } else {
+                    done = by_width<Split>(filter.width, in, size, out);
+                    uint64_t records = size / filter.width;
+                    for (uint64_t plane = 0; plane < done; plane += records) {
+                        encode_words<1, false>(out + plane, records, out + plane);
+                    }
+                }
+                break;
+        }
+        if (done < size) {
+            std::memcpy(out + done, in + done, size - done);
+        }
+    }
+
+
+    const char* const KIND_NAMES[] = {"none", "delta", "xor", "split"};
+
+} // \FILTER
+
+
+uint8_t filter_code(Filter filter) {
+    if (filter.kind == FilterKind::NONE) {
+        return 0;
+    }
+    uint8_t log_width = 0;
+    while ((1u << log_width) < filter.width) {
+        ++log_width;
+    }
+    return static_cast<uint8_t>(static_cast<uint8_t>(filter.kind) << 4u | log_width);
+}
+
+
+Filter filter_from_code(uint8_t code) {
+    auto kind = code >> 4u;
+    auto log_width = code & 0xfu;
+    if (kind > static_cast<uint8_t>(FilterKind::SPLIT) || log_width > 3
+        || (kind == 0 && log_width != 0)) {
+        throw archive_error("unknown block filter");
+    }
+    return {static_cast<FilterKind>(kind), static_cast<uint8_t>(1u << log_width)};
+}
+
+
+Filter parse_filter(const std::string& name) {
+    for (uint8_t kind = 0; kind <= static_cast<uint8_t>(FilterKind::SPLIT); ++kind) {
+        const std::string prefix = KIND_NAMES[kind];
+        if (name.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        auto width = name.substr(prefix.size());
+        if (kind == 0 && width.empty()) {
+            return {};
+        }
+        bool split = kind == static_cast<uint8_t>(FilterKind::SPLIT);
+        if (width == "2" || width == "4" || width == "8" || (width == "1" && !split)) {
+            return {static_cast<FilterKind>(kind), static_cast<uint8_t>(std::stoi(width))};
+        }
+    }
+    throw std::runtime_error("unknown filter: " + name);
+}
+
+
+std::string filter_name(Filter filter) {
+    std::string name = KIND_NAMES[static_cast<uint8_t>(filter.kind)];
+    if (filter.kind != FilterKind::NONE) {
+        name += std::to_string(filter.width);
+    }
+    return name;
+}
+
+
+void apply_filter(Filter filter, const uint8_t* in, uint64_t size, uint8_t* out) {
+    transform(filter, false, in, size, out);
+}
+
+
+void undo_filter(Filter filter, const uint8_t* in, uint64_t size, uint8_t* out) {
+    transform(filter, true, in, size, out);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// Обратимые преобразования блока перед сжатием, для числовых двоичных
+//   данных. Данные делятся на слова ширины width байтов (1, 2, 4 или 8),
+//   хвост короче слова не меняется.
+//     DELTA -- разность со словом перед ним (слова -- целые little-endian)
+//     XOR   -- исключающее или со словом перед ним
+//     SPLIT -- записи из width байтов разбиваются на width плоскостей
+//              (сначала первые байты всех записей, затем вторые и т.д.),
+//              в каждой плоскости байт заменяется разностью с предыдущим:
+//              перестановка сама по себе не меняет частот байтов.
+//   Преобразование хранится в записи блока в каталоге архива одним
+//   байтом: вид(4 бита) log2(width)(4 бита).
+
+enum class FilterKind : uint8_t { NONE, DELTA, XOR, SPLIT };
+
+struct Filter {
+    FilterKind kind = FilterKind::NONE;
+    uint8_t width = 1;
+};
+
+inline bool operator==(Filter a, Filter b) {
+    return a.kind == b.kind && (a.kind == FilterKind::NONE || a.width == b.width);
+}
+
+inline bool operator!=(Filter a, Filter b) {
+    return !(a == b);
+}
+
+uint8_t filter_code(Filter filter);
+
+// Бросает archive_error для неизвестного кода
+Filter filter_from_code(uint8_t code);
+
+// Имена вида none, delta4, xor2, split8. Бросает std::runtime_error
+//   для неизвестного имени.
+Filter parse_filter(const std::string& name);
+std::string filter_name(Filter filter);
+
+// out -- буфер из size байтов, не пересекающийся с in
+void apply_filter(Filter filter, const uint8_t* in, uint64_t size, uint8_t* out);
+void undo_filter(Filter filter, const uint8_t* in, uint64_t size, uint8_t* out);
@@ -1,10 +1,19 @@
 #include "huffman.hpp"
+#include "lanes.hpp"
+#include "tune.hpp"
+#include "wide.hpp"
+#include "words.hpp"
 
 #include <queue>
 #include <vector>
 #include <string>
 #include <cassert>
 #include <array>
+#include <thread>
+#include <algorithm>
+#include <memory>
+#include <cmath>
+#include <cstring>
 
 namespace {
 
@@ -191,19 +200,22 @@ namespace {
     };
 
 
-    std::vector<uint8_t> encode_buffer(
+    // Дописывает закодированный буфер в encoded. Средняя длина кода
+    //    Хаффмана меньше энтропии + 1 <= 9 бит, поэтому память под
+    //    результат выделяется один раз.
+    void encode_buffer(
         const uint8_t* raw_data,
         const uint64_t size, 
-        const CodeTree& tree
+        const std::array<Bits, 256>& table,
+        std::vector<uint8_t>* encoded_ptr
     ) {
-        std::vector<uint8_t> encoded; // NRVO
-
-        std::array<Bits, 256> table = tree.create_table();
+        std::vector<uint8_t>& encoded = *encoded_ptr;
+        encoded.reserve(encoded.size() + max_encoded_size(size));
 
         uint8_t current_offset = 0; // текущий отступ от начала байта
         encoded.push_back(0);
         for (uint64_t i = 0; i < size; ++i) {
-            Bits& symbol = table[raw_data[i]];
+            const Bits& symbol = table[raw_data[i]];
 
             // Если код длинный, записываем сначала его целые байты
             for (size_t j = 0; j < symbol.data.size() - 1; ++j) {
@@ -228,7 +240,50 @@ namespace {
         if (current_offset > 0) {
             encoded.push_back(current_offset);
         }
-        return encoded;
+    }
+
+
+    // Наименьший размер данных для кодирования участками
+    constexpr uint64_t MIN_LANES_SIZE = 4 * 1024;
+
+
+    // Таблица для encode_lanes; false, если есть коды длиннее
+    //    MAX_LANE_CODE_LENGTH
+    bool make_lane_table(const std::array<Bits, 256>& codes, LaneTable* table) {
+        for (size_t symbol = 0; symbol < 256; ++symbol) {
+            const Bits& code = codes[symbol];
+            uint64_t length = code.data.size() * 8 - code.last_bit_pos;
+            if (length > MAX_LANE_CODE_LENGTH) {
+                return false;
+            }
+            uint64_t value = 0;
+            for (uint8_t byte : code.data) {
+                value = value << 8u | byte;
+            }
+            (*table)[symbol] = value >> code.last_bit_pos | length << 32u;
+        }
+        return true;
+    }
+
+
+    // То же, что encode_buffer, но участками (см. lanes.hpp), если коды
+    //    не слишком длинные и данных достаточно
+    void encode_symbols(
+        const uint8_t* data,
+        uint64_t size,
+        const std::array<Bits, 256>& codes,
+        std::vector<uint8_t>* encoded,
+        EncodeLoop loop
+    ) {
+        LaneTable table;
+        if (loop == EncodeLoop::SERIAL || size < MIN_LANES_SIZE || !make_lane_table(codes, &table)) {
+            encode_buffer(data, size, codes, encoded);
+            return;
+        }
+        uint64_t bits = encode_lanes(data, size, table, encoded, loop == EncodeLoop::BEST && has_avx2());
+        // Как в encode_buffer: число значимых битов последнего байта,
+        //    0 -- если он заполнен (****)
+        encoded->push_back(static_cast<uint8_t>(bits % 8));
     }
 
 
@@ -321,10 +376,44 @@ namespace {
         }
     }
 
+    // Проверяет, что таблица целиком лежит в [data, end) и описывает
+    //   дерево ровно с alphabet_size листьями. Вершины при этом
+    //   не создаются, поэтому испорченная таблица ничего не теряет.
+    void check_tree(const uint8_t* data, const uint8_t* end) {
+        if (data >= end) {
+            throw std::runtime_error("corrupted tree");
+        }
+        uint16_t alphabet_size = *data + 1;
+        if (static_cast<uint64_t>(end - data) <= alphabet_size) {
+            throw std::runtime_error("corrupted tree");
+        }
+        DecoderStruct ds{nullptr, data + 1 + alphabet_size};
+        // Число еще не прочитанных вершин и прочитанных листьев
+        uint64_t pending = 1;
+        uint16_t leaves = 0;
+        while (pending > 0) {
+            if (ds.next_byte >= end) {
+                throw std::runtime_error("corrupted tree");
+            }
+            if (ds.get_next_bit()) {
+                ++pending;
+            } else {
+                --pending;
+                if (++leaves > alphabet_size) {
+                    throw std::runtime_error("corrupted tree");
+                }
+            }
+        }
+        if (leaves != alphabet_size) {
+            throw std::runtime_error("corrupted tree");
+        }
+    }
+
     // Декодирование дерева.
     //   Обновляет data: после завершения работы указывает на следующий
-    //   байт после таблицы.
-    CodeTree::Node* decode_tree(const uint8_t** data) {
+    //   байт после таблицы. Таблица не должна выходить за end.
+    CodeTree::Node* decode_tree(const uint8_t** data, const uint8_t* end) {
+        check_tree(*data, end);
         // В первом байте хранится размер алфавита - 1
         const uint8_t* buffer = *data;
         uint16_t alphabet_size = *(buffer++) + 1;
@@ -335,66 +424,420 @@ namespace {
     }
 
 
-    std::vector<uint8_t> decode_buffer(
-        const uint8_t* buffer,
-        uint64_t size,
-        const CodeTree& tree
-    ) {
-        std::vector<uint8_t> decoded; // NRVO
+    // Минимальный размер участка (в битах) для параллельного декодирования
+    constexpr uint64_t MIN_CHUNK_BITS = 8 * 64 * 1024;
+    // Минимальный размер участка (в битах) при чередовании участков
+    //    в одном потоке
+    constexpr uint64_t MIN_STREAM_BITS = 8 * 16 * 1024;
+    // Размер окна (в битах), в котором запоминаются начала символов
+    //    для синхронизации с предыдущим участком. Коды Хаффмана обычно
+    //    синхронизируются за несколько десятков бит.
+    constexpr uint64_t SYNC_WINDOW_BITS = 8 * 1024;
+
+    // Ширины таблиц и числа чередующихся участков, для которых
+    //    есть специализированные декодеры
+    constexpr std::array<unsigned, 4> TABLE_WIDTHS = {6, 8, 10, 12};
+    constexpr std::array<unsigned, 3> STREAM_COUNTS = {1, 2, 4};
+    // Таблица выбирается так, чтобы коды длиннее нее встречались
+    //    не чаще, чем в 1/64 случаев
+    constexpr double LONG_CODES_SHARE = 1.0 / 64;
+
+
+    // Значение бита с номером pos (биты в байте нумеруются от старшего)
+    inline bool get_bit(const uint8_t* buffer, uint64_t pos) {
+        return (buffer[pos >> 3u] & (0x80u >> (pos & 7u))) != 0;
+    }
+
 
-        uint8_t last_byte_data = *(buffer + size - 1);
-        // Если последний байт равен 0, то считаем, что это часть 
-        //     буфера (случай (****)). Иначе он содержит число 
-        //     значимых битов в последнем байте.
+    // Количество значимых битов в буфере из size байтов с последним
+    //    байтом last_byte_data (см. encode_buffer)
+    uint64_t count_bits(uint8_t last_byte_data, uint64_t size) {
+        if (size == 0 || last_byte_data > 8 || (last_byte_data != 0 && size < 2)) {
+            throw std::runtime_error("corrupted data");
+        }
         if (last_byte_data == 0) {
-            ++size;
+            return (size - 1) * 8;
+        }
+        return (size - 2) * 8 + last_byte_data;
+    }
+
+
+    // Таблица декодирования по первым bits битам потока: символ и длина
+    //    кода, если код не длиннее bits, иначе вершина дерева, в которую
+    //    ведут эти биты.
+    struct TreeTable {
+        unsigned bits = 0;
+        std::vector<uint16_t> entries; // символ | длина << 8, длина 0 -- код длиннее
+        std::vector<const CodeTree::Node*> long_codes;
+    };
+
+
+    void fill_tree_table(
+        TreeTable* table,
+        const CodeTree::Node* node,
+        uint32_t code,
+        unsigned length
+    ) {
+        if (!node->zero) {
+            auto entry = static_cast<uint16_t>(node->symbol | length << 8u);
+            std::fill(
+                table->entries.begin() + (code << (table->bits - length)),
+                table->entries.begin() + ((code + 1) << (table->bits - length)),
+                entry
+            );
+            return;
+        }
+        if (length == table->bits) {
+            table->long_codes[code] = node;
+            return;
+        }
+        fill_tree_table(table, node->zero, code << 1u, length + 1);
+        fill_tree_table(table, node->one, code << 1u | 1u, length + 1);
+    }
+
+
+    // Требуется: в дереве больше одной вершины
+    TreeTable build_tree_table(const CodeTree& tree, unsigned bits) {
+        TreeTable table; // NRVO
+        table.bits = bits;
+        table.entries.assign(size_t{1} << bits, 0);
+        table.long_codes.assign(size_t{1} << bits, nullptr);
+        fill_tree_table(&table, tree.root, 0, 0);
+        return table;
+    }
+
+
+    void count_leaves(const CodeTree::Node* node, unsigned depth, std::array<uint32_t, 64>* leaves) {
+        if (!node->zero) {
+            ++(*leaves)[std::min(depth, 63u)];
+            return;
+        }
+        count_leaves(node->zero, depth + 1, leaves);
+        count_leaves(node->one, depth + 1, leaves);
+    }
+
+
+    // Номер в TABLE_WIDTHS самой узкой таблицы, для которой доля длинных
+    //    кодов не больше LONG_CODES_SHARE. Символ с кодом длины d
+    //    встречается с частотой около 2^-d.
+    size_t choose_table_width(const CodeTree& tree) {
+        std::array<uint32_t, 64> leaves{};
+        count_leaves(tree.root, 0, &leaves);
+        double covered = 0;
+        unsigned depth = 0;
+        for (size_t i = 0; i < TABLE_WIDTHS.size(); ++i) {
+            for (; depth <= TABLE_WIDTHS[i]; ++depth) {
+                covered += std::ldexp(leaves[depth], -static_cast<int>(depth));
+            }
+            if (covered >= 1 - LONG_CODES_SHARE) {
+                return i;
+            }
         }
+        return TABLE_WIDTHS.size() - 1;
+    }
+
 
-        uint8_t last_bit_pos = 8 - last_byte_data; // Позиция последнего 
-                                                //   бита в последнем байте
-        const uint8_t* from = buffer;
-        const uint8_t* to = buffer + size - 2;
+    // Таблица декодирования выбранной ширины; для дерева из одной
+    //    вершины -- пустая
+    TreeTable make_tree_table(const CodeTree& tree) {
+        if (!tree.root->zero) {
+            return {};
+        }
+        return build_tree_table(tree, TABLE_WIDTHS[choose_table_width(tree)]);
+    }
 
-        uint8_t current_bit = 7;
-        CodeTree::Node* current_node = tree.root;
 
-        // Если в дереве ввсего одна вершина
-        if (current_node && (!current_node->zero)) {
-            // Декодируем целые байты
-            for (uint64_t i = 0; i < size - 2; ++i){
-                for (int j = 0; j < 8; ++j) {
-                    decoded.push_back(current_node->symbol);
+    // Результат (возможно, спекулятивного) декодирования участка
+    struct DecodedChunk {
+        std::vector<uint8_t> symbols;
+        std::vector<uint64_t> starts; // начала первых символов участка
+        uint64_t end_pos = 0;         // начало первого символа за участком
+        bool valid = true;            // false, если поток оборвался посреди кода
+    };
+
+
+    // Участок декодирования: символы, начинающиеся в битах [begin, stop).
+    //   Начала символов из окна [begin, begin + sync_window) сохраняются
+    //   в DecodedChunk::starts, так что starts[k] -- начало symbols[k].
+    struct StreamRange {
+        uint64_t begin;
+        uint64_t stop;
+        uint64_t sync_window;
+    };
+
+
+    // 64 бита потока, начиная с бита pos; достоверны старшие 57.
+    //    Требуется: pos / 8 + 8 <= размер буфера.
+    inline uint64_t load_bits(const uint8_t* buffer, uint64_t pos) {
+        uint64_t word;
+        std::memcpy(&word, buffer + (pos >> 3u), sizeof(word));
+        return __builtin_bswap64(word) << (pos & 7u);
+    }
+
+
+    // То же для любого pos: за концом буфера из size байтов -- нули
+    inline uint64_t load_bits_safe(const uint8_t* buffer, uint64_t size, uint64_t pos) {
+        if ((pos >> 3u) + 8 <= size) {
+            return load_bits(buffer, pos);
+        }
+        uint64_t word = 0;
+        for (uint64_t i = pos >> 3u; i < (pos >> 3u) + 8; ++i) {
+            word = word << 8u | (i < size ? buffer[i] : 0);
+        }
+        return word << (pos & 7u);
+    }
+
+
+    // Декодирует Streams участков вперемешку: состояние участка -- одна
+    //    позиция, цепочки зависимостей разных участков независимы,
+    //    и процессор выполняет их шаги одновременно. Ширина таблицы
+    //    TableBits известна при компиляции, так что сдвиги -- константы;
+    //    TableBits == 0 -- общий цикл с шириной table.bits.
+    template <unsigned TableBits, unsigned Streams>
+    void decode_streams(
+        const uint8_t* buffer,
+        uint64_t total_bits,
+        const TreeTable& table,
+        const StreamRange* ranges,
+        DecodedChunk* chunks
+    ) {
+        const unsigned bits = TableBits ? TableBits : table.bits;
+        const uint64_t size = (total_bits + 7) / 8;
+        std::array<uint64_t, Streams> pos;
+        // За одну загрузку 64 бит (57 достоверных) декодируется group
+        //    кодов не длиннее таблицы. Пока pos + span <= fast_stop,
+        //    группа не выходит за участок и 8 байт от pos лежат в буфере.
+        const unsigned group = 57 / bits;
+        const uint64_t span = group * bits;
+        std::array<uint64_t, Streams> fast_stop;
+        for (unsigned s = 0; s < Streams; ++s) {
+            pos[s] = ranges[s].begin;
+            fast_stop[s] = std::min(ranges[s].stop, size >= 8 ? (size - 8) * 8 + span : 0);
+        }
+
+        auto step = [&](unsigned s) {
+            DecodedChunk& chunk = chunks[s];
+            if (pos[s] - ranges[s].begin < ranges[s].sync_window) {
+                chunk.starts.push_back(pos[s]);
+            }
+            auto prefix = static_cast<uint32_t>(load_bits_safe(buffer, size, pos[s]) >> (64 - bits));
+            uint16_t entry = table.entries[prefix];
+            unsigned length = entry >> 8u;
+            if (length == 0) {
+                // Код длиннее таблицы: дальше по дереву
+                const CodeTree::Node* node = table.long_codes[prefix];
+                length = bits;
+                while (node->zero) {
+                    uint64_t bit = pos[s] + length++;
+                    node = bit < total_bits && get_bit(buffer, bit) ? node->one : node->zero;
                 }
+                entry = node->symbol;
+            }
+            if (pos[s] + length > total_bits) {
+                chunk.valid = false;
+                return;
             }
+            chunk.symbols.push_back(static_cast<uint8_t>(entry));
+            pos[s] += length;
+        };
+        auto running = [&](unsigned s) {
+            return chunks[s].valid && pos[s] < ranges[s].stop;
+        };
 
-            // Декодируем последний байт
-            while (last_bit_pos++ < 8) {
-                decoded.push_back(current_node->symbol);
+        // Начала символов в окнах синхронизации запоминаются медленным путем
+        for (unsigned s = 0; s < Streams; ++s) {
+            while (running(s) && pos[s] - ranges[s].begin < ranges[s].sync_window) {
+                step(s);
             }
-        } else {
-            // Если дерево из более, чем 1 вершины
-            while ((from < to) || ((from == to) && (current_bit >= last_bit_pos))) {
-                bool bit = (*from & (1u << current_bit)) != 0; // текущий бит
-                if (current_bit == 0) {
-                    current_bit = 7;
-                    ++from;
-                } else {
-                    --current_bit;
+        }
+
+        // Быстрый путь: участки далеко от конца. Символы собираются
+        //    в локальный буфер: запись в него не может изменить позиции,
+        //    и компилятор держит их в регистрах.
+        constexpr unsigned BATCH = 256;
+        std::array<std::array<uint8_t, BATCH>, Streams> batch;
+        std::array<unsigned, Streams> count;
+        while (true) {
+            count.fill(0);
+            bool progress = true;
+            bool long_code = false;
+            while (progress && !long_code) {
+                progress = false;
+                for (unsigned s = 0; s < Streams; ++s) {
+                    if (pos[s] + span > fast_stop[s] || count[s] + group > BATCH) {
+                        continue;
+                    }
+                    progress = true;
+                    uint64_t acc = load_bits(buffer, pos[s]);
+                    for (unsigned k = 0; k < group; ++k) {
+                        uint16_t entry = table.entries[acc >> (64 - bits)];
+                        auto length = static_cast<uint8_t>(entry >> 8u);
+                        if (length == 0) {
+                            long_code = true;
+                            break;
+                        }
+                        acc <<= length;
+                        pos[s] += length;
+                        batch[s][count[s]++] = static_cast<uint8_t>(entry);
+                    }
                 }
+            }
+            for (unsigned s = 0; s < Streams; ++s) {
+                chunks[s].symbols.insert(
+                    chunks[s].symbols.end(), batch[s].begin(), batch[s].begin() + count[s]
+                );
+            }
+
+            // Длинные коды и концы участков -- медленным путем
+            bool any_running = false;
+            for (unsigned s = 0; s < Streams; ++s) {
+                if (!running(s)) {
+                    continue;
+                }
+                any_running = true;
+                uint64_t prefix = load_bits_safe(buffer, size, pos[s]) >> (64 - bits);
+                if (pos[s] + span > fast_stop[s] || (table.entries[prefix] >> 8u) == 0) {
+                    step(s);
+                }
+            }
+            if (!any_running) {
+                break;
+            }
+        }
+        for (unsigned s = 0; s < Streams; ++s) {
+            chunks[s].end_pos = pos[s];
+        }
+    }
+
+
+    using StreamsDecoder = void (*)(
+        const uint8_t*, uint64_t, const TreeTable&, const StreamRange*, DecodedChunk*
+    );
+
+    template <unsigned TableBits>
+    constexpr std::array<StreamsDecoder, STREAM_COUNTS.size()> decoders_for_width() {
+        return {decode_streams<TableBits, 1>, decode_streams<TableBits, 2>, decode_streams<TableBits, 4>};
+    }
+
+    // DECODERS[i][j] -- декодер для TABLE_WIDTHS[i] и STREAM_COUNTS[j]
+    constexpr std::array<std::array<StreamsDecoder, STREAM_COUNTS.size()>, TABLE_WIDTHS.size()> DECODERS = {
+        decoders_for_width<6>(),
+        decoders_for_width<8>(),
+        decoders_for_width<10>(),
+        decoders_for_width<12>(),
+    };
+
+
+    // Спекулятивное параллельное декодирование одного битового потока.
+    //   Поток делится на участки, каждый поток выполнения декодирует
+    //   несколько соседних участков вперемешку, начиная с их границ,
+    //   как если бы там начинался символ. Затем участки склеиваются
+    //   последовательно: участок точно декодируется от конца предыдущего,
+    //   пока начало символа не совпадет с одним из спекулятивных начал;
+    //   остаток участка уже декодирован верно. Если совпадения в окне
+    //   синхронизации нет, участок декодируется заново.
+    std::vector<uint8_t> decode_buffer_parallel(
+        const uint8_t* buffer,
+        uint64_t size,
+        const CodeTree& tree,
+        const TreeTable& table,
+        unsigned threads,
+        uint64_t expected_size = 0,
+        DecodeLoop loop = DecodeLoop::SPECIALISED
+    ) {
+        if (size == 0) {
+            throw std::runtime_error("corrupted data");
+        }
+        uint64_t total_bits = count_bits(buffer[size - 1], size);
+        // Если в дереве одна вершина, каждый бит кодирует символ
+        if (!tree.root->zero) {
+            return std::vector<uint8_t>(total_bits, tree.root->symbol);
+        }
+
+        uint64_t max_chunks = std::max<uint64_t>(total_bits / MIN_CHUNK_BITS, 1);
+        auto n_threads = static_cast<size_t>(std::min<uint64_t>(threads, max_chunks));
+        auto width = static_cast<size_t>(
+            std::find(TABLE_WIDTHS.begin(), TABLE_WIDTHS.end(), table.bits) - TABLE_WIDTHS.begin()
+        );
+        size_t streams = 0;
+        if (loop == DecodeLoop::SPECIALISED) {
+            unsigned max_streams = tuned_config().streams;
+            while (streams + 1 < STREAM_COUNTS.size()
+                && (max_streams == 0 || STREAM_COUNTS[streams + 1] <= max_streams)
+                && total_bits / (n_threads * STREAM_COUNTS[streams + 1]) >= MIN_STREAM_BITS) {
+                ++streams;
+            }
+        }
+        StreamsDecoder decode = DECODERS[width][streams];
+        StreamsDecoder decode_exact = DECODERS[width][0];
+        if (loop == DecodeLoop::GENERIC) {
+            decode = decode_exact = decode_streams<0, 1>;
+        }
+
+        size_t chunks_per_thread = STREAM_COUNTS[streams];
+        size_t n_chunks = n_threads * chunks_per_thread;
+        uint64_t chunk_bits = ((total_bits + n_chunks - 1) / n_chunks + 7) / 8 * 8;
+        auto chunk_stop = [&](size_t i) {
+            return std::min(total_bits, chunk_bits * (i + 1));
+        };
 
-                assert(current_node);
-                current_node = bit ? current_node->one : current_node->zero;
-                // Если дошли до листа, выписываем символ и возвращаемся в корень
-                if (!current_node->zero) {
-                    decoded.push_back(current_node->symbol);
-                    current_node = tree.root;
+        std::vector<StreamRange> ranges;
+        for (size_t i = 0; i < n_chunks; ++i) {
+            ranges.push_back({chunk_bits * i, chunk_stop(i), i == 0 ? 0 : SYNC_WINDOW_BITS});
+        }
+        std::vector<DecodedChunk> chunks(n_chunks);
+        chunks[0].symbols.reserve(expected_size);
+        std::vector<std::thread> workers;
+        for (size_t i = chunks_per_thread; i < n_chunks; i += chunks_per_thread) {
+            workers.emplace_back(
+                decode, buffer, total_bits, std::cref(table), &ranges[i], &chunks[i]
+            );
+        }
+        decode(buffer, total_bits, table, &ranges[0], &chunks[0]);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        std::vector<uint8_t> decoded = std::move(chunks[0].symbols); // NRVO
+        uint64_t pos = chunks[0].end_pos;
+        for (size_t i = 1; i < n_chunks; ++i) {
+            const DecodedChunk& chunk = chunks[i];
+            // Точно декодируем участок от pos, пока начало символа
+            //    не совпадет с одним из спекулятивных начал
+            StreamRange head_range{
+                pos, std::min(chunk_stop(i), ranges[i].begin + SYNC_WINDOW_BITS), SYNC_WINDOW_BITS
+            };
+            DecodedChunk head;
+            decode_exact(buffer, total_bits, table, &head_range, &head);
+            size_t a = 0;
+            size_t b = 0;
+            while (a < head.starts.size() && b < chunk.starts.size()
+                && head.starts[a] != chunk.starts[b]) {
+                if (head.starts[a] < chunk.starts[b]) {
+                    ++a;
+                } else {
+                    ++b;
                 }
             }
+            if (chunk.valid && a < head.starts.size() && b < chunk.starts.size()) {
+                decoded.insert(decoded.end(), head.symbols.begin(), head.symbols.begin() + a);
+                decoded.insert(decoded.end(), chunk.symbols.begin() + b, chunk.symbols.end());
+                pos = chunk.end_pos;
+                continue;
+            }
+            // Участок не синхронизировался: декодируем его до конца
+            decoded.insert(decoded.end(), head.symbols.begin(), head.symbols.end());
+            StreamRange rest_range{head.end_pos, chunk_stop(i), 0};
+            DecodedChunk rest;
+            decode_exact(buffer, total_bits, table, &rest_range, &rest);
+            decoded.insert(decoded.end(), rest.symbols.begin(), rest.symbols.end());
+            pos = rest.end_pos;
         }
 
         return decoded;
     }
 
+
     void print_summary(uint64_t from, uint64_t to, uint64_t table) {
         std::cout << from << '\n' << to << '\n' << table << '\n';
     }
@@ -411,7 +854,7 @@ namespace {
 
 } // \HUFFMAN
 
-void encode(std::istream& istr, std::ostream& ostr, bool verbose) {
+void encode(std::istream& istr, std::ostream& ostr, bool verbose, Alphabet alphabet) {
     uint64_t size = get_file_size(istr);
 
     if (!ostr || size == 0) {
@@ -419,24 +862,36 @@ void encode(std::istream& istr, std::ostream& ostr, bool verbose) {
         return;
     }
 
-    char* buffer = new char[size];
-    istr.read(buffer, size);
+    std::vector<uint8_t> buffer(size);
+    istr.read(reinterpret_cast<char*>(buffer.data()), size);
 
-    std::array<uint64_t, 256> freqs {};
-    for (uint64_t i = 0; i < size; ++i) {
-        auto index = static_cast<const uint8_t>(buffer[i]);
-        ++freqs[index];
+    if (alphabet == Alphabet::WORDS) {
+        auto compressed = compress_words(buffer.data(), size);
+        uint64_t table_size = word_table_size(compressed.data(), compressed.size());
+        print_summary(size, compressed.size() - table_size, table_size);
+        if (verbose) {
+            print_word_codes(compressed.data(), compressed.size(), std::cout);
+        }
+        ostr.write(reinterpret_cast<char*>(compressed.data()), compressed.size());
+        return;
+    }
+    if (alphabet == Alphabet::WIDE) {
+        auto compressed = compress_wide(buffer.data(), size);
+        uint64_t table_size = wide_table_size(compressed.data(), compressed.size());
+        print_summary(size, compressed.size() - table_size, table_size);
+        if (verbose) {
+            print_wide_codes(compressed.data(), compressed.size(), std::cout);
+        }
+        ostr.write(reinterpret_cast<char*>(compressed.data()), compressed.size());
+        return;
     }
 
-    auto tree = CodeTree(freqs);
+    auto tree = CodeTree(byte_histogram(buffer.data(), size));
 
-    auto encoded_buffer = encode_buffer(
-        reinterpret_cast<uint8_t*>(buffer), size, tree
-    );
+    std::vector<uint8_t> encoded_buffer;
+    encode_symbols(buffer.data(), size, tree.create_table(), &encoded_buffer, EncodeLoop::BEST);
     auto encoded_table = encode_tree(tree);
 
-    delete[] buffer;
-
     // Последний байт буфера хранит информацию о количестве значимых
     //    битов в предпоследнем байте.
     print_summary(size, encoded_buffer.size() - 1, encoded_table.size() + 1);
@@ -455,7 +910,7 @@ void encode(std::istream& istr, std::ostream& ostr, bool verbose) {
 }
 
 
-void decode(std::istream& istr, std::ostream& ostr, bool verbose) {
+void decode(std::istream& istr, std::ostream& ostr, bool verbose, unsigned threads) {
     uint64_t size = get_file_size(istr);
 
     if (!ostr || size == 0) {
@@ -463,20 +918,41 @@ void decode(std::istream& istr, std::ostream& ostr, bool verbose) {
         return;
     }
 
-    char* buffer = new char[size];
-    istr.read(buffer, size);
+    std::vector<uint8_t> buffer(size);
+    istr.read(reinterpret_cast<char*>(buffer.data()), size);
+
+    if (is_word_stream(buffer.data(), size)) {
+        auto decoded = decompress_words(buffer.data(), size);
+        uint64_t table_size = word_table_size(buffer.data(), size);
+        print_summary(size - table_size, decoded.size(), table_size);
+        if (verbose) {
+            print_word_codes(buffer.data(), size, std::cout);
+        }
+        ostr.write(reinterpret_cast<char*>(decoded.data()), decoded.size());
+        return;
+    }
+    if (is_wide_stream(buffer.data(), size)) {
+        auto decoded = decompress_wide(buffer.data(), size);
+        uint64_t table_size = wide_table_size(buffer.data(), size);
+        print_summary(size - table_size, decoded.size(), table_size);
+        if (verbose) {
+            print_wide_codes(buffer.data(), size, std::cout);
+        }
+        ostr.write(reinterpret_cast<char*>(decoded.data()), decoded.size());
+        return;
+    }
 
-    const auto *current_buffer = reinterpret_cast<const uint8_t*>(buffer);
+    const uint8_t *current_buffer = buffer.data();
     const uint8_t *origin = current_buffer;
 
     // decode_tree сдвигает current_buffer на начало буфера с данными
-    CodeTree tree{decode_tree(&current_buffer)};
+    CodeTree tree{decode_tree(&current_buffer, origin + size)};
     auto table_size = static_cast<uint64_t>(current_buffer - origin);
     uint64_t data_size = size - table_size;
     
-    auto decoded = decode_buffer(current_buffer, data_size, tree);
-
-    delete[] buffer;
+    auto decoded = decode_buffer_parallel(
+        current_buffer, data_size, tree, make_tree_table(tree), resolve_threads(threads)
+    );
 
     // Последний байт буфера хранит информацию о количестве значимых
     //    битов в предпоследнем байте.
@@ -490,3 +966,259 @@ void decode(std::istream& istr, std::ostream& ostr, bool verbose) {
         decoded.size()
     );
 }
+
+
+void decode_streaming(
+    std::istream& istr,
+    std::ostream& ostr,
+    bool verbose,
+    uint64_t buffer_size
+) {
+    uint64_t size = get_file_size(istr);
+
+    if (!ostr || size == 0) {
+        print_summary(0, 0, 0);
+        return;
+    }
+
+    std::vector<uint8_t> header(std::min(size, MAX_TABLE_SIZE));
+    istr.read(reinterpret_cast<char*>(header.data()), header.size());
+    if (is_word_stream(header.data(), header.size())) {
+        throw std::runtime_error("word streams can not be decoded with limited memory");
+    }
+    if (is_wide_stream(header.data(), header.size())) {
+        throw std::runtime_error("wide streams can not be decoded with limited memory");
+    }
+    const uint8_t* current_header = header.data();
+    CodeTree tree{decode_tree(&current_header, header.data() + header.size())};
+    auto table_size = static_cast<uint64_t>(current_header - header.data());
+    uint64_t data_size = size - table_size;
+
+    istr.seekg(size - 1);
+    uint64_t total_bits = count_bits(static_cast<uint8_t>(istr.get()), data_size);
+    istr.seekg(table_size);
+
+    std::vector<uint8_t> input(buffer_size);
+    std::vector<uint8_t> output;
+    output.reserve(buffer_size);
+    uint64_t decoded_size = 0;
+    auto put = [&](uint8_t symbol) {
+        output.push_back(symbol);
+        if (output.size() == buffer_size) {
+            ostr.write(reinterpret_cast<char*>(output.data()), output.size());
+            decoded_size += output.size();
+            output.clear();
+        }
+    };
+
+    // Если в дереве одна вершина, каждый бит кодирует символ
+    const CodeTree::Node* node = tree.root;
+    bool single_symbol = !node->zero;
+    for (uint64_t pos = 0; pos < total_bits;) {
+        uint64_t chunk = std::min(buffer_size, (total_bits - pos + 7) / 8);
+        istr.read(reinterpret_cast<char*>(input.data()), chunk);
+        uint64_t chunk_bits = std::min(chunk * 8, total_bits - pos);
+        for (uint64_t bit = 0; bit < chunk_bits; ++bit) {
+            if (single_symbol) {
+                put(node->symbol);
+                continue;
+            }
+            node = get_bit(input.data(), bit) ? node->one : node->zero;
+            if (!node->zero) {
+                put(node->symbol);
+                node = tree.root;
+            }
+        }
+        pos += chunk_bits;
+    }
+    ostr.write(reinterpret_cast<char*>(output.data()), output.size());
+    decoded_size += output.size();
+
+    print_summary(data_size - 1, decoded_size, table_size + 1);
+    if (verbose) {
+        tree.print();
+    }
+}
+
+
+std::array<uint64_t, 256> byte_histogram(const uint8_t* data, uint64_t size) {
+    // Четыре таблицы, чтобы соседние одинаковые байты не ждали
+    //    друг друга при инкременте одного счетчика.
+    std::array<std::array<uint64_t, 256>, 4> partial {};
+    uint64_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        ++partial[0][data[i]];
+        ++partial[1][data[i + 1]];
+        ++partial[2][data[i + 2]];
+        ++partial[3][data[i + 3]];
+    }
+    for (; i < size; ++i) {
+        ++partial[0][data[i]];
+    }
+
+    std::array<uint64_t, 256> freqs {}; // NRVO
+    for (size_t symbol = 0; symbol < 256; ++symbol) {
+        freqs[symbol] = partial[0][symbol] + partial[1][symbol]
+            + partial[2][symbol] + partial[3][symbol];
+    }
+    return freqs;
+}
+
+
+unsigned resolve_threads(unsigned threads) {
+    if (threads == 0) {
+        threads = tuned_config().threads;
+    }
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    return std::max(threads, 1u);
+}
+
+
+std::vector<uint8_t> compress(const uint8_t* data, uint64_t size, EncodeLoop loop) {
+    if (size == 0) {
+        return {};
+    }
+    auto tree = CodeTree(byte_histogram(data, size));
+    std::vector<uint8_t> compressed = encode_tree(tree); // NRVO
+    encode_symbols(data, size, tree.create_table(), &compressed, loop);
+    return compressed;
+}
+
+
+std::vector<uint8_t> decompress(
+    const uint8_t* data,
+    uint64_t size,
+    unsigned threads,
+    uint64_t expected_size,
+    DecodeLoop loop
+) {
+    if (size == 0) {
+        return {};
+    }
+    if (is_word_stream(data, size)) {
+        return decompress_words(data, size);
+    }
+    if (is_wide_stream(data, size)) {
+        return decompress_wide(data, size);
+    }
+    const uint8_t* current_buffer = data;
+    CodeTree tree{decode_tree(&current_buffer, data + size)};
+    auto table_size = static_cast<uint64_t>(current_buffer - data);
+    return decode_buffer_parallel(
+        current_buffer, size - table_size, tree, make_tree_table(tree),
+        resolve_threads(threads), expected_size, loop
+    );
+}
+
+
+struct TrainedTable::Impl {
+    CodeTree tree;
+    std::array<Bits, 256> codes;
+    TreeTable table;
+    std::vector<uint8_t> encoded_tree;
+    std::array<uint8_t, 256> lengths{};
+
+    explicit Impl(const std::array<uint64_t, 256>& freqs)
+        : tree(freqs)
+        , codes(tree.create_table())
+        , table(make_tree_table(tree))
+        , encoded_tree(encode_tree(tree))
+    {
+        for (size_t symbol = 0; symbol < codes.size(); ++symbol) {
+            lengths[symbol] = static_cast<uint8_t>(codes[symbol].data.size() * 8 - codes[symbol].last_bit_pos);
+        }
+    }
+};
+
+
+TrainedTable::TrainedTable(const uint8_t* sample, uint64_t size) {
+    // Байты, которых нет в образце, получают частоту 1
+    auto freqs = byte_histogram(sample, size);
+    for (auto& freq : freqs) {
+        ++freq;
+    }
+    impl_ = std::make_unique<Impl>(freqs);
+}
+
+
+TrainedTable::~TrainedTable() = default;
+
+
+std::vector<uint8_t> TrainedTable::compress(const uint8_t* data, uint64_t size) const {
+    std::vector<uint8_t> compressed; // NRVO
+    if (size > 0) {
+        encode_symbols(data, size, impl_->codes, &compressed, EncodeLoop::BEST);
+    }
+    return compressed;
+}
+
+
+std::vector<uint8_t> TrainedTable::compress_stream(
+    const uint8_t* data,
+    uint64_t size,
+    bool* drifted
+) const {
+    if (drifted) {
+        *drifted = false;
+    }
+    if (size == 0) {
+        return {};
+    }
+
+    // Куски по 256 байтов через каждые 4 КиБ; небольшие буферы -- целиком
+    std::array<uint64_t, 256> freqs{};
+    constexpr uint64_t run = 256;
+    constexpr uint64_t stride = 16 * run;
+    if (size <= 16 * stride) {
+        freqs = byte_histogram(data, size);
+    } else {
+        for (uint64_t pos = 0; pos < size; pos += stride) {
+            const uint8_t* end = data + pos + std::min(run, size - pos);
+            for (const uint8_t* byte = data + pos; byte < end; ++byte) {
+                ++freqs[*byte];
+            }
+        }
+    }
+    uint64_t total = 0;
+    double sampled_bits = 0;
+    double entropy_bits = 0;
+    for (size_t symbol = 0; symbol < freqs.size(); ++symbol) {
+        total += freqs[symbol];
+    }
+    for (size_t symbol = 0; symbol < freqs.size(); ++symbol) {
+        if (freqs[symbol] > 0) {
+            auto freq = static_cast<double>(freqs[symbol]);
+            sampled_bits += freq * impl_->lengths[symbol];
+            entropy_bits += freq * std::log2(static_cast<double>(total) / freq);
+        }
+    }
+    if (sampled_bits > (1 + DRIFT_TOLERANCE) * std::max(entropy_bits, static_cast<double>(total))) {
+        if (drifted) {
+            *drifted = true;
+        }
+        return ::compress(data, size);
+    }
+
+    std::vector<uint8_t> compressed = impl_->encoded_tree; // NRVO
+    encode_symbols(data, size, impl_->codes, &compressed, EncodeLoop::BEST);
+    return compressed;
+}
+
+
+std::vector<uint8_t> TrainedTable::decompress(
+    const uint8_t* data,
+    uint64_t size,
+    uint64_t expected_size
+) const {
+    if (size == 0) {
+        return {};
+    }
+    return decode_buffer_parallel(data, size, impl_->tree, impl_->table, 1, expected_size);
+}
+
+
+uint64_t max_encoded_size(uint64_t size) {
+    return size / 8 * 9 + size % 8 * 9 / 8 + 2;
+}
@@ -1,6 +1,111 @@
 #pragma once
 
+#include <array>
 #include <iostream>
+#include <memory>
+#include <vector>
+#include <cstdint>
 
-void encode(std::istream& istr, std::ostream& ostr, bool verbose);
-void decode(std::istream& istr, std::ostream& ostr, bool verbose);
+// Алфавит кодирования: байты, слова и разделители (см. words.hpp) или
+//   16-битные символы (см. wide.hpp). decode определяет алфавит по
+//   заголовку.
+enum class Alphabet { BYTES, WORDS, WIDE };
+
+// threads -- число потоков декодирования (0 -- по числу ядер)
+void encode(
+    std::istream& istr,
+    std::ostream& ostr,
+    bool verbose,
+    Alphabet alphabet = Alphabet::BYTES
+);
+void decode(std::istream& istr, std::ostream& ostr, bool verbose, unsigned threads = 0);
+
+// То же для буферов в памяти, без вывода статистики.
+//   compress использует алфавит байтов.
+//
+//   Данные кодируются восемью участками вперемешку (см. lanes.hpp), в
+//   регистрах AVX2, если процессор их поддерживает; результат такой же,
+//   как при кодировании подряд. SCALAR -- участки без AVX2, SERIAL --
+//   подряд (для сравнения в bench).
+enum class EncodeLoop { BEST, SCALAR, SERIAL };
+std::vector<uint8_t> compress(
+    const uint8_t* data,
+    uint64_t size,
+    EncodeLoop loop = EncodeLoop::BEST
+);
+//   expected_size -- ожидаемый размер результата, если известен.
+//
+//   Потоки с алфавитом байтов декодируются по таблице. Для каждого
+//   потока выбираются ширина таблицы (6-12 бит) и число участков,
+//   декодируемых одним потоком выполнения вперемешку (1, 2 или 4);
+//   для каждой пары скомпилирован свой цикл. GENERIC -- один общий
+//   цикл с шириной таблицы в переменной (для сравнения в bench).
+enum class DecodeLoop { SPECIALISED, GENERIC };
+std::vector<uint8_t> decompress(
+    const uint8_t* data,
+    uint64_t size,
+    unsigned threads = 0,
+    uint64_t expected_size = 0,
+    DecodeLoop loop = DecodeLoop::SPECIALISED
+);
+
+// decode с ограниченной памятью: сжатые и декодированные данные
+//   обрабатываются кусками по buffer_size байтов. Только для потоков
+//   в формате encode с алфавитом байтов, без параллельного декодирования;
+//   для потоков слов и 16-битных символов бросает std::runtime_error.
+void decode_streaming(
+    std::istream& istr,
+    std::ostream& ostr,
+    bool verbose,
+    uint64_t buffer_size
+);
+
+// Наибольший размер закодированных данных (без таблицы) для size байтов
+uint64_t max_encoded_size(uint64_t size);
+
+// Наибольший размер таблицы кодов (алфавит, символы и структура дерева)
+constexpr uint64_t MAX_TABLE_SIZE = 1 + 256 + 64;
+
+// 0 потоков означает "как в настройках autotune (см. tune.hpp), иначе
+//   по числу ядер"
+unsigned resolve_threads(unsigned threads);
+
+// Таблица кодов байтов, построенная заранее по образцу данных, для
+//   потоков без таблицы в заголовке: только коды и последний байт, как
+//   в encode. Кодирует любые байты: частоты образца увеличены на 1.
+//   Таблицы для декодирования строятся один раз; методы можно вызывать
+//   из нескольких потоков одновременно.
+class TrainedTable {
+public:
+    TrainedTable(const uint8_t* sample, uint64_t size);
+    ~TrainedTable();
+
+    std::vector<uint8_t> compress(const uint8_t* data, uint64_t size) const;
+
+    // Поток в формате encode (таблица образца в заголовке, decompress
+    //   декодирует его без TrainedTable) за один проход по данным.
+    //   Частоты сначала считаются по шестнадцатой части данных (кускам,
+    //   разбросанным по буферу); если по ним коды образца длиннее оценки
+    //   энтропии больше чем в 1 + DRIFT_TOLERANCE раз, статистика ушла
+    //   от образца: данные кодируются своей таблицей, как compress, и
+    //   *drifted = true.
+    static constexpr double DRIFT_TOLERANCE = 0.05;
+    std::vector<uint8_t> compress_stream(
+        const uint8_t* data,
+        uint64_t size,
+        bool* drifted = nullptr
+    ) const;
+
+    std::vector<uint8_t> decompress(
+        const uint8_t* data,
+        uint64_t size,
+        uint64_t expected_size = 0
+    ) const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// Частоты байтов буфера
+std::array<uint64_t, 256> byte_histogram(const uint8_t* data, uint64_t size);
@@ -0,0 +1,253 @@
+#include "lanes.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HUFFMAN_LANES_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+
+    constexpr uint64_t CODE_MASK = 0xffffffffu;
+
+    // Состояние участков между циклами: аккумулятор, число битов в нем
+    //    (меньше 32 между шагами) и индекс следующего 32-битного слова
+    struct LaneState {
+        uint64_t acc[LANES];
+        uint64_t bits[LANES];
+        uint64_t pos[LANES];
+    };
+
+
+    // Слова пишутся старшим байтом вперед
+    inline void put_word(uint8_t* out, uint64_t index, uint64_t word) {
+        uint32_t bytes = __builtin_bswap32(static_cast<uint32_t>(word));
+        std::memcpy(out + 4 * index, &bytes, 4);
+    }
+
+    inline void or_word(uint8_t* out, uint64_t index, uint64_t word) {
+        uint32_t bytes;
+        std::memcpy(&bytes, out + 4 * index, 4);
+        bytes |= __builtin_bswap32(static_cast<uint32_t>(word));
+        std::memcpy(out + 4 * index, &bytes, 4);
+    }
+
+
+    inline void encode_symbol(
+        const LaneTable& table,
+        uint8_t symbol,
+        uint64_t* acc,
+        uint64_t* bits,
+        uint64_t* pos,
+        uint8_t* out
+    ) {
+        uint64_t entry = table[symbol];
+        *acc = (*acc << (entry >> 32u)) | (entry & CODE_MASK);
+        *bits += entry >> 32u;
+        if (*bits >= 32) {
+            *bits -= 32;
+            put_word(out, (*pos)++, *acc >> *bits);
+        }
+    }
+
+
+    // Шаги from..to всех участков вперемешку; участок k начинается
+    //    в data + k * lane_size
+    void encode_scalar(
+        const uint8_t* data,
+        uint64_t lane_size,
+        uint64_t from,
+        uint64_t to,
+        const LaneTable& table,
+        LaneState* state,
+        uint8_t* out
+    ) {
+        uint64_t acc[LANES];
+        uint64_t bits[LANES];
+        uint64_t pos[LANES];
+        std::copy(state->acc, state->acc + LANES, acc);
+        std::copy(state->bits, state->bits + LANES, bits);
+        std::copy(state->pos, state->pos + LANES, pos);
+        for (uint64_t i = from; i < to; ++i) {
+            for (unsigned k = 0; k < LANES; ++k) {
+                encode_symbol(table, data[k * lane_size + i], &acc[k], &bits[k], &pos[k], out);
+            }
+        }
+        std::copy(acc, acc + LANES, state->acc);
+        std::copy(bits, bits + LANES, state->bits);
+        std::copy(pos, pos + LANES, state->pos);
+    }
+
+
+#ifdef HUFFMAN_LANES_AVX2
+
+    // Один шаг четырех участков: коды собираются из таблицы по индексам
+    //    symbols, слова участков, набравших 32 бита, пишутся на их места,
+    //    остальные -- в слово dump.
+    __attribute__((target("avx2")))
+    inline void step_avx2(
+        const LaneTable& table,
+        __m128i symbols,
+        __m256i* acc,
+        __m256i* bits,
+        __m256i* pos,
+        __m256i dump,
+        uint8_t* out
+    ) {
+        const __m256i code_mask = _mm256_set1_epi64x(CODE_MASK);
+        const __m256i word_bits = _mm256_set1_epi64x(32);
+        __m256i entry = _mm256_i32gather_epi64(
+            reinterpret_cast<const long long*>(table.data()), symbols, 8
+        );
+        __m256i length = _mm256_srli_epi64(entry, 32);
+        *acc = _mm256_or_si256(_mm256_sllv_epi64(*acc, length), _mm256_and_si256(entry, code_mask));
+        *bits = _mm256_add_epi64(*bits, length);
+
+        __m256i full = _mm256_cmpgt_epi64(*bits, _mm256_set1_epi64x(31));
+        // При bits < 32 сдвиг отрицателен, то есть больше 63, и слово -- 0
+        __m256i word = _mm256_srlv_epi64(*acc, _mm256_sub_epi64(*bits, word_bits));
+        *bits = _mm256_sub_epi64(*bits, _mm256_and_si256(full, word_bits));
+        __m256i where = _mm256_blendv_epi8(dump, *pos, full);
+        *pos = _mm256_sub_epi64(*pos, full);
+
+        alignas(32) uint64_t words[4];
+        alignas(32) uint64_t indices[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(words), word);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(indices), where);
+        for (unsigned k = 0; k < 4; ++k) {
+            put_word(out, indices[k], words[k]);
+        }
+    }
+
+
+    // Шаги 0..to (to кратно 4): байты восьми участков загружаются одним
+    //    gather по 4, участки 0-3 и 4-7 -- в двух половинах состояния.
+    //    Смещения участков должны помещаться в int32.
+    __attribute__((target("avx2")))
+    void encode_avx2(
+        const uint8_t* data,
+        uint64_t lane_size,
+        uint64_t to,
+        const LaneTable& table,
+        LaneState* state,
+        uint8_t* out,
+        uint64_t dump
+    ) {
+        __m256i acc_low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state->acc));
+        __m256i acc_high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state->acc + 4));
+        __m256i bits_low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state->bits));
+        __m256i bits_high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state->bits + 4));
+        __m256i pos_low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state->pos));
+        __m256i pos_high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state->pos + 4));
+        const __m256i dump_index = _mm256_set1_epi64x(static_cast<long long>(dump));
+        const __m256i byte_mask = _mm256_set1_epi32(0xff);
+
+        auto step = static_cast<int>(lane_size);
+        __m256i offsets = _mm256_setr_epi32(0, step, 2 * step, 3 * step, 4 * step, 5 * step, 6 * step, 7 * step);
+        for (uint64_t i = 0; i < to; i += 4) {
+            __m256i bytes = _mm256_i32gather_epi32(reinterpret_cast<const int*>(data + i), offsets, 1);
+            for (unsigned s = 0; s < 4; ++s) {
+                __m256i symbols = _mm256_and_si256(bytes, byte_mask);
+                bytes = _mm256_srli_epi32(bytes, 8);
+                step_avx2(table, _mm256_castsi256_si128(symbols), &acc_low, &bits_low, &pos_low, dump_index, out);
+                step_avx2(table, _mm256_extracti128_si256(symbols, 1), &acc_high, &bits_high, &pos_high, dump_index, out);
+            }
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(state->acc), acc_low);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(state->acc + 4), acc_high);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(state->bits), bits_low);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(state->bits + 4), bits_high);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(state->pos), pos_low);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(state->pos + 4), pos_high);
+    }
+
+#endif
+
+
+    uint64_t count_bits(const uint8_t* data, uint64_t size, const LaneTable& table) {
+        uint64_t bits[4] = {0, 0, 0, 0};
+        uint64_t i = 0;
+        for (; i + 4 <= size; i += 4) {
+            for (unsigned k = 0; k < 4; ++k) {
+                bits[k] += table[data[i + k]] >> 32u;
+            }
+        }
+        for (; i < size; ++i) {
+            bits[0] += table[data[i]] >> 32u;
+        }
+        return bits[0] + bits[1] + bits[2] + bits[3];
+    }
+
+} // \LANES
+
+
+bool has_avx2() {
+#ifdef HUFFMAN_LANES_AVX2
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+
+uint64_t encode_lanes(
+    const uint8_t* data,
+    uint64_t size,
+    const LaneTable& table,
+    std::vector<uint8_t>* encoded,
+    bool avx2
+) {
+    // Участки 0..LANES-2 длины lane_size, последний -- с остатком
+    uint64_t lane_size = size / LANES;
+    uint64_t lane_bits[LANES];
+    uint64_t total_bits = 0;
+    for (unsigned k = 0; k < LANES; ++k) {
+        uint64_t end = k + 1 < LANES ? (k + 1) * lane_size : size;
+        lane_bits[k] = count_bits(data + k * lane_size, end - k * lane_size, table);
+        total_bits += lane_bits[k];
+    }
+
+    // Участок k начинает с нулевых битов до своей позиции в слове: его
+    //    первое слово совпадает с последним неполным словом участка k - 1,
+    //    которое добавляется через OR в конце. Лишнее слово -- для
+    //    записей AVX2 участков, не набравших слово.
+    uint64_t words = (total_bits + 31) / 32;
+    uint64_t base = encoded->size();
+    encoded->resize(base + 4 * (words + 1));
+    uint8_t* out = encoded->data() + base;
+
+    LaneState state{};
+    uint64_t start = 0;
+    for (unsigned k = 0; k < LANES; ++k) {
+        state.pos[k] = start / 32;
+        state.bits[k] = start % 32;
+        start += lane_bits[k];
+    }
+
+    uint64_t done = 0;
+#ifdef HUFFMAN_LANES_AVX2
+    if (avx2 && size < (1ull << 31u)) {
+        done = lane_size / 4 * 4;
+        encode_avx2(data, lane_size, done, table, &state, out, words);
+    }
+#else
+    (void)avx2;
+#endif
+    encode_scalar(data, lane_size, done, lane_size, table, &state, out);
+    const unsigned last = LANES - 1;
+    for (uint64_t i = LANES * lane_size; i < size; ++i) {
+        encode_symbol(table, data[i], &state.acc[last], &state.bits[last], &state.pos[last], out);
+    }
+
+    for (unsigned k = 0; k < LANES; ++k) {
+        if (state.bits[k] > 0) {
+            or_word(out, state.pos[k], state.acc[k] << (32 - state.bits[k]));
+        }
+    }
+    encoded->resize(base + (total_bits + 7) / 8);
+    return total_bits;
+}
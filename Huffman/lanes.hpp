@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+// Кодирование участками. Входные данные делятся на LANES участков,
+//   каждый кодируется своим 64-битным аккумулятором, все аккумуляторы --
+//   вперемешку: в скалярном цикле или в регистрах AVX2 (по 4 участка в
+//   регистре, коды собираются из таблицы командой gather). Начальная
+//   позиция каждого участка в потоке битов известна заранее (после
+//   подсчета длин), поэтому участки пишут 32-битные слова прямо на свои
+//   места, и результат совпадает с последовательным кодированием.
+
+constexpr unsigned LANES = 8;
+
+// Коды длиннее 32 бит в таблицу не помещаются
+constexpr unsigned MAX_LANE_CODE_LENGTH = 32;
+
+// Элемент таблицы: код, выровненный вправо, в младших 32 битах,
+//   длина кода -- в старших.
+using LaneTable = std::array<uint64_t, 256>;
+
+// Поддерживает ли процессор AVX2 (проверяется один раз)
+bool has_avx2();
+
+// Дописывает в encoded коды size байтов data, начиная со старших битов,
+//   и возвращает число записанных битов; последний байт дополнен нулями.
+//   avx2 можно передавать, только если has_avx2().
+uint64_t encode_lanes(
+    const uint8_t* data,
+    uint64_t size,
+    const LaneTable& table,
+    std::vector<uint8_t>* encoded,
+    bool avx2
+);
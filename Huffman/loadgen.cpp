@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "daemon.hpp"
+
+using namespace std;
+
+// Нагрузка на сервер huffman --daemon:
+//    ./loadgen SOCKET [-n REQUESTS] [-c CONNECTIONS] [-s SIZE] [-o OP] [-r] [FILE]
+// Запросы размером SIZE байтов берутся из FILE по кругу и отправляются
+// по CONNECTIONS соединениям, каждое -- в своем потоке, запрос за запросом.
+// OP -- c, d, C или D (см. daemon.hpp); для d и D данные сначала сжимаются
+// тем же сервером, а ответы сверяются с исходными. С -r куски FILE
+// отправляются как есть (испорченные данные), и на каждый запрос сервер
+// должен ответить ошибкой, не закрывая соединение. Печатаются число
+// запросов в секунду и 50-й и 99-й процентили задержки.
+
+namespace {
+
+    struct Options {
+        string socket;
+        string file = "smoke_test/pg16527.in";
+        uint64_t requests = 10000;
+        unsigned connections = 4;
+        uint64_t size = 4096;
+        char op = 'c';
+        bool rejected = false; // -r
+    };
+
+    bool parse_args(int argc, char** argv, Options* options) {
+        for (int i = 1; i < argc; ++i) {
+            const string arg = argv[i];
+            bool has_value = i + 1 < argc;
+            if (arg == "-n" && has_value) {
+                options->requests = strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "-c" && has_value) {
+                options->connections = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+            } else if (arg == "-s" && has_value) {
+                options->size = strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "-o" && has_value && string("cdCD").find(argv[i + 1][0]) != string::npos) {
+                options->op = argv[++i][0];
+            } else if (arg == "-r") {
+                options->rejected = true;
+            } else if (options->socket.empty()) {
+                options->socket = arg;
+            } else {
+                options->file = arg;
+            }
+        }
+        return !options->socket.empty() && options->requests > 0
+            && options->connections > 0 && options->size > 0;
+    }
+
+    double percentile(const vector<double>& sorted, double p) {
+        auto index = static_cast<size_t>(p * (sorted.size() - 1));
+        return sorted[index];
+    }
+
+} // \LOADGEN
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_args(argc, argv, &options)) {
+        cout << "Usage:\n    " << argv[0]
+             << " SOCKET [-n REQUESTS] [-c CONNECTIONS] [-s SIZE] [-o c|d|C|D] [-r] [FILE]\n";
+        return 1;
+    }
+
+    ifstream fin(options.file, ios::binary);
+    vector<uint8_t> data{istreambuf_iterator<char>(fin), istreambuf_iterator<char>()};
+    if (data.empty()) {
+        cerr << argv[0] << ": no data in " << options.file << '\n';
+        return 1;
+    }
+
+    // Полезные данные запросов: куски файла по кругу
+    vector<vector<uint8_t>> payloads;
+    for (uint64_t offset = 0; offset < data.size(); offset += options.size) {
+        auto end = data.begin() + min<uint64_t>(data.size(), offset + options.size);
+        payloads.emplace_back(data.begin() + offset, end);
+    }
+
+    bool decode = !options.rejected && (options.op == 'd' || options.op == 'D');
+    vector<vector<uint8_t>> requests = payloads;
+    try {
+        if (decode) {
+            DaemonClient client(options.socket);
+            auto compress_op = options.op == 'd' ? DaemonOp::COMPRESS : DaemonOp::COMPRESS_TRAINED;
+            for (auto& request : requests) {
+                request = client.request(compress_op, request.data(), request.size());
+            }
+        }
+    } catch (const runtime_error& e) {
+        cerr << argv[0] << ": " << e.what() << '\n';
+        return 1;
+    }
+
+    vector<vector<double>> latencies(options.connections);
+    vector<uint64_t> mismatches(options.connections);
+    vector<uint64_t> bytes(options.connections);
+    vector<string> errors(options.connections);
+    auto connection = [&](unsigned id) {
+        try {
+            DaemonClient client(options.socket);
+            for (uint64_t i = id; i < options.requests; i += options.connections) {
+                size_t k = i % requests.size();
+                auto start = chrono::steady_clock::now();
+                vector<uint8_t> response;
+                try {
+                    response = client.request(
+                        static_cast<DaemonOp>(options.op), requests[k].data(), requests[k].size()
+                    );
+                    if (options.rejected) {
+                        ++mismatches[id];
+                    }
+                } catch (const daemon_error& e) {
+                    // Ответ-ошибка ожидается только с -r; оборванное
+                    //   соединение -- всегда ошибка
+                    if (!options.rejected || string(e.what()) == "connection closed by server") {
+                        throw;
+                    }
+                }
+                chrono::duration<double, micro> latency = chrono::steady_clock::now() - start;
+                latencies[id].push_back(latency.count());
+                bytes[id] += payloads[k].size();
+                if (decode && response != payloads[k]) {
+                    ++mismatches[id];
+                }
+            }
+        } catch (const runtime_error& e) {
+            errors[id] = e.what();
+        }
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (unsigned id = 0; id < options.connections; ++id) {
+        threads.emplace_back(connection, id);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    for (const auto& error : errors) {
+        if (!error.empty()) {
+            cerr << argv[0] << ": " << error << '\n';
+            return 1;
+        }
+    }
+
+    vector<double> all;
+    uint64_t mismatched = 0;
+    uint64_t total_bytes = 0;
+    for (unsigned id = 0; id < options.connections; ++id) {
+        all.insert(all.end(), latencies[id].begin(), latencies[id].end());
+        mismatched += mismatches[id];
+        total_bytes += bytes[id];
+    }
+    sort(all.begin(), all.end());
+
+    cout << "op " << options.op << ", " << all.size() << " requests of " << options.size
+         << " bytes, " << options.connections << " connections\n";
+    cout << "  " << all.size() / elapsed.count() << " req/s, "
+         << total_bytes / elapsed.count() / (1 << 20) << " MiB/s\n";
+    cout << "  latency p50 " << percentile(all, 0.5) << " us, p99 "
+         << percentile(all, 0.99) << " us\n";
+    if (mismatched > 0) {
+        cout << "  MISMATCH in " << mismatched << " responses\n";
+        return 1;
+    }
+    return 0;
+}
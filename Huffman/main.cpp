@@ -1,13 +1,41 @@
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iterator>
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 #include <fstream>
 
 #include "huffman.hpp"
+#include "archive.hpp"
+#include "search.hpp"
+#include "perf.hpp"
+#include "store.hpp"
+#include "stream.hpp"
+#include "daemon.hpp"
+#include "deflate.hpp"
+#include "tune.hpp"
 
 using namespace std;
 
 const string USAGE{
     "Usage:\n"
-    "    ./huffman [-v] OPTION SOURCE DEST\n"
+    "    ./huffman [-v] [-w|-W] [-t THREADS] [--perf] [--max-memory SIZE] [--filter FILTER]\n"
+    "              [--sample SIZE] OPTION SOURCE DEST\n"
+    "    ./huffman [-t THREADS] [--max-memory SIZE] --gzip MODE -c SOURCE DEST\n"
+    "    ./huffman [-t THREADS] [--max-memory SIZE] [--filter FILTER] -a SOURCE DEST\n"
+    "    ./huffman [--filter FILTER] -A ARCHIVE FILE...\n"
+    "    ./huffman [-v] -l ARCHIVE|STORE\n"
+    "    ./huffman [-t THREADS] -x ARCHIVE DIR [MEMBER...]\n"
+    "    ./huffman [-v] [-t THREADS] -s PATTERN FILE\n"
+    "    ./huffman [-t THREADS] --daemon SOCKET [SAMPLE]\n"
+    "    ./huffman --autotune SAMPLE [CONFIG]\n"
+    "    ./huffman [-v] [-t THREADS] [--filter FILTER] --store STORE FILE...\n"
+    "    ./huffman --restore STORE NAME DEST\n"
     "\n"
     "DESCRIPTION\n"
     "    Encodes and decodes a file using the Huffman algorithm.\n"
@@ -17,36 +45,407 @@ const string USAGE{
     "        encode SOURCE and save to DEST\n"
     "    -d\n"
     "        decode SOURCE and save to DEST\n"
+    "    -a\n"
+    "        append SOURCE to block stream DEST (created if missing), writing\n"
+    "        only the new blocks and the directory\n"
     "    -v\n"
     "        display the encoding table\n"
+    "    -w\n"
+    "        encode words and separators as symbols (for text)\n"
+    "    -W\n"
+    "        encode 16-bit little-endian symbols (for UTF-16 text and 16-bit\n"
+    "        samples)\n"
+    "    -t THREADS\n"
+    "        number of threads (default: from --autotune, else number of cores);\n"
+    "        block streams use them for encoding too\n"
+    "    --max-memory SIZE\n"
+    "        keep buffers under SIZE bytes (suffixes K, M, G): -c writes a block\n"
+    "        stream with block size, threads and queue depth fitted to SIZE,\n"
+    "        -d decodes in bounded chunks; peak memory is printed to stderr\n"
+    "    --filter FILTER\n"
+    "        transform blocks before encoding (-c then writes a block stream):\n"
+    "        deltaN (difference of N-byte words), xorN (xor with the previous\n"
+    "        N-byte word), N = 1, 2, 4, 8, or splitN (byte planes of N-byte\n"
+    "        records), N = 2, 4, 8; auto chooses a filter or a coder (plain,\n"
+    "        words or none) for every block by sampling it and prints the\n"
+    "        choices to stderr (with -v, also the sampled features)\n"
+    "    --sample SIZE\n"
+    "        -c and -a build one code table from SIZE bytes (suffixes K, M, G)\n"
+    "        sampled across SOURCE, or from its first SIZE bytes if SOURCE is\n"
+    "        a pipe, and encode a block stream in one pass over the data; blocks\n"
+    "        whose statistics drift from the sample get their own table\n"
+    "    --gzip MODE\n"
+    "        -c writes a gzip file (readable by gzip -d) compressed in parallel\n"
+    "        chunks: MODE huffman codes bytes only, lz also finds matches\n"
+    "    --perf\n"
+    "        print time and hardware counters per input byte to stderr\n"
+    "    -A\n"
+    "        create ARCHIVE from FILEs, each compressed in independent blocks\n"
+    "    -l\n"
+    "        list members of ARCHIVE or files of STORE; with -v, also their\n"
+    "        blocks or chunks\n"
+    "    -x\n"
+    "        extract MEMBERs (all by default) of ARCHIVE to DIR\n"
+    "    -s\n"
+    "        print offsets of PATTERN in compressed FILE or ARCHIVE members,\n"
+    "        decoding only the blocks that may contain it\n"
+    "    --daemon\n"
+    "        serve compress/decompress requests on Unix socket SOCKET with\n"
+    "        THREADS warm workers; with SAMPLE, also with a table trained on\n"
+    "        SAMPLE (see daemon.hpp for the protocol and loadgen for a client)\n"
+    "    --autotune\n"
+    "        measure block streams of a sample of file SAMPLE with different\n"
+    "        block sizes, thread counts and interleaved decoding streams, and\n"
+    "        write the fastest settings to CONFIG (default: $HUFFMAN_CONFIG or\n"
+    "        ~/.huffman.conf), which later runs use by default\n"
+    "    --store\n"
+    "        add FILEs to deduplicating store STORE (a directory, created if\n"
+    "        missing): files are cut into content-defined chunks and only\n"
+    "        chunks not yet in STORE are compressed and written\n"
+    "    --restore\n"
+    "        write file NAME of STORE to DEST\n"
 };
 
+namespace {
+
+    // Команды и допустимое число аргументов-файлов
+    const map<string, pair<size_t, size_t>> COMMANDS{
+        {"-c", {2, 2}},
+        {"-d", {2, 2}},
+        {"-a", {2, 2}},
+        {"-A", {2, SIZE_MAX}},
+        {"-l", {1, 1}},
+        {"-x", {2, SIZE_MAX}},
+        {"-s", {2, 2}},
+        {"--daemon", {1, 2}},
+        {"--autotune", {1, 2}},
+        {"--store", {2, SIZE_MAX}},
+        {"--restore", {3, 3}},
+    };
+
+    bool parse_number(const char* str, unsigned* value) {
+        char* end = nullptr;
+        unsigned long parsed = strtoul(str, &end, 10);
+        if (end == str || *end != '\0') {
+            return false;
+        }
+        *value = static_cast<unsigned>(parsed);
+        return true;
+    }
+
+    // Размер с необязательным суффиксом K, M или G
+    bool parse_size(const char* str, uint64_t* value) {
+        char* end = nullptr;
+        unsigned long long parsed = strtoull(str, &end, 10);
+        if (end == str) {
+            return false;
+        }
+        const string suffix = end;
+        unsigned shift = 0;
+        if (suffix == "K" || suffix == "k") {
+            shift = 10;
+        } else if (suffix == "M" || suffix == "m") {
+            shift = 20;
+        } else if (suffix == "G" || suffix == "g") {
+            shift = 30;
+        } else if (!suffix.empty()) {
+            return false;
+        }
+        *value = static_cast<uint64_t>(parsed) << shift;
+        return *value > 0;
+    }
+
+    // Число блоков по выбранным способам и время выбора; с verbose --
+    //    признаки каждого блока
+    void print_sniffs(ostream& out, const vector<SniffReport>& sniffs, bool verbose) {
+        map<string, uint64_t> plans;
+        chrono::nanoseconds time{0};
+        for (size_t i = 0; i < sniffs.size(); ++i) {
+            const auto& sniff = sniffs[i];
+            ++plans[plan_name(sniff.plan)];
+            time += sniff.time;
+            if (verbose) {
+                out << "block " << i << ": text " << sniff.text << ", order0 " << sniff.order0
+                    << ", order1 " << sniff.order1 << ", repeats " << sniff.repeats
+                    << ", filtered " << sniff.filtered << ", words " << sniff.words
+                    << " -> " << plan_name(sniff.plan) << '\n';
+            }
+        }
+        out << "plans:";
+        for (const auto& [name, blocks] : plans) {
+            out << ' ' << name << ' ' << blocks << (name == plans.rbegin()->first ? ";" : ",");
+        }
+        out << " sampling " << chrono::duration<double, milli>(time).count() << " ms\n";
+    }
+
+    // Наибольший размер резидентной памяти процесса
+    uint64_t peak_rss() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+    }
+
+} // \MAIN
+
 int main(int argc, char** argv) {
-    if (argc < 4 || argc > 5) {
-        cout << USAGE;
-        return 1;
+    bool verbose = false;
+    bool perf = false;
+    Alphabet alphabet = Alphabet::BYTES;
+    unsigned threads = 0;
+    uint64_t max_memory = 0;
+    uint64_t sample_size = 0;
+    string filter_arg = "none";
+    string gzip_arg;
+    string command;
+    vector<string> files;
+
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "-v") {
+            verbose = true;
+        } else if (arg == "--perf") {
+            perf = true;
+        } else if (arg == "-w") {
+            alphabet = Alphabet::WORDS;
+        } else if (arg == "-W") {
+            alphabet = Alphabet::WIDE;
+        } else if (arg == "-t") {
+            if (++i == argc || !parse_number(argv[i], &threads)) {
+                cout << USAGE;
+                return 1;
+            }
+        } else if (arg == "--max-memory") {
+            if (++i == argc || !parse_size(argv[i], &max_memory)) {
+                cout << USAGE;
+                return 1;
+            }
+        } else if (arg == "--sample") {
+            if (++i == argc || !parse_size(argv[i], &sample_size)) {
+                cout << USAGE;
+                return 1;
+            }
+        } else if (arg == "--filter") {
+            if (++i == argc) {
+                cout << USAGE;
+                return 1;
+            }
+            filter_arg = argv[i];
+        } else if (arg == "--gzip") {
+            if (++i == argc || (string(argv[i]) != "huffman" && string(argv[i]) != "lz")) {
+                cout << USAGE;
+                return 1;
+            }
+            gzip_arg = argv[i];
+        } else if (COMMANDS.count(arg) && command.empty()) {
+            command = arg;
+        } else {
+            files.push_back(arg);
+        }
     }
-    const bool verbose = string(argv[1]) == "-v";
 
-    if (argc != (verbose ? 5 : 4)) {
+    if (command.empty()
+        || files.size() < COMMANDS.at(command).first
+        || files.size() > COMMANDS.at(command).second) {
         cout << USAGE;
         return 1;
     }
 
-    const int n_cmd = verbose ? 2 : 1;
-    const int n_arg1 = verbose ? 3 : 2;
-    const int n_arg2 = verbose ? 4 : 3;
-
-    if (string(argv[n_cmd]) == "-c") {
-        std::ifstream fin(argv[n_arg1], std::ios::binary);
-        std::ofstream fout(argv[n_arg2], std::ios_base::binary);
-        encode(fin, fout, verbose);
-    } else if (string(argv[n_cmd]) == "-d") {
-        std::ifstream fin(argv[n_arg1], std::ios::binary);
-        std::ofstream fout(argv[n_arg2], std::ios_base::binary);
-        decode(fin, fout, verbose);
-    } else {
-        cout << USAGE;
+    try {
+        BlockOptions coding;
+        if (filter_arg == "auto") {
+            coding.automatic = true;
+        } else {
+            coding.plan.filter = parse_filter(filter_arg);
+        }
+        if (command == "-c" || command == "-d" || command == "-a") {
+            // Счетчики открываются, только если их просили
+            std::unique_ptr<PerfCounters> counters;
+            if (perf) {
+                counters = std::make_unique<PerfCounters>();
+                counters->start();
+            }
+            StreamStats stats;
+            bool blocks = false;
+            {
+                std::ifstream fin(files[0], std::ios::binary);
+                std::ofstream fout;
+                if (command != "-a") {
+                    fout.open(files[1], std::ios_base::binary);
+                }
+                std::error_code error;
+                auto input_size = filesystem::file_size(files[0], error);
+                if (error) {
+                    input_size = 0;
+                }
+                bool block_stream = max_memory > 0 || sample_size > 0 || coding.automatic
+                    || coding.plan.filter.kind != FilterKind::NONE;
+                if (command == "-c" && !gzip_arg.empty()) {
+                    if (alphabet != Alphabet::BYTES || filter_arg != "none" || sample_size > 0) {
+                        throw runtime_error("--gzip can not be combined with -w, -W, --filter or --sample");
+                    }
+                    auto limits = fit_memory(
+                        max_memory, input_size, threads, gzip_arg == "lz" ? DEFLATE_WINDOW : 0
+                    );
+                    encode_gzip(fin, fout, limits, gzip_arg == "lz", &stats);
+                    blocks = true;
+                    cout << stats.raw_size << '\n' << stats.compressed_size << '\n'
+                         << stats.overhead << '\n';
+                } else if (command == "-a" || (command == "-c" && block_stream)) {
+                    if (alphabet != Alphabet::BYTES) {
+                        throw runtime_error("-w and -W can not be combined with block streams");
+                    }
+                    auto limits = fit_memory(max_memory, input_size, threads, 0, sample_size, coding);
+                    auto dest_size = filesystem::file_size(files[1], error);
+                    if (command == "-a" && !error && dest_size > 0) {
+                        std::fstream dest(files[1], std::ios::in | std::ios::out | std::ios::binary);
+                        append_blocks(dest, fin, limits, &stats);
+                    } else {
+                        if (!fout.is_open()) {
+                            fout.open(files[1], std::ios_base::binary);
+                        }
+                        encode_blocks(fin, fout, limits, &stats);
+                    }
+                    blocks = true;
+                    cout << stats.raw_size << '\n' << stats.compressed_size << '\n'
+                         << stats.overhead << '\n';
+                } else if (command == "-c") {
+                    encode(fin, fout, verbose, alphabet);
+                } else if (is_archive(fin)) {
+                    decode_blocks(fin, fout, {max_memory, 0, threads, 0, {}}, &stats);
+                    blocks = true;
+                    std::error_code error;
+                    auto size = filesystem::file_size(files[0], error);
+                    cout << stats.compressed_size << '\n' << stats.raw_size << '\n'
+                         << (error ? 0 : size - stats.compressed_size) << '\n';
+                } else if (max_memory > 0) {
+                    // Входной и выходной буферы -- по четверти бюджета
+                    constexpr uint64_t min_buffer_size = 4 * 1024;
+                    if (max_memory / 4 < min_buffer_size) {
+                        throw runtime_error(
+                            "memory limit too small: need at least " + to_string(4 * min_buffer_size) + " bytes"
+                        );
+                    }
+                    auto buffer_size = std::min<uint64_t>(max_memory / 4, 1 << 20);
+                    decode_streaming(fin, fout, verbose, buffer_size);
+                    stats.peak_memory = 2 * buffer_size + MAX_TABLE_SIZE;
+                } else {
+                    decode(fin, fout, verbose, threads);
+                }
+            }
+            PerfSample sample;
+            if (counters) {
+                sample = counters->stop();
+            }
+            if (!stats.sniffs.empty()) {
+                print_sniffs(cerr, stats.sniffs, verbose);
+            }
+            if (sample_size > 0 && command != "-d") {
+                cerr << "sample: " << stats.drifted << " of " << stats.blocks
+                     << " blocks drifted to their own table\n";
+            }
+            if (max_memory > 0) {
+                cerr << "memory: peak " << stats.peak_memory << " of " << max_memory << " bytes";
+                if (blocks) {
+                    if (stats.limits.block_size > 0) {
+                        cerr << ", block " << stats.limits.block_size;
+                    }
+                    cerr << ", threads " << stats.limits.threads
+                         << ", queue " << stats.limits.queue_depth;
+                }
+                cerr << "; process peak rss " << peak_rss() << " bytes\n";
+            }
+            if (perf) {
+                // Счетчики относятся к байтам несжатых данных
+                const auto& raw_file = command == "-d" ? files[1] : files[0];
+                std::error_code error;
+                auto raw_size = filesystem::file_size(raw_file, error);
+                print_perf(cerr, command == "-d" ? "decode" : "encode", sample, error ? 0 : raw_size);
+            }
+        } else if (command == "-A") {
+            std::ofstream fout(files[0], std::ios_base::binary);
+            create_archive(
+                fout, vector<string>(files.begin() + 1, files.end()), default_block_size(), true, coding
+            );
+        } else if (command == "-l" && filesystem::is_directory(files[0])) {
+            for (const auto& file : list_store(files[0])) {
+                cout << file.raw_size << ' ' << file.chunks.size() << ' ' << file.name << '\n';
+                if (verbose) {
+                    for (const auto& digest : file.chunks) {
+                        cout << "    " << to_hex(digest) << '\n';
+                    }
+                }
+            }
+        } else if (command == "-l") {
+            std::ifstream fin(files[0], std::ios::binary);
+            for (const auto& member : list_archive(fin)) {
+                uint64_t size = 0;
+                for (const auto& block : member.blocks) {
+                    size += block.size;
+                }
+                cout << member.raw_size << ' ' << size << ' ' << member.name << '\n';
+                if (verbose) {
+                    for (const auto& block : member.blocks) {
+                        cout << "    " << block.offset << ' ' << block.raw_size << ' '
+                             << block.size << ' ' << plan_name(block.plan) << '\n';
+                    }
+                }
+            }
+        } else if (command == "-s") {
+            std::ifstream fin(files[1], std::ios::binary);
+            SearchStats stats;
+            for (const auto& match : search(fin, files[0], threads, &stats)) {
+                if (!match.member.empty()) {
+                    cout << match.member << ':';
+                }
+                cout << match.offset << '\n';
+            }
+            if (verbose) {
+                cout << stats.decoded_blocks << " of " << stats.blocks << " blocks decoded\n";
+            }
+        } else if (command == "--daemon") {
+            std::unique_ptr<TrainedTable> trained;
+            if (files.size() > 1) {
+                std::ifstream fin(files[1], std::ios::binary);
+                vector<uint8_t> sample{istreambuf_iterator<char>(fin), istreambuf_iterator<char>()};
+                trained = std::make_unique<TrainedTable>(sample.data(), sample.size());
+            }
+            run_daemon(files[0], threads, trained.get());
+        } else if (command == "--store") {
+            StoreStats stats;
+            store_files(files[0], vector<string>(files.begin() + 1, files.end()), coding, threads, &stats);
+            cout << stats.raw_size << '\n' << stats.new_raw_size << '\n' << stats.new_size << '\n';
+            if (verbose) {
+                cout << stats.new_chunks << " of " << stats.chunks << " chunks new\n";
+            }
+        } else if (command == "--restore") {
+            std::ofstream fout(files[2], std::ios::binary);
+            restore_file(files[0], files[1], fout);
+        } else if (command == "--autotune") {
+            std::ifstream fin(files[0], std::ios::binary);
+            if (!fin) {
+                throw runtime_error("can not open " + files[0]);
+            }
+            auto sample = read_sample(fin, DEFAULT_SAMPLE_SIZE);
+            auto config = autotune(sample.data(), sample.size(), cout);
+            const string path = files.size() > 1 ? files[1] : config_path();
+            if (path.empty()) {
+                throw runtime_error("no config file: set HUFFMAN_CONFIG or HOME");
+            }
+            std::ofstream fout(path);
+            write_config(fout, config);
+            if (!fout) {
+                throw runtime_error("can not write " + path);
+            }
+            cout << "block " << config.block_size << ", threads " << config.threads
+                 << ", streams " << config.streams << " written to " << path << '\n';
+        } else {
+            extract_archive(
+                files[0], files[1], vector<string>(files.begin() + 2, files.end()), threads
+            );
+        }
+    } catch (const exception& e) {
+        // В том числе filesystem_error при распаковке и ошибки выделения памяти
+        cerr << argv[0] << ": " << e.what() << '\n';
         return 1;
     }
 
@@ -0,0 +1,137 @@
+#include "perf.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+    const char* const EVENT_NAMES[PERF_EVENT_COUNT] = {
+        "cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses"
+    };
+
+#ifdef __linux__
+    int open_event(PerfEvent event) {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        switch (event) {
+        case PERF_CYCLES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PERF_INSTRUCTIONS:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case PERF_BRANCH_MISSES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        case PERF_L1D_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8u)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16u);
+            break;
+        default:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        }
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+    }
+#endif
+
+} // \PERF
+
+
+PerfCounters::PerfCounters() {
+    fds_.fill(-1);
+#ifdef __linux__
+    for (int event = 0; event < PERF_EVENT_COUNT; ++event) {
+        fds_[event] = open_event(static_cast<PerfEvent>(event));
+    }
+#endif
+}
+
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+    for (int fd : fds_) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+#endif
+}
+
+
+void PerfCounters::start() {
+#ifdef __linux__
+    for (int fd : fds_) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+    start_ = std::chrono::steady_clock::now();
+}
+
+
+PerfSample PerfCounters::stop() {
+    PerfSample sample; // NRVO
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+    sample.seconds = elapsed.count();
+#ifdef __linux__
+    for (int event = 0; event < PERF_EVENT_COUNT; ++event) {
+        int fd = fds_[event];
+        if (fd < 0) {
+            continue;
+        }
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        // Значение, время включения и время работы счетчика. Если
+        //    счетчиков больше, чем регистров, значение масштабируется.
+        uint64_t values[3];
+        if (read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+            continue;
+        }
+        sample.available[event] = true;
+        sample.counts[event] = static_cast<uint64_t>(
+            static_cast<double>(values[0]) * values[1] / values[2]
+        );
+    }
+#endif
+    return sample;
+}
+
+
+void print_perf(std::ostream& out, const std::string& phase, const PerfSample& sample, uint64_t bytes) {
+    out << phase << ": " << sample.seconds * 1000 << " ms";
+    if (bytes == 0) {
+        out << '\n';
+        return;
+    }
+    out << ", " << bytes / sample.seconds / (1 << 20) << " MiB/s";
+    for (int event = 0; event < PERF_EVENT_COUNT; ++event) {
+        if (sample.available[event]) {
+            out << ", " << static_cast<double>(sample.counts[event]) / bytes
+                << ' ' << EVENT_NAMES[event] << "/B";
+        }
+    }
+    if (sample.available[PERF_CYCLES] && sample.available[PERF_INSTRUCTIONS]
+        && sample.counts[PERF_CYCLES] > 0) {
+        out << ", IPC " << static_cast<double>(sample.counts[PERF_INSTRUCTIONS])
+            / sample.counts[PERF_CYCLES];
+    }
+    out << '\n';
+}
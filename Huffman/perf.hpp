@@ -0,0 +1,46 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <cstdint>
+
+// Аппаратные счетчики производительности (perf_event_open в Linux).
+//   Если счетчики недоступны (другая ОС, нет прав, виртуальная машина),
+//   измеряется только время.
+
+enum PerfEvent {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_EVENT_COUNT
+};
+
+struct PerfSample {
+    double seconds = 0;
+    std::array<bool, PERF_EVENT_COUNT> available{};
+    std::array<uint64_t, PERF_EVENT_COUNT> counts{};
+};
+
+class PerfCounters {
+public:
+    // Счетчики учитывают и потоки, созданные после конструирования
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    void start();
+    PerfSample stop();
+
+private:
+    std::array<int, PERF_EVENT_COUNT> fds_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Печатает время и значения счетчиков в пересчете на байт
+void print_perf(std::ostream& out, const std::string& phase, const PerfSample& sample, uint64_t bytes);
@@ -0,0 +1,224 @@
+#include "search.hpp"
+#include "archive.hpp"
+#include "huffman.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+
+namespace {
+
+    constexpr int BLOOM_HASHES = 3;
+    constexpr uint64_t BLOOM_BITS_PER_TRIGRAM = 8;
+    constexpr uint64_t MIN_SUMMARY_BITS = 64;
+    // Сводка занимает не больше 1/16 блока, иначе она не строится
+    constexpr uint64_t MAX_SUMMARY_RATIO = 16;
+    constexpr size_t TRIGRAM_COUNT = 1u << 24u;
+
+
+    uint32_t trigram_at(const uint8_t* data) {
+        return data[0] | (data[1] << 8u) | (data[2] << 16u);
+    }
+
+
+    // Вызывает f для каждого бита триграммы в фильтре из (mask + 1) битов
+    template <class F>
+    void for_each_bloom_bit(uint32_t trigram, uint64_t mask, F&& f) {
+        // Финализатор splitmix64
+        uint64_t h = trigram + 0x9E3779B97F4A7C15ull;
+        h = (h ^ (h >> 30u)) * 0xBF58476D1CE4E5B9ull;
+        h = (h ^ (h >> 27u)) * 0x94D049BB133111EBull;
+        h ^= h >> 31u;
+
+        uint64_t step = (h >> 32u) | 1u;
+        for (int i = 0; i < BLOOM_HASHES; ++i) {
+            f((h + i * step) & mask);
+        }
+    }
+
+
+    bool may_contain(const std::vector<uint8_t>& summary, uint32_t trigram) {
+        if (summary.empty()) {
+            return true;
+        }
+        bool found = true;
+        for_each_bloom_bit(trigram, summary.size() * 8 - 1, [&](uint64_t bit) {
+            found = found && (summary[bit >> 3u] & (1u << (bit & 7u)));
+        });
+        return found;
+    }
+
+
+    class Matcher {
+    public:
+        Matcher(const std::string& pattern, std::vector<SearchMatch>* matches)
+            : pattern_(pattern.begin(), pattern.end())
+            , searcher_(pattern_.begin(), pattern_.end())
+            , matches_(matches)
+        {}
+
+        // Ищет образец в окне из хвоста предыдущего блока и нового блока.
+        //    start -- смещение блока в исходном файле.
+        void feed(const std::string& member, const std::vector<uint8_t>& block, uint64_t start) {
+            uint64_t window_start = start - window_.size();
+            window_.insert(window_.end(), block.begin(), block.end());
+
+            auto it = std::search(window_.begin(), window_.end(), searcher_);
+            while (it != window_.end()) {
+                matches_->push_back({member, window_start + (it - window_.begin())});
+                it = std::search(it + 1, window_.end(), searcher_);
+            }
+
+            // Хвост короче образца, поэтому совпадения не повторяются
+            size_t tail = std::min(window_.size(), pattern_.size() - 1);
+            window_.erase(window_.begin(), window_.end() - tail);
+        }
+
+        void reset() {
+            window_.clear();
+        }
+
+    private:
+        std::vector<uint8_t> pattern_;
+        std::boyer_moore_horspool_searcher<std::vector<uint8_t>::const_iterator> searcher_;
+        std::vector<uint8_t> window_;
+        std::vector<SearchMatch>* matches_;
+    };
+
+
+    // Блоки, в которых может начинаться или заканчиваться совпадение
+    std::vector<bool> candidate_blocks(
+        const ArchiveMember& member,
+        const std::string& pattern
+    ) {
+        const auto& blocks = member.blocks;
+        size_t size = pattern.size();
+        bool short_blocks = std::any_of(blocks.begin(), blocks.end(), [&](const ArchiveBlock& b) {
+            return b.raw_size + 1 < size;
+        });
+        if (size < 3 || short_blocks) {
+            return std::vector<bool>(blocks.size(), true);
+        }
+
+        auto pattern_data = reinterpret_cast<const uint8_t*>(pattern.data());
+        size_t trigrams = size - 2;
+
+        // hits_prefix[i] -- сколько первых триграмм образца есть в блоке i,
+        //   hits_suffix[i] -- с какой триграммы все последующие есть в блоке i.
+        std::vector<size_t> hits_prefix(blocks.size()), hits_suffix(blocks.size());
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            const auto& summary = blocks[i].summary;
+            size_t prefix = 0;
+            while (prefix < trigrams && may_contain(summary, trigram_at(pattern_data + prefix))) {
+                ++prefix;
+            }
+            size_t suffix = trigrams;
+            while (suffix > 0 && may_contain(summary, trigram_at(pattern_data + suffix - 1))) {
+                --suffix;
+            }
+            hits_prefix[i] = prefix;
+            hits_suffix[i] = suffix;
+        }
+
+        std::vector<bool> candidates(blocks.size()); // NRVO
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            if (hits_prefix[i] == trigrams) {
+                candidates[i] = true;
+            }
+            // Совпадение делится на префикс длины s в блоке i и суффикс
+            //    в блоке i + 1; триграммы на стыке не проверяются.
+            if (i + 1 < blocks.size()
+                && std::max<size_t>(1, hits_suffix[i + 1])
+                    <= std::min(size - 1, hits_prefix[i] + 2)) {
+                candidates[i] = candidates[i + 1] = true;
+            }
+        }
+        return candidates;
+    }
+
+} // \SEARCH
+
+
+std::vector<uint8_t> trigram_summary(const uint8_t* data, uint64_t size) {
+    if (size < 3) {
+        return {};
+    }
+
+    // Число различных триграмм
+    static thread_local std::vector<bool> seen(TRIGRAM_COUNT);
+    uint64_t distinct = 0;
+    for (uint64_t i = 0; i + 2 < size; ++i) {
+        auto seen_bit = seen[trigram_at(data + i)];
+        if (!seen_bit) {
+            seen_bit = true;
+            ++distinct;
+        }
+    }
+    for (uint64_t i = 0; i + 2 < size; ++i) {
+        seen[trigram_at(data + i)] = false;
+    }
+
+    uint64_t bits = MIN_SUMMARY_BITS;
+    while (bits < distinct * BLOOM_BITS_PER_TRIGRAM) {
+        bits <<= 1u;
+    }
+    if (bits / 8 > size / MAX_SUMMARY_RATIO) {
+        return {};
+    }
+
+    std::vector<uint8_t> summary(bits / 8); // NRVO
+    for (uint64_t i = 0; i + 2 < size; ++i) {
+        for_each_bloom_bit(trigram_at(data + i), bits - 1, [&](uint64_t bit) {
+            summary[bit >> 3u] |= 1u << (bit & 7u);
+        });
+    }
+    return summary;
+}
+
+
+std::vector<SearchMatch> search(
+    std::istream& istr,
+    const std::string& pattern,
+    unsigned threads,
+    SearchStats* stats
+) {
+    SearchStats local_stats;
+    if (!stats) {
+        stats = &local_stats;
+    }
+    *stats = {};
+
+    std::vector<SearchMatch> matches; // NRVO
+    if (pattern.empty()) {
+        return matches;
+    }
+    Matcher matcher(pattern, &matches);
+
+    if (!is_archive(istr)) {
+        istr.seekg(0);
+        std::vector<uint8_t> data{
+            std::istreambuf_iterator<char>(istr), std::istreambuf_iterator<char>()
+        };
+        stats->blocks = stats->decoded_blocks = 1;
+        matcher.feed("", decompress(data.data(), data.size(), threads), 0);
+        return matches;
+    }
+
+    for (const auto& member : list_archive(istr)) {
+        auto candidates = candidate_blocks(member, pattern);
+        uint64_t start = 0;
+        matcher.reset();
+        for (size_t i = 0; i < member.blocks.size(); ++i) {
+            const auto& block = member.blocks[i];
+            ++stats->blocks;
+            if (candidates[i]) {
+                ++stats->decoded_blocks;
+                matcher.feed(member.name, read_block(istr, block, threads), start);
+            } else {
+                matcher.reset();
+            }
+            start += block.raw_size;
+        }
+    }
+    return matches;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Поиск подстроки в сжатых файлах.
+//
+//   Для каждого блока архива в каталоге хранится фильтр Блума по
+//   триграммам блока. Блок декодируется, только если все триграммы
+//   образца могут в нем встретиться (или образец может начинаться в нем
+//   и заканчиваться в следующем блоке). Файлы в формате encode
+//   декодируются целиком.
+
+struct SearchMatch {
+    std::string member; // пустое имя для файлов в формате encode
+    uint64_t offset;
+};
+
+struct SearchStats {
+    uint64_t blocks = 0;
+    uint64_t decoded_blocks = 0;
+};
+
+// Сводка блока для поиска: фильтр Блума по триграммам.
+//   Пустая сводка означает, что блок может содержать что угодно.
+std::vector<uint8_t> trigram_summary(const uint8_t* data, uint64_t size);
+
+std::vector<SearchMatch> search(
+    std::istream& istr,
+    const std::string& pattern,
+    unsigned threads = 0,
+    SearchStats* stats = nullptr
+);
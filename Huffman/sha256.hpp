@@ -0,0 +1,14 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <cstdint>
+
+// SHA-256 (FIPS 180-4): ключ кусков в хранилище (см. store.hpp)
+
+using Sha256Digest = std::array<uint8_t, 32>;
+
+Sha256Digest sha256(const uint8_t* data, uint64_t size);
+
+// 64 шестнадцатеричные цифры
+std::string to_hex(const Sha256Digest& digest);
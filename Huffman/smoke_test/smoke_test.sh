@@ -2,11 +2,12 @@
 
 if [ "$#" -lt 1 ]; then
     echo "Usage:"
-    echo "    $0 path_to_huffman"
+    echo "    $0 path_to_huffman [path_to_loadgen]"
     exit 0
 fi
 
 EXECUTABLE="$1"
+LOADGEN="${2:-}"
 REAL_EXEC="$EXECUTABLE"
 
 VALGRIND_OPTS="--leak-check=yes -q --leak-resolution=high --main-stacksize=64000000"
@@ -15,6 +16,13 @@ VALGRIND_OPTS="--leak-check=yes -q --leak-resolution=high --main-stacksize=64000
 
 COMPRESSED_FILE=compressed
 DECOMPRESSED_FILE=decompressed
+ARCHIVE_FILE=archive
+EXTRACT_DIR=extracted
+CONFIG_FILE=tune.conf
+STORE_DIR=store
+
+# Settings of a previous --autotune must not change the tests
+export HUFFMAN_CONFIG=/dev/null
 
 run()
 {
@@ -27,6 +35,192 @@ for source_file in *.in; do
     run -c $source_file $COMPRESSED_FILE
     run -d $COMPRESSED_FILE $DECOMPRESSED_FILE
     diff -q $source_file $DECOMPRESSED_FILE
+    run -w -c $source_file $COMPRESSED_FILE
+    run -d $COMPRESSED_FILE $DECOMPRESSED_FILE
+    diff -q $source_file $DECOMPRESSED_FILE
+    run -W -c $source_file $COMPRESSED_FILE
+    run -d $COMPRESSED_FILE $DECOMPRESSED_FILE
+    diff -q $source_file $DECOMPRESSED_FILE
+    run --max-memory 64K -c $source_file $COMPRESSED_FILE
+    # Decoding also holds the tree and its table
+    run --max-memory 128K -d $COMPRESSED_FILE $DECOMPRESSED_FILE
+    diff -q $source_file $DECOMPRESSED_FILE
+done
+
+# Speculative chunk borders must not drop the tail of the stream
+run -c fib_unbalanced.in $COMPRESSED_FILE
+for threads in 2 3 5 7 16; do
+    run -t $threads -d $COMPRESSED_FILE $DECOMPRESSED_FILE
+    diff -q fib_unbalanced.in $DECOMPRESSED_FILE
+done
+
+# A truncated table is an error, not a crash
+printf '\377' > $COMPRESSED_FILE
+if run -d $COMPRESSED_FILE $DECOMPRESSED_FILE 2> /dev/null; then
+    exit 1
+fi
+
+# Damaged word streams are errors: bad code lengths, a huge size, a cut tail
+run -w -c pg16527.in $COMPRESSED_FILE > /dev/null
+cp $COMPRESSED_FILE $EXTRACT_DIR.part
+printf '\000\000' | dd of=$COMPRESSED_FILE bs=1 seek=12 conv=notrunc 2> /dev/null
+head -c 128 /dev/zero | tr '\000' '\021' | dd of=$COMPRESSED_FILE bs=1 seek=14 conv=notrunc 2> /dev/null
+if run -d $COMPRESSED_FILE $DECOMPRESSED_FILE 2> /dev/null; then
+    exit 1
+fi
+cp $EXTRACT_DIR.part $COMPRESSED_FILE
+printf '\000\000\000\100' | dd of=$COMPRESSED_FILE bs=1 seek=4 conv=notrunc 2> /dev/null
+if run -d $COMPRESSED_FILE $DECOMPRESSED_FILE 2> /dev/null; then
+    exit 1
+fi
+head -c $(( $(wc -c < $EXTRACT_DIR.part) - 3 )) $EXTRACT_DIR.part > $COMPRESSED_FILE
+if run -d $COMPRESSED_FILE $DECOMPRESSED_FILE 2> /dev/null; then
+    exit 1
+fi
+rm $EXTRACT_DIR.part
+# A cut tail of a wide stream too
+run -W -c pg16527.in $COMPRESSED_FILE > /dev/null
+head -c $(( $(wc -c < $COMPRESSED_FILE) - 3 )) $COMPRESSED_FILE > $EXTRACT_DIR.part
+if run -d $EXTRACT_DIR.part $DECOMPRESSED_FILE 2> /dev/null; then
+    exit 1
+fi
+rm $EXTRACT_DIR.part
+
+run --filter auto -A $ARCHIVE_FILE *.in
+run -v -l $ARCHIVE_FILE > /dev/null
+run -x $ARCHIVE_FILE $EXTRACT_DIR
+for source_file in *.in; do
+    diff -q $source_file $EXTRACT_DIR/$source_file
+done
+run -x $ARCHIVE_FILE $EXTRACT_DIR fib.in
+diff -q fib.in $EXTRACT_DIR/fib.in
+FOUND=$(run -s Gutenberg $ARCHIVE_FILE | grep -c "^pg16527.in:")
+test "$FOUND" -eq "$(grep -o Gutenberg pg16527.in | wc -l)"
+if run -x $ARCHIVE_FILE /dev/null/$EXTRACT_DIR 2> /dev/null; then
+    exit 1
+fi
+# A huge member count in a damaged directory is an error, not an allocation
+DIR_OFFSET=$(tail -c 20 $ARCHIVE_FILE | od -An -tu8 -N8 | tr -d ' ')
+printf '\377\377\377\377' | dd of=$ARCHIVE_FILE bs=1 seek=$DIR_OFFSET conv=notrunc 2> /dev/null
+if run -l $ARCHIVE_FILE > /dev/null 2>&1; then
+    exit 1
+fi
+rm -r $ARCHIVE_FILE $EXTRACT_DIR
+
+for filter in delta1 delta2 delta4 delta8 xor1 xor8 split2 split4 split8; do
+    run --filter $filter -c fib.in $COMPRESSED_FILE
+    run -d $COMPRESSED_FILE $DECOMPRESSED_FILE
+    diff -q fib.in $DECOMPRESSED_FILE
+done
+# Filter and sniff buffers count against the budget
+run --max-memory 1M --filter auto -c pg16527.in $COMPRESSED_FILE 2> /dev/null
+run --max-memory 1M -d $COMPRESSED_FILE $DECOMPRESSED_FILE 2> /dev/null
+diff -q pg16527.in $DECOMPRESSED_FILE
+if run --max-memory 128K --filter auto -c pg16527.in $COMPRESSED_FILE 2> /dev/null; then
+    exit 1
+fi
+for source_file in *.in; do
+    run --filter auto -c $source_file $COMPRESSED_FILE 2> /dev/null
+    run -d $COMPRESSED_FILE $DECOMPRESSED_FILE
+    diff -q $source_file $DECOMPRESSED_FILE
 done
 
+rm -f $COMPRESSED_FILE
+head -c 100000 pg16527.in > $EXTRACT_DIR.part
+run -a $EXTRACT_DIR.part $COMPRESSED_FILE
+tail -c +100001 pg16527.in > $EXTRACT_DIR.part
+run --max-memory 64K -a $EXTRACT_DIR.part $COMPRESSED_FILE
+run --filter split4 -a fib.in $COMPRESSED_FILE
+run -d $COMPRESSED_FILE $DECOMPRESSED_FILE
+cat pg16527.in fib.in | diff -q - $DECOMPRESSED_FILE
+rm $EXTRACT_DIR.part
+
+run -c pg16527.in $COMPRESSED_FILE
+run --max-memory 16K -d $COMPRESSED_FILE $DECOMPRESSED_FILE
+diff -q pg16527.in $DECOMPRESSED_FILE
+# A budget that can not be met is an error, not a silent overrun
+if run --max-memory 8K -d $COMPRESSED_FILE $DECOMPRESSED_FILE 2> /dev/null; then
+    exit 1
+fi
+
+# One pass with a sampled table; fib.in drifts from a sample of the text
+cat pg16527.in fib.in > $EXTRACT_DIR.part
+run --max-memory 256K --sample 64K -c $EXTRACT_DIR.part $COMPRESSED_FILE 2> /dev/null
+run -d $COMPRESSED_FILE $DECOMPRESSED_FILE
+diff -q $EXTRACT_DIR.part $DECOMPRESSED_FILE
+if run --max-memory 64K --sample 64K -c $EXTRACT_DIR.part $COMPRESSED_FILE 2> /dev/null; then
+    exit 1
+fi
+cat $EXTRACT_DIR.part | run --max-memory 256K --sample 16K -c /dev/stdin $COMPRESSED_FILE 2> /dev/null
+run -d $COMPRESSED_FILE $DECOMPRESSED_FILE
+diff -q $EXTRACT_DIR.part $DECOMPRESSED_FILE
+rm $EXTRACT_DIR.part
+
+if command -v gzip > /dev/null; then
+    for source_file in *.in; do
+        for mode in huffman lz; do
+            run --gzip $mode -c $source_file $COMPRESSED_FILE > /dev/null
+            gzip -dc < $COMPRESSED_FILE > $DECOMPRESSED_FILE
+            diff -q $source_file $DECOMPRESSED_FILE
+        done
+    done
+    # Many chunks, matches across chunk borders
+    cat pg16527.in pg16527.in > $EXTRACT_DIR.part
+    run --max-memory 128K --gzip lz -c $EXTRACT_DIR.part $COMPRESSED_FILE > /dev/null
+    gzip -dc < $COMPRESSED_FILE | diff -q $EXTRACT_DIR.part -
+    rm $EXTRACT_DIR.part
+fi
+
+run --store $STORE_DIR pg16527.in fib.in > /dev/null
+{ head -c 100000 pg16527.in; echo inserted; tail -c +100001 pg16527.in; } > $EXTRACT_DIR.part
+# Only the chunk around the insertion is new
+NEW=$(run --store $STORE_DIR $EXTRACT_DIR.part | sed -n 3p)
+test "$NEW" -lt "$(wc -c < pg16527.in)"
+# Torn records after a crash are dropped before the next append
+printf 'torn' >> $STORE_DIR/index
+printf 'torn' >> $STORE_DIR/files
+run --store $STORE_DIR fib_unbalanced.in > /dev/null
+run -v -l $STORE_DIR > /dev/null
+for source_file in pg16527.in fib.in $EXTRACT_DIR.part fib_unbalanced.in; do
+    run --restore $STORE_DIR $source_file $DECOMPRESSED_FILE
+    diff -q $source_file $DECOMPRESSED_FILE
+done
+rm -r $STORE_DIR $EXTRACT_DIR.part
+
+run --autotune pg16527.in $CONFIG_FILE > /dev/null
+grep -q "^block_size " $CONFIG_FILE
+export HUFFMAN_CONFIG=$CONFIG_FILE
+run --filter auto -c pg16527.in $COMPRESSED_FILE 2> /dev/null
+run -d $COMPRESSED_FILE $DECOMPRESSED_FILE
+diff -q pg16527.in $DECOMPRESSED_FILE
+for line in "block_size 1024" "streams 3" "threads 1000000"; do
+    echo "$line" > $CONFIG_FILE
+    if run -c pg16527.in $COMPRESSED_FILE 2> /dev/null; then
+        exit 1
+    fi
+done
+export HUFFMAN_CONFIG=/dev/null
+rm $CONFIG_FILE
+
+if [ -n "$LOADGEN" ]; then
+    SOCKET=$(pwd)/daemon.sock
+    $REAL_EXEC --daemon $SOCKET pg16527.in &
+    DAEMON_PID=$!
+    while [ ! -S $SOCKET ]; do sleep 0.1; done
+    # Damaged word streams get error responses and leave the daemon up
+    run -w -c pg16527.in $COMPRESSED_FILE > /dev/null
+    cp $COMPRESSED_FILE $EXTRACT_DIR.part
+    head -c 128 /dev/zero | tr '\000' '\021' | dd of=$EXTRACT_DIR.part bs=1 seek=14 conv=notrunc 2> /dev/null
+    printf '\000\000' | dd of=$EXTRACT_DIR.part bs=1 seek=12 conv=notrunc 2> /dev/null
+    $LOADGEN $SOCKET -n 20 -s 1000000 -o d -r $EXTRACT_DIR.part > /dev/null
+    printf '\000\000\000\100' | dd of=$COMPRESSED_FILE bs=1 seek=4 conv=notrunc 2> /dev/null
+    $LOADGEN $SOCKET -n 20 -s 1000000 -o d -r $COMPRESSED_FILE > /dev/null
+    rm $EXTRACT_DIR.part
+    for op in c d C D; do
+        $LOADGEN $SOCKET -n 200 -o $op pg16527.in
+    done
+    kill $DAEMON_PID
+    rm $SOCKET
+fi
+
 echo "Smoke test passed!"
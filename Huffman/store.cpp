@@ -0,0 +1,437 @@
+#include "store.hpp"
+#include "archive.hpp"
+#include "huffman.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+    constexpr char INDEX_MAGIC[4] = {'H', 'F', 'S', 'T'};
+    constexpr char FILES_MAGIC[4] = {'H', 'F', 'S', 'F'};
+    constexpr uint8_t STORE_VERSION = 1;
+    constexpr uint64_t STORE_HEADER_SIZE = sizeof(INDEX_MAGIC) + 1;
+    constexpr uint64_t INDEX_ENTRY_SIZE = 32 + 8 + 4 + 4 + 1 + 1;
+    // Файлы читаются и обрабатываются порциями такого размера
+    constexpr uint64_t BATCH_SIZE = 8u << 20u;
+
+    // Граница -- где CUT_BITS старших битов хеша нулевые, то есть
+    //    в среднем через AVERAGE_CHUNK_SIZE байтов после минимума.
+    //    При сдвиге на бит в хеш входит следующий байт, поэтому старшие
+    //    биты зависят от последних 48-64 байтов.
+    constexpr unsigned CUT_BITS = 15;
+    static_assert(AVERAGE_CHUNK_SIZE == 1u << CUT_BITS, "average chunk size");
+    constexpr uint64_t CUT_MASK = ~uint64_t{0} << (64 - CUT_BITS);
+
+    // Случайные числа для байтов (splitmix64)
+    constexpr std::array<uint64_t, 256> make_gear() {
+        std::array<uint64_t, 256> gear{};
+        uint64_t state = 0;
+        for (auto& value : gear) {
+            state += 0x9e3779b97f4a7c15u;
+            uint64_t z = state;
+            z = (z ^ (z >> 30u)) * 0xbf58476d1ce4e5b9u;
+            z = (z ^ (z >> 27u)) * 0x94d049bb133111ebu;
+            value = z ^ (z >> 31u);
+        }
+        return gear;
+    }
+
+    constexpr std::array<uint64_t, 256> GEAR = make_gear();
+
+
+    struct ChunkEntry {
+        uint64_t offset = 0;
+        uint32_t raw_size = 0;
+        uint32_t size = 0;
+        BlockPlan plan;
+    };
+
+    struct DigestHash {
+        size_t operator()(const Sha256Digest& digest) const {
+            size_t hash;
+            std::memcpy(&hash, digest.data(), sizeof(hash));
+            return hash;
+        }
+    };
+
+    using ChunkIndex = std::unordered_map<Sha256Digest, ChunkEntry, DigestHash>;
+
+
+    void put(std::vector<uint8_t>* out, uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; ++i) {
+            out->push_back(static_cast<uint8_t>(value >> (8u * i)));
+        }
+    }
+
+    uint64_t get(const uint8_t* data, int bytes) {
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; ++i) {
+            value |= static_cast<uint64_t>(data[i]) << (8u * i);
+        }
+        return value;
+    }
+
+
+    std::string store_path(const std::string& dir, const char* name) {
+        return (std::filesystem::path(dir) / name).string();
+    }
+
+
+    // Содержимое файла хранилища после заголовка; пусто, если файла нет
+    std::vector<uint8_t> read_store_file(const std::string& path, const char* magic) {
+        std::ifstream fin(path, std::ios::binary);
+        if (!fin) {
+            return {};
+        }
+        std::vector<uint8_t> data{std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>()};
+        if (data.size() < STORE_HEADER_SIZE
+            || !std::equal(magic, magic + sizeof(INDEX_MAGIC), data.begin())
+            || data[sizeof(INDEX_MAGIC)] != STORE_VERSION) {
+            throw archive_error("not a store file: " + path);
+        }
+        data.erase(data.begin(), data.begin() + STORE_HEADER_SIZE);
+        return data;
+    }
+
+
+    // Открывает файл хранилища на дописывание; новый файл -- с заголовком.
+    //   Существующий файл сначала обрезается до records_size байтов целых
+    //   записей, иначе новые записи встали бы за обрывком и сдвинулись.
+    std::ofstream append_store_file(const std::string& path, const char* magic, uint64_t records_size) {
+        bool exists = std::filesystem::exists(path);
+        if (exists) {
+            std::filesystem::resize_file(path, STORE_HEADER_SIZE + records_size);
+        }
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        if (!exists) {
+            out.write(magic, sizeof(INDEX_MAGIC));
+            out.put(static_cast<char>(STORE_VERSION));
+        }
+        if (!out) {
+            throw archive_error("cannot write " + path);
+        }
+        return out;
+    }
+
+
+    // Обрывок записи в конце (после сбоя при дописывании) пропускается;
+    //   в records_size -- размер целых записей
+    ChunkIndex read_index(const std::string& dir, uint64_t* records_size = nullptr) {
+        auto data = read_store_file(store_path(dir, "index"), INDEX_MAGIC);
+        ChunkIndex index;
+        size_t pos = 0;
+        for (; pos + INDEX_ENTRY_SIZE <= data.size(); pos += INDEX_ENTRY_SIZE) {
+            const uint8_t* entry = data.data() + pos;
+            Sha256Digest digest;
+            std::copy(entry, entry + digest.size(), digest.begin());
+            entry += digest.size();
+            ChunkEntry chunk;
+            chunk.offset = get(entry, 8);
+            chunk.raw_size = static_cast<uint32_t>(get(entry + 8, 4));
+            chunk.size = static_cast<uint32_t>(get(entry + 12, 4));
+            chunk.plan = {filter_from_code(entry[16]), static_cast<BlockCoder>(entry[17])};
+            if (chunk.plan.coder > BlockCoder::STORED) {
+                throw archive_error("corrupted store index");
+            }
+            index[digest] = chunk;
+        }
+        if (records_size) {
+            *records_size = pos;
+        }
+        return index;
+    }
+
+
+    // Все записи о файлах, включая замененные; в records_size -- размер
+    //   целых записей
+    std::vector<StoredFile> read_files(const std::string& dir, uint64_t* records_size = nullptr) {
+        auto data = read_store_file(store_path(dir, "files"), FILES_MAGIC);
+        std::vector<StoredFile> files;
+        size_t pos = 0;
+        size_t end = 0;
+        while (pos + 2 <= data.size()) {
+            auto name_size = static_cast<size_t>(get(data.data() + pos, 2));
+            if (pos + 2 + name_size + 12 > data.size()) {
+                break;
+            }
+            StoredFile file;
+            file.name.assign(data.begin() + pos + 2, data.begin() + pos + 2 + name_size);
+            pos += 2 + name_size;
+            file.raw_size = get(data.data() + pos, 8);
+            uint64_t count = get(data.data() + pos + 8, 4);
+            pos += 12;
+            if (pos + count * 32 > data.size()) {
+                break;
+            }
+            file.chunks.resize(count);
+            for (auto& digest : file.chunks) {
+                std::copy(data.begin() + pos, data.begin() + pos + 32, digest.begin());
+                pos += 32;
+            }
+            files.push_back(std::move(file));
+            end = pos;
+        }
+        if (records_size) {
+            *records_size = end;
+        }
+        return files;
+    }
+
+
+    // Вызывает f(i) для всех i < count в threads потоках
+    template <class F>
+    void parallel_for(size_t count, unsigned threads, F f) {
+        threads = static_cast<unsigned>(std::max<size_t>(std::min<size_t>(threads, count), 1));
+        std::atomic<size_t> next{0};
+        std::vector<std::exception_ptr> errors(threads);
+        auto worker = [&](unsigned id) {
+            try {
+                for (size_t i = next++; i < count; i = next++) {
+                    f(i);
+                }
+            } catch (...) {
+                errors[id] = std::current_exception();
+            }
+        };
+        std::vector<std::thread> workers;
+        for (unsigned id = 1; id < threads; ++id) {
+            workers.emplace_back(worker, id);
+        }
+        worker(0);
+        for (auto& thread : workers) {
+            thread.join();
+        }
+        for (const auto& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+
+    struct Chunk {
+        const uint8_t* data;
+        uint32_t size;
+        Sha256Digest digest;
+    };
+
+
+    // Добавляет куски одной порции: хеши и сжатие новых кусков --
+    //    параллельно, запись в pack и index -- по порядку
+    class ChunkWriter {
+    public:
+        ChunkWriter(const std::string& dir, const BlockOptions& options, unsigned threads)
+            : options_(options),
+              threads_(threads)
+        {
+            uint64_t index_size = 0;
+            index_ = read_index(dir, &index_size);
+            auto pack_path = store_path(dir, "pack");
+            pack_offset_ = std::filesystem::exists(pack_path) ? std::filesystem::file_size(pack_path) : 0;
+            pack_.open(pack_path, std::ios::binary | std::ios::app);
+            index_out_ = append_store_file(store_path(dir, "index"), INDEX_MAGIC, index_size);
+            if (!pack_) {
+                throw archive_error("cannot write " + pack_path);
+            }
+        }
+
+        void add(std::vector<Chunk>* chunks, StoredFile* file, StoreStats* stats) {
+            parallel_for(chunks->size(), threads_, [&](size_t i) {
+                (*chunks)[i].digest = sha256((*chunks)[i].data, (*chunks)[i].size);
+            });
+
+            std::vector<const Chunk*> fresh;
+            for (const auto& chunk : *chunks) {
+                file->chunks.push_back(chunk.digest);
+                file->raw_size += chunk.size;
+                ++stats->chunks;
+                if (index_.emplace(chunk.digest, ChunkEntry{}).second) {
+                    fresh.push_back(&chunk);
+                }
+            }
+
+            std::vector<std::vector<uint8_t>> compressed(fresh.size());
+            std::vector<BlockPlan> plans(fresh.size());
+            parallel_for(fresh.size(), threads_, [&](size_t i) {
+                compressed[i] = compress_block(fresh[i]->data, fresh[i]->size, options_, &plans[i]);
+            });
+
+            std::vector<uint8_t> entries;
+            for (size_t i = 0; i < fresh.size(); ++i) {
+                pack_.write(reinterpret_cast<const char*>(compressed[i].data()), compressed[i].size());
+                ChunkEntry entry{
+                    pack_offset_, fresh[i]->size, static_cast<uint32_t>(compressed[i].size()), plans[i]
+                };
+                index_[fresh[i]->digest] = entry;
+                entries.insert(entries.end(), fresh[i]->digest.begin(), fresh[i]->digest.end());
+                put(&entries, entry.offset, 8);
+                put(&entries, entry.raw_size, 4);
+                put(&entries, entry.size, 4);
+                put(&entries, filter_code(entry.plan.filter), 1);
+                put(&entries, static_cast<uint8_t>(entry.plan.coder), 1);
+                pack_offset_ += compressed[i].size();
+                ++stats->new_chunks;
+                stats->new_raw_size += fresh[i]->size;
+                stats->new_size += compressed[i].size();
+            }
+            // Куски попадают в index только после записи в pack
+            pack_.flush();
+            index_out_.write(reinterpret_cast<const char*>(entries.data()), entries.size());
+            index_out_.flush();
+            if (!pack_ || !index_out_) {
+                throw archive_error("write error");
+            }
+        }
+
+    private:
+        ChunkIndex index_;
+        BlockOptions options_;
+        unsigned threads_;
+        std::ofstream pack_;
+        std::ofstream index_out_;
+        uint64_t pack_offset_ = 0;
+    };
+
+} // \STORE
+
+
+uint32_t chunk_length(const uint8_t* data, uint64_t size) {
+    auto limit = static_cast<uint32_t>(std::min<uint64_t>(size, MAX_CHUNK_SIZE));
+    uint64_t hash = 0;
+    for (uint32_t i = MIN_CHUNK_SIZE; i < limit; ++i) {
+        hash = (hash << 1u) + GEAR[data[i]];
+        if ((hash & CUT_MASK) == 0) {
+            return i + 1;
+        }
+    }
+    return limit;
+}
+
+
+void store_files(
+    const std::string& dir,
+    const std::vector<std::string>& files,
+    const BlockOptions& options,
+    unsigned threads,
+    StoreStats* stats
+) {
+    std::filesystem::create_directories(dir);
+    ChunkWriter writer(dir, options, resolve_threads(threads));
+    uint64_t files_size = 0;
+    read_files(dir, &files_size);
+    auto files_out = append_store_file(store_path(dir, "files"), FILES_MAGIC, files_size);
+    StoreStats total;
+
+    for (const auto& path : files) {
+        std::ifstream fin(path, std::ios::binary);
+        if (!fin) {
+            throw archive_error("cannot open " + path);
+        }
+        StoredFile file{member_name(path), 0, {}};
+        // Длина имени записывается в два байта
+        if (file.name.size() > 0xFFFF) {
+            throw archive_error("name too long: " + path);
+        }
+
+        // Кусок отрезается, только если за его началом есть
+        //    MAX_CHUNK_SIZE байтов или конец файла: иначе граница
+        //    зависела бы от размера порции
+        std::vector<uint8_t> buffer;
+        bool eof = false;
+        while (!eof) {
+            size_t old_size = buffer.size();
+            buffer.resize(old_size + BATCH_SIZE);
+            fin.read(reinterpret_cast<char*>(buffer.data() + old_size), BATCH_SIZE);
+            buffer.resize(old_size + static_cast<size_t>(fin.gcount()));
+            eof = !fin;
+
+            std::vector<Chunk> chunks;
+            size_t pos = 0;
+            while (pos < buffer.size() && (eof || buffer.size() - pos >= MAX_CHUNK_SIZE)) {
+                uint32_t length = chunk_length(buffer.data() + pos, buffer.size() - pos);
+                chunks.push_back({buffer.data() + pos, length, {}});
+                pos += length;
+            }
+            writer.add(&chunks, &file, &total);
+            buffer.erase(buffer.begin(), buffer.begin() + pos);
+        }
+        total.raw_size += file.raw_size;
+
+        std::vector<uint8_t> record;
+        put(&record, file.name.size(), 2);
+        record.insert(record.end(), file.name.begin(), file.name.end());
+        put(&record, file.raw_size, 8);
+        put(&record, file.chunks.size(), 4);
+        for (const auto& digest : file.chunks) {
+            record.insert(record.end(), digest.begin(), digest.end());
+        }
+        files_out.write(reinterpret_cast<const char*>(record.data()), record.size());
+        files_out.flush();
+        if (!files_out) {
+            throw archive_error("write error");
+        }
+    }
+
+    if (stats) {
+        *stats = total;
+    }
+}
+
+
+std::vector<StoredFile> list_store(const std::string& dir) {
+    if (!std::filesystem::is_directory(dir)) {
+        throw archive_error("not a store: " + dir);
+    }
+    std::vector<StoredFile> latest;
+    for (auto& file : read_files(dir)) {
+        auto same_name = [&](const StoredFile& f) { return f.name == file.name; };
+        latest.erase(std::remove_if(latest.begin(), latest.end(), same_name), latest.end());
+        latest.push_back(std::move(file));
+    }
+    return latest;
+}
+
+
+void restore_file(const std::string& dir, const std::string& name, std::ostream& ostr) {
+    auto files = list_store(dir);
+    auto file = std::find_if(files.begin(), files.end(), [&](const StoredFile& f) {
+        return f.name == name;
+    });
+    if (file == files.end()) {
+        throw archive_error("no such file: " + name);
+    }
+    auto index = read_index(dir);
+    std::ifstream pack(store_path(dir, "pack"), std::ios::binary);
+
+    std::vector<uint8_t> compressed;
+    for (const auto& digest : file->chunks) {
+        auto entry = index.find(digest);
+        if (entry == index.end()) {
+            throw archive_error("missing chunk " + to_hex(digest));
+        }
+        const ChunkEntry& chunk = entry->second;
+        compressed.resize(chunk.size);
+        pack.seekg(static_cast<std::streamoff>(chunk.offset));
+        pack.read(reinterpret_cast<char*>(compressed.data()), chunk.size);
+        if (!pack) {
+            throw archive_error("unexpected end of pack");
+        }
+        auto raw = decompress_block(compressed.data(), compressed.size(), chunk.raw_size, chunk.plan);
+        if (sha256(raw.data(), raw.size()) != digest) {
+            throw archive_error("corrupted chunk " + to_hex(digest));
+        }
+        ostr.write(reinterpret_cast<const char*>(raw.data()), raw.size());
+    }
+    if (!ostr) {
+        throw archive_error("write error");
+    }
+}
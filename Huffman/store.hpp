@@ -0,0 +1,71 @@
+#pragma once
+
+#include "block.hpp"
+#include "sha256.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Хранилище с устранением повторов для похожих друг на друга файлов
+//   (сборки, снимки журналов). Файлы режутся на куски по содержимому:
+//   граница ставится там, где скользящий хеш последних байтов (gear)
+//   имеет нужные старшие биты, поэтому вставка или удаление байтов
+//   сдвигает только соседние границы. Куски хранятся по SHA-256, каждый
+//   уникальный кусок сжимается один раз; файл -- список ключей кусков.
+//
+//   Хранилище -- каталог с файлами, которые только дописываются:
+//     pack    -- сжатые куски подряд (каждый -- блок, см. block.hpp)
+//     index   -- "HFST" версия(1), затем для каждого куска:
+//                SHA-256(32) смещение в pack(8) исходный размер(4)
+//                сжатый размер(4) преобразование(1) кодер(1)
+//     files   -- "HFSF" версия(1), затем для каждого добавления файла:
+//                длина имени(2) имя размер(8) число кусков(4)
+//                SHA-256 кусков
+//   Все числа хранятся в little-endian. Файл, добавленный повторно
+//   под тем же именем, заменяет прежний. Новые куски пишутся в pack
+//   раньше, чем в index, а index -- раньше, чем files.
+//
+//   При добавлении все данные только режутся и хешируются; сжатие,
+//   запись и место зависят лишь от новых кусков. Старые куски не
+//   читаются, index загружается целиком, но он мал (50 байтов на кусок).
+
+constexpr uint32_t MIN_CHUNK_SIZE = 8 * 1024;
+constexpr uint32_t AVERAGE_CHUNK_SIZE = 32 * 1024;
+constexpr uint32_t MAX_CHUNK_SIZE = 128 * 1024;
+
+// Длина куска, начинающегося в data: первая граница после
+//   MIN_CHUNK_SIZE байтов, но не больше MAX_CHUNK_SIZE и size
+uint32_t chunk_length(const uint8_t* data, uint64_t size);
+
+struct StoredFile {
+    std::string name;
+    uint64_t raw_size = 0;
+    std::vector<Sha256Digest> chunks;
+};
+
+struct StoreStats {
+    uint64_t raw_size = 0;       // байтов в добавленных файлах
+    uint64_t chunks = 0;
+    uint64_t new_chunks = 0;     // куски, которых не было в хранилище
+    uint64_t new_raw_size = 0;
+    uint64_t new_size = 0;       // сжатый размер новых кусков
+};
+
+// Добавляет файлы в хранилище dir (создает его, если нужно). Имена --
+//   относительные пути, как в архиве. Куски хешируются и сжимаются
+//   в threads потоках способом options. Бросает archive_error.
+void store_files(
+    const std::string& dir,
+    const std::vector<std::string>& files,
+    const BlockOptions& options = {},
+    unsigned threads = 0,
+    StoreStats* stats = nullptr
+);
+
+// Последние версии файлов хранилища в порядке добавления
+std::vector<StoredFile> list_store(const std::string& dir);
+
+// Собирает файл name из кусков, проверяя их SHA-256
+void restore_file(const std::string& dir, const std::string& name, std::ostream& ostr);
@@ -0,0 +1,574 @@
+#include "stream.hpp"
+#include "deflate.hpp"
+#include "huffman.hpp"
+#include "tune.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+    // Запись каталога: смещение(8) исходный размер(4) сжатый размер(4)
+    //    размер сводки(4) преобразование(1) кодер(1)
+    constexpr uint64_t DIRECTORY_ENTRY_SIZE = 8 + 4 + 4 + 4 + 1 + 1;
+
+
+    // Память под каталог из blocks блоков: вектор ArchiveBlock растет
+    //    удвоением, при записи каталог сериализуется целиком.
+    uint64_t directory_memory(uint64_t blocks) {
+        return blocks * (2 * sizeof(ArchiveBlock) + DIRECTORY_ENTRY_SIZE);
+    }
+
+
+    // Учет памяти, занятой буферами конвейера и каталогом. Если limit
+    //    не 0, превышение его -- ошибка, а не молчаливый перерасход.
+    class MemoryTracker {
+    public:
+        explicit MemoryTracker(uint64_t limit = 0) : limit_(limit) {}
+
+        void add(uint64_t bytes) {
+            uint64_t now = current_ += bytes;
+            uint64_t peak = peak_;
+            while (now > peak && !peak_.compare_exchange_weak(peak, now)) {}
+            if (limit_ > 0 && now > limit_) {
+                throw archive_error(
+                    "memory limit exceeded: " + std::to_string(now) + " of " + std::to_string(limit_) + " bytes"
+                );
+            }
+        }
+
+        void sub(uint64_t bytes) {
+            current_ -= bytes;
+        }
+
+        uint64_t peak() const {
+            return peak_;
+        }
+
+    private:
+        uint64_t limit_;
+        std::atomic<uint64_t> current_{0};
+        std::atomic<uint64_t> peak_{0};
+    };
+
+
+    struct Job {
+        std::vector<uint8_t> input;
+        std::vector<uint8_t> output;
+        uint32_t raw_size = 0;
+        BlockPlan plan;
+        SniffReport sniff;
+        uint32_t prefix = 0;   // словарь перед данными в input (gzip)
+        uint32_t checksum = 0; // CRC-32 исходных данных (gzip)
+        bool last = false;     // последний кусок потока (gzip)
+        bool drifted = false;  // закодирован своей таблицей вместо таблицы образца
+        bool done = false;
+        std::exception_ptr error;
+        MemoryTracker* tracker = nullptr;
+        uint64_t tracked = 0;
+
+        // Учитывает буферы задания в tracker
+        void track() {
+            uint64_t memory = input.capacity() + output.capacity();
+            if (memory > tracked) {
+                tracker->add(memory - tracked);
+            } else {
+                tracker->sub(tracked - memory);
+            }
+            tracked = memory;
+        }
+
+        ~Job() {
+            tracker->sub(tracked);
+        }
+    };
+
+
+    // Главный поток читает задания (read), пул потоков их обрабатывает
+    //    (process), главный поток записывает результаты (write) в порядке
+    //    чтения. Одновременно существует не больше queue_depth заданий.
+    template <class Read, class Process, class Write>
+    void run_pipeline(
+        unsigned threads,
+        unsigned queue_depth,
+        MemoryTracker& tracker,
+        Read read,
+        Process process,
+        Write write
+    ) {
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<std::shared_ptr<Job>> queue;
+        std::deque<Job*> pending;
+        bool finished = false;
+
+        auto worker = [&] {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                changed.wait(lock, [&] { return finished || !pending.empty(); });
+                if (pending.empty()) {
+                    return;
+                }
+                Job* job = pending.front();
+                pending.pop_front();
+                lock.unlock();
+                try {
+                    process(*job);
+                    job->track();
+                } catch (...) {
+                    job->error = std::current_exception();
+                }
+                lock.lock();
+                job->done = true;
+                changed.notify_all();
+            }
+        };
+
+        std::vector<std::thread> workers;
+        auto stop = [&] {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished = true;
+                pending.clear();
+            }
+            changed.notify_all();
+            for (auto& thread : workers) {
+                thread.join();
+            }
+        };
+
+        try {
+            for (unsigned i = 0; i < threads; ++i) {
+                workers.emplace_back(worker);
+            }
+            bool eof = false;
+            while (true) {
+                while (!eof && queue.size() < queue_depth) {
+                    auto job = std::make_shared<Job>();
+                    job->tracker = &tracker;
+                    bool more = read(*job);
+                    job->track();
+                    if (!more) {
+                        eof = true;
+                        break;
+                    }
+                    std::lock_guard<std::mutex> lock(mutex);
+                    queue.push_back(job);
+                    pending.push_back(job.get());
+                    changed.notify_one();
+                }
+                if (queue.empty()) {
+                    break;
+                }
+
+                std::shared_ptr<Job> job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [&] { return queue.front()->done; });
+                    job = std::move(queue.front());
+                    queue.pop_front();
+                }
+                if (job->error) {
+                    std::rethrow_exception(job->error);
+                }
+                write(*job);
+            }
+        } catch (...) {
+            stop();
+            throw;
+        }
+        stop();
+    }
+
+
+    // Сжимает istr блоками и пишет их в ostr, начиная со смещения offset
+    //    (текущая позиция ostr), добавляя их к блокам member; затем пишет
+    //    каталог. В stats -- только новые данные.
+    void write_blocks(
+        std::istream& istr,
+        std::ostream& ostr,
+        const MemoryLimits& limits,
+        ArchiveMember* member,
+        uint64_t offset,
+        StreamStats* stats
+    ) {
+        unsigned threads = resolve_threads(limits.threads);
+        unsigned queue_depth = limits.queue_depth > 0 ? limits.queue_depth : threads + 1;
+        uint32_t block_size = std::max(limits.block_size, 1u);
+
+        MemoryTracker tracker(limits.max_memory);
+        tracker.add(member->blocks.capacity() * sizeof(ArchiveBlock));
+        const uint64_t blocks_offset = offset;
+        const uint64_t old_blocks = member->blocks.size();
+        const uint64_t old_raw_size = member->raw_size;
+
+        // Таблица образца; если istr нельзя перематывать, образец -- его
+        //    начало, которое затем кодируется первым
+        std::unique_ptr<TrainedTable> sampled;
+        std::vector<uint8_t> head;
+        uint64_t head_pos = 0;
+        uint64_t drifted = 0;
+        if (limits.sample_size > 0) {
+            if (limits.coding.automatic || limits.coding.plan.filter.kind != FilterKind::NONE) {
+                throw archive_error("sampled tables can not be combined with filters");
+            }
+            if (istr.tellg() == std::streampos(0)) {
+                auto sample = read_sample(istr, limits.sample_size);
+                tracker.add(sample.capacity());
+                istr.clear();
+                istr.seekg(0);
+                sampled = std::make_unique<TrainedTable>(sample.data(), sample.size());
+                tracker.sub(sample.capacity());
+            } else {
+                head.resize(limits.sample_size);
+                istr.read(reinterpret_cast<char*>(head.data()), static_cast<std::streamsize>(head.size()));
+                head.resize(static_cast<size_t>(istr.gcount()));
+                tracker.add(head.capacity());
+                sampled = std::make_unique<TrainedTable>(head.data(), head.size());
+            }
+        }
+
+        auto read = [&](Job& job) {
+            job.input.resize(block_size);
+            auto from_head = static_cast<size_t>(std::min<uint64_t>(block_size, head.size() - head_pos));
+            std::copy_n(head.begin() + head_pos, from_head, job.input.begin());
+            head_pos += from_head;
+            if (!head.empty() && head_pos == head.size()) {
+                // Начало потока закодировано -- буфер больше не нужен
+                tracker.sub(head.capacity());
+                std::vector<uint8_t>().swap(head);
+                head_pos = 0;
+            }
+            istr.read(reinterpret_cast<char*>(job.input.data() + from_head), block_size - from_head);
+            job.input.resize(from_head + static_cast<size_t>(istr.gcount()));
+            job.raw_size = static_cast<uint32_t>(job.input.size());
+            return job.raw_size > 0;
+        };
+        auto process = [&](Job& job) {
+            if (sampled) {
+                job.output = sampled->compress_stream(job.input.data(), job.input.size(), &job.drifted);
+                return;
+            }
+            // Временные буферы живут только внутри compress_block
+            uint64_t scratch = compress_scratch_memory(job.input.size(), limits.coding);
+            tracker.add(scratch);
+            job.output = compress_block(
+                job.input.data(), job.input.size(), limits.coding, &job.plan, &job.sniff
+            );
+            tracker.sub(scratch);
+        };
+        auto write = [&](Job& job) {
+            ostr.write(reinterpret_cast<const char*>(job.output.data()), job.output.size());
+            uint64_t capacity = member->blocks.capacity();
+            member->blocks.push_back(
+                {offset, job.raw_size, static_cast<uint32_t>(job.output.size()), {}, job.plan}
+            );
+            tracker.add((member->blocks.capacity() - capacity) * sizeof(ArchiveBlock));
+            if (stats && limits.coding.automatic) {
+                stats->sniffs.push_back(job.sniff);
+                tracker.add(sizeof(SniffReport));
+            }
+            offset += job.output.size();
+            member->raw_size += job.raw_size;
+            drifted += job.drifted;
+        };
+        run_pipeline(threads, queue_depth, tracker, read, process, write);
+
+        tracker.add(member->blocks.size() * DIRECTORY_ENTRY_SIZE);
+        auto directory_start = ostr.tellp();
+        write_archive_directory(ostr, {*member}, offset);
+        if (!ostr) {
+            throw archive_error("write error");
+        }
+
+        if (stats) {
+            stats->raw_size = member->raw_size - old_raw_size;
+            stats->compressed_size = offset - blocks_offset;
+            stats->overhead = static_cast<uint64_t>(ostr.tellp() - directory_start);
+            stats->blocks = member->blocks.size() - old_blocks;
+            stats->peak_memory = tracker.peak();
+            stats->drifted = drifted;
+            stats->limits = {
+                limits.max_memory, block_size, threads, queue_depth, limits.coding, limits.sample_size
+            };
+        }
+    }
+
+} // \STREAM
+
+
+uint64_t block_memory(uint64_t block_size, const BlockOptions& coding) {
+    return block_size + MAX_TABLE_SIZE + max_encoded_size(block_size)
+        + compress_scratch_memory(block_size, coding);
+}
+
+
+MemoryLimits fit_memory(
+    uint64_t max_memory,
+    uint64_t input_size,
+    unsigned threads,
+    uint64_t prefix,
+    uint64_t sample_size,
+    const BlockOptions& coding
+) {
+    MemoryLimits limits;
+    limits.max_memory = max_memory;
+    limits.sample_size = sample_size;
+    limits.coding = coding;
+    limits.threads = resolve_threads(threads);
+    limits.queue_depth = limits.threads + 1;
+    if (max_memory == 0) {
+        return limits;
+    }
+    limits.coding.words = false;
+
+    // Буфер блока занимает block_size байтов, даже если вход короче,
+    //    поэтому блок не длиннее входа
+    auto clamp = [&](uint32_t block_size) {
+        if (input_size > 0) {
+            return static_cast<uint32_t>(std::min<uint64_t>(block_size, input_size));
+        }
+        return block_size;
+    };
+    auto need = [&](uint32_t block_size, unsigned queue_depth) {
+        uint64_t blocks = 1;
+        if (input_size > 0) {
+            blocks = (input_size + block_size - 1) / block_size;
+        }
+        return sample_size + queue_depth * (prefix + block_memory(clamp(block_size), coding))
+            + directory_memory(blocks);
+    };
+
+    // Сначала уменьшаем число потоков, затем размер блока
+    const uint32_t largest = std::max(default_block_size(), MIN_BLOCK_SIZE);
+    for (uint32_t block_size = largest; block_size >= MIN_BLOCK_SIZE; block_size /= 2) {
+        for (unsigned t = limits.threads; t > 0; --t) {
+            if (need(block_size, t + 1) <= max_memory) {
+                limits.block_size = clamp(block_size);
+                limits.threads = t;
+                limits.queue_depth = t + 1;
+                return limits;
+            }
+        }
+    }
+    // Без чтения следующего блока во время кодирования текущего
+    uint64_t least = UINT64_MAX;
+    for (uint32_t block_size = largest; block_size >= MIN_BLOCK_SIZE; block_size /= 2) {
+        if (need(block_size, 1) <= max_memory) {
+            limits.block_size = clamp(block_size);
+            limits.threads = 1;
+            limits.queue_depth = 1;
+            return limits;
+        }
+        least = std::min(least, need(block_size, 1));
+    }
+    throw archive_error(
+        "memory limit too small: need at least " + std::to_string(least) + " bytes"
+    );
+}
+
+
+void encode_blocks(
+    std::istream& istr,
+    std::ostream& ostr,
+    const MemoryLimits& limits,
+    StreamStats* stats
+) {
+    ArchiveMember member{"", 0, {}};
+    write_archive_header(ostr);
+    write_blocks(istr, ostr, limits, &member, ARCHIVE_HEADER_SIZE, stats);
+    if (stats) {
+        stats->overhead += ARCHIVE_HEADER_SIZE;
+    }
+}
+
+
+void append_blocks(
+    std::iostream& file,
+    std::istream& istr,
+    const MemoryLimits& limits,
+    StreamStats* stats
+) {
+    auto members = list_archive(file);
+    if (members.size() != 1) {
+        throw archive_error("not a block stream: archive has " + std::to_string(members.size()) + " files");
+    }
+    ArchiveMember member = std::move(members.front());
+
+    // Новые блоки пишутся на место каталога
+    uint64_t offset = ARCHIVE_HEADER_SIZE;
+    for (const auto& block : member.blocks) {
+        offset = std::max(offset, block.offset + block.size);
+    }
+    file.clear();
+    // Каталог пишется в последней версии формата
+    file.seekp(0);
+    write_archive_header(file);
+    file.seekp(static_cast<std::streamoff>(offset));
+    write_blocks(istr, file, limits, &member, offset, stats);
+}
+
+
+void encode_gzip(
+    std::istream& istr,
+    std::ostream& ostr,
+    const MemoryLimits& limits,
+    bool lz,
+    StreamStats* stats
+) {
+    unsigned threads = resolve_threads(limits.threads);
+    unsigned queue_depth = limits.queue_depth > 0 ? limits.queue_depth : threads + 1;
+    uint32_t block_size = std::max(limits.block_size, 1u);
+    MemoryTracker tracker(limits.max_memory);
+
+    // Конец предыдущего куска -- словарь для совпадений следующего
+    std::vector<uint8_t> window;
+    auto read = [&](Job& job) {
+        job.input.resize(window.size() + block_size);
+        std::copy(window.begin(), window.end(), job.input.begin());
+        istr.read(reinterpret_cast<char*>(job.input.data() + window.size()), block_size);
+        job.input.resize(window.size() + static_cast<size_t>(istr.gcount()));
+        job.prefix = static_cast<uint32_t>(window.size());
+        job.raw_size = static_cast<uint32_t>(job.input.size() - window.size());
+        if (job.raw_size == 0) {
+            return false;
+        }
+        job.last = istr.peek() == std::istream::traits_type::eof();
+        if (lz) {
+            auto keep = std::min<size_t>(job.input.size(), DEFLATE_WINDOW);
+            window.assign(job.input.end() - keep, job.input.end());
+        }
+        return true;
+    };
+    auto process = [&](Job& job) {
+        job.checksum = crc32(job.input.data() + job.prefix, job.raw_size);
+        deflate_chunk(job.input.data(), job.prefix, job.raw_size, lz, job.last, &job.output);
+    };
+    uint64_t raw_size = 0;
+    uint64_t compressed_size = 0;
+    uint64_t chunks = 0;
+    uint32_t checksum = 0;
+    bool finished = false;
+    auto write = [&](Job& job) {
+        ostr.write(reinterpret_cast<const char*>(job.output.data()), job.output.size());
+        checksum = crc32_combine(checksum, job.checksum, job.raw_size);
+        raw_size += job.raw_size;
+        compressed_size += job.output.size();
+        ++chunks;
+        finished = job.last;
+    };
+
+    write_gzip_header(ostr);
+    run_pipeline(threads, queue_depth, tracker, read, process, write);
+    // Пустой вход или конец потока, замеченный только после чтения
+    uint64_t overhead = 0;
+    if (!finished) {
+        std::vector<uint8_t> end;
+        deflate_chunk(nullptr, 0, 0, false, true, &end);
+        ostr.write(reinterpret_cast<const char*>(end.data()), end.size());
+        overhead += end.size();
+    }
+    write_gzip_trailer(ostr, checksum, raw_size);
+    if (!ostr) {
+        throw archive_error("write error");
+    }
+
+    if (stats) {
+        stats->raw_size = raw_size;
+        stats->compressed_size = compressed_size;
+        stats->overhead = overhead + GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE;
+        stats->blocks = chunks;
+        stats->peak_memory = tracker.peak();
+        stats->limits = {limits.max_memory, block_size, threads, queue_depth, {}};
+    }
+}
+
+
+void decode_blocks(
+    std::istream& istr,
+    std::ostream& ostr,
+    const MemoryLimits& limits,
+    StreamStats* stats
+) {
+    MemoryTracker tracker(limits.max_memory);
+    auto members = list_archive(istr);
+    if (members.size() != 1) {
+        throw archive_error("not a block stream: archive has " + std::to_string(members.size()) + " files");
+    }
+    const auto& member = members.front();
+    tracker.add(member.blocks.capacity() * sizeof(ArchiveBlock));
+
+    uint64_t job_size = 0;
+    for (const auto& block : member.blocks) {
+        job_size = std::max<uint64_t>(
+            job_size,
+            uint64_t{block.size} + block.raw_size + decompress_scratch_memory(block.raw_size, block.plan)
+        );
+    }
+    unsigned threads = resolve_threads(limits.threads);
+    unsigned queue_depth = threads + 1;
+    if (limits.max_memory > 0 && job_size > 0) {
+        uint64_t directory = member.blocks.capacity() * sizeof(ArchiveBlock);
+        uint64_t available = limits.max_memory > directory ? limits.max_memory - directory : 0;
+        if (available < job_size) {
+            throw archive_error(
+                "memory limit too small: need at least "
+                + std::to_string(directory + job_size) + " bytes"
+            );
+        }
+        queue_depth = static_cast<unsigned>(std::min<uint64_t>(queue_depth, available / job_size));
+        threads = std::max(std::min(threads, queue_depth - 1), 1u);
+    }
+
+    size_t next = 0;
+    uint64_t raw_size = 0;
+    uint64_t compressed_size = 0;
+    auto read = [&](Job& job) {
+        if (next == member.blocks.size()) {
+            return false;
+        }
+        const auto& block = member.blocks[next++];
+        job.raw_size = block.raw_size;
+        job.plan = block.plan;
+        job.input.resize(block.size);
+        istr.seekg(static_cast<std::streamoff>(block.offset));
+        istr.read(reinterpret_cast<char*>(job.input.data()), block.size);
+        if (!istr) {
+            throw archive_error("unexpected end of archive");
+        }
+        return true;
+    };
+    auto process = [&](Job& job) {
+        uint64_t scratch = decompress_scratch_memory(job.raw_size, job.plan);
+        tracker.add(scratch);
+        job.output = decompress_block(job.input.data(), job.input.size(), job.raw_size, job.plan, 1);
+        tracker.sub(scratch);
+    };
+    auto write = [&](Job& job) {
+        ostr.write(reinterpret_cast<const char*>(job.output.data()), job.output.size());
+        raw_size += job.output.size();
+        compressed_size += job.input.size();
+    };
+    run_pipeline(threads, queue_depth, tracker, read, process, write);
+
+    if (raw_size != member.raw_size) {
+        throw archive_error("corrupted archive directory");
+    }
+    if (!ostr) {
+        throw archive_error("write error");
+    }
+
+    if (stats) {
+        stats->raw_size = raw_size;
+        stats->compressed_size = compressed_size;
+        stats->blocks = member.blocks.size();
+        stats->peak_memory = tracker.peak();
+        stats->limits = {limits.max_memory, 0, threads, queue_depth, {}};
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "archive.hpp"
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+// Поток блоков: архив (см. archive.hpp) из одного файла с пустым именем.
+//   Блоки кодируются и декодируются конвейером: главный поток читает
+//   и пишет блоки по порядку, пул потоков их обрабатывает. В конвейере
+//   одновременно находится не больше queue_depth блоков, поэтому память
+//   ограничена queue_depth * block_memory(block_size) и каталогом.
+
+// Наименьший блок, до которого fit_memory уменьшает блоки
+constexpr uint32_t MIN_BLOCK_SIZE = 4 * 1024;
+
+struct MemoryLimits {
+    uint64_t max_memory = 0; // 0 -- без ограничения
+    uint32_t block_size = default_block_size();
+    unsigned threads = 0;
+    unsigned queue_depth = 0; // 0 -- threads + 1
+    BlockOptions coding;      // способ сжатия блоков при кодировании
+    // Если не 0, все блоки кодируются за один проход одной таблицей,
+    //   построенной по образцу из sample_size байтов (см. encode_blocks)
+    uint64_t sample_size = 0;
+};
+
+struct StreamStats {
+    uint64_t raw_size = 0;
+    uint64_t compressed_size = 0; // блоки без заголовка и каталога
+    uint64_t overhead = 0;        // записанные заголовок и каталог
+    uint64_t blocks = 0;
+    uint64_t peak_memory = 0;     // наибольший объем буферов и каталога
+    uint64_t drifted = 0;         // блоки, закодированные своей таблицей
+                                  //   вместо таблицы образца
+    MemoryLimits limits;          // использованные параметры
+    // Признаки и выбранный способ для каждого нового блока, если способ
+    //   выбирался автоматически
+    std::vector<SniffReport> sniffs;
+};
+
+// Наибольший объем памяти под один блок в конвейере: исходные
+//   и сжатые данные и временные буферы способа coding
+//   (см. compress_scratch_memory)
+uint64_t block_memory(uint64_t block_size, const BlockOptions& coding = {});
+
+// Подбирает размер блока, число потоков и глубину очереди так, чтобы
+//   кодирование input_size байтов уложилось в max_memory. Блок не длиннее
+//   входа; prefix -- байты перед данными в буфере каждого блока (словарь
+//   gzip); sample_size -- образец для таблицы (см. encode_blocks), он
+//   занимает память вместе с блоками; coding -- способ сжатия блоков,
+//   его буферы и таблицы тоже входят в бюджет, а кодер слов выключается.
+//   Сначала уменьшается число потоков, затем размер блока. Если бюджет
+//   слишком мал, бросает archive_error; превышение бюджета при
+//   кодировании -- тоже archive_error.
+MemoryLimits fit_memory(
+    uint64_t max_memory,
+    uint64_t input_size,
+    unsigned threads = 0,
+    uint64_t prefix = 0,
+    uint64_t sample_size = 0,
+    const BlockOptions& coding = {}
+);
+
+// Если limits.sample_size > 0, таблица кодов строится по образцу: по
+//   кускам, разбросанным по всему istr, если его можно перематывать,
+//   иначе по первым sample_size байтам (они хранятся в памяти до
+//   кодирования). Блоки кодируются ею без подсчета частот; в заголовке
+//   каждого блока -- та же таблица, поэтому формат и декодирование не
+//   меняются. Байты, которых нет в образце, тоже имеют коды. Блок,
+//   статистика которого ушла от образца (см. TrainedTable::compress_stream),
+//   кодируется своей таблицей. Преобразования и автоматический выбор
+//   способа при этом не применяются.
+void encode_blocks(
+    std::istream& istr,
+    std::ostream& ostr,
+    const MemoryLimits& limits,
+    StreamStats* stats = nullptr
+);
+
+// Дописывает istr новыми блоками в конец потока блоков file (открыт
+//   на чтение и запись). Старые блоки не читаются и не переписываются:
+//   новые пишутся на место каталога, за ними -- новый каталог, так что
+//   время зависит только от размера новых данных. stats -- о новых данных.
+void append_blocks(
+    std::iostream& file,
+    std::istream& istr,
+    const MemoryLimits& limits,
+    StreamStats* stats = nullptr
+);
+
+// Сжимает istr в формат gzip (см. deflate.hpp) кусками по
+//   limits.block_size байтов тем же конвейером, что и encode_blocks;
+//   lz -- искать совпадения. В stats блоки -- куски, overhead --
+//   заголовок и конец gzip.
+void encode_gzip(
+    std::istream& istr,
+    std::ostream& ostr,
+    const MemoryLimits& limits,
+    bool lz,
+    StreamStats* stats = nullptr
+);
+
+// Декодирует архив из одного файла. Размер блока задан файлом, поэтому
+//   из limits используются max_memory и threads.
+void decode_blocks(
+    std::istream& istr,
+    std::ostream& ostr,
+    const MemoryLimits& limits,
+    StreamStats* stats = nullptr
+);
@@ -0,0 +1,257 @@
+#include "tune.hpp"
+#include "stream.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    // Образец -- столько кусков, равномерно разбросанных по файлу
+    constexpr uint64_t SAMPLE_SLICES = 8;
+    constexpr uint32_t TUNE_BLOCK_SIZES[] = {64u << 10u, 256u << 10u, 1u << 20u, 4u << 20u};
+    constexpr unsigned TUNE_STREAMS[] = {1, 2, 4};
+    // Каждая настройка замеряется столько раз, берется лучшее время
+    constexpr int TUNE_REPEATS = 2;
+    // Настройки, сжимающие хуже лучших больше чем на эту долю, не выбираются
+    constexpr double MAX_RATIO_LOSS = 0.01;
+    // Пределы значений в файле настроек: --autotune таких не пишет,
+    //    а блок или число потоков больше -- скорее опечатка
+    constexpr uint32_t MAX_CONFIG_BLOCK_SIZE = 64u << 20u;
+    constexpr unsigned MAX_THREADS_PER_CORE = 4;
+
+
+    struct Trial {
+        double encode = 0; // секунды
+        double decode = 0;
+        uint64_t compressed = 0;
+    };
+
+
+    double seconds_since(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+
+    double mib_per_second(uint64_t size, double seconds) {
+        return seconds > 0 ? size / seconds / (1u << 20u) : 0;
+    }
+
+
+    // Кодирует и декодирует образец потоком блоков в памяти
+    Trial run_trial(const std::string& sample, uint32_t block_size, unsigned threads) {
+        Trial trial;
+        for (int i = 0; i < TUNE_REPEATS; ++i) {
+            std::istringstream raw(sample);
+            std::ostringstream encoded;
+            auto start = Clock::now();
+            encode_blocks(raw, encoded, {0, block_size, threads, threads + 1, {}});
+            double encode = seconds_since(start);
+
+            std::istringstream compressed(encoded.str());
+            std::ostringstream decoded;
+            start = Clock::now();
+            decode_blocks(compressed, decoded, {0, 0, threads, 0, {}});
+            double decode = seconds_since(start);
+            if (decoded.str() != sample) {
+                throw std::runtime_error("autotune: decoded sample differs from the original");
+            }
+
+            trial.encode = i == 0 ? encode : std::min(trial.encode, encode);
+            trial.decode = i == 0 ? decode : std::min(trial.decode, decode);
+            trial.compressed = encoded.str().size();
+        }
+        return trial;
+    }
+
+
+    TuneConfig load_config() {
+        auto path = config_path();
+        if (path.empty()) {
+            return {};
+        }
+        std::ifstream fin(path);
+        if (!fin) {
+            return {};
+        }
+        try {
+            return read_config(fin);
+        } catch (const std::runtime_error& e) {
+            throw std::runtime_error(path + ": " + e.what());
+        }
+    }
+
+
+    TuneConfig& current_config() {
+        static TuneConfig config = load_config();
+        return config;
+    }
+
+} // \TUNE
+
+
+std::string config_path() {
+    if (const char* path = std::getenv("HUFFMAN_CONFIG")) {
+        return path;
+    }
+    if (const char* home = std::getenv("HOME")) {
+        return std::string(home) + "/.huffman.conf";
+    }
+    return {};
+}
+
+
+TuneConfig read_config(std::istream& istr) {
+    TuneConfig config;
+    std::string line;
+    while (std::getline(istr, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key) || key[0] == '#') {
+            continue;
+        }
+        uint64_t value = 0;
+        std::string rest;
+        if (!(fields >> value) || fields >> rest || value == 0 || value > UINT32_MAX) {
+            throw std::runtime_error("bad config line: " + line);
+        }
+        bool valid = true;
+        if (key == "block_size") {
+            valid = value >= MIN_BLOCK_SIZE && value <= MAX_CONFIG_BLOCK_SIZE;
+            config.block_size = static_cast<uint32_t>(value);
+        } else if (key == "threads") {
+            unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+            valid = value <= uint64_t{MAX_THREADS_PER_CORE} * cores;
+            config.threads = static_cast<unsigned>(value);
+        } else if (key == "streams") {
+            valid = std::find(std::begin(TUNE_STREAMS), std::end(TUNE_STREAMS), value) != std::end(TUNE_STREAMS);
+            config.streams = static_cast<unsigned>(value);
+        } else {
+            throw std::runtime_error("unknown config key: " + key);
+        }
+        if (!valid) {
+            throw std::runtime_error("bad config line: " + line);
+        }
+    }
+    return config;
+}
+
+
+void write_config(std::ostream& ostr, const TuneConfig& config) {
+    ostr << "# written by huffman --autotune\n";
+    if (config.block_size > 0) {
+        ostr << "block_size " << config.block_size << '\n';
+    }
+    if (config.threads > 0) {
+        ostr << "threads " << config.threads << '\n';
+    }
+    if (config.streams > 0) {
+        ostr << "streams " << config.streams << '\n';
+    }
+}
+
+
+TuneConfig tuned_config() {
+    return current_config();
+}
+
+
+void set_tuned_config(const TuneConfig& config) {
+    current_config() = config;
+}
+
+
+std::vector<uint8_t> read_sample(std::istream& istr, uint64_t size) {
+    istr.seekg(0, std::ios::end);
+    auto total = static_cast<uint64_t>(istr.tellg());
+    istr.seekg(0);
+    if (total <= size) {
+        std::vector<uint8_t> sample(total);
+        istr.read(reinterpret_cast<char*>(sample.data()), static_cast<std::streamsize>(total));
+        return sample;
+    }
+    uint64_t slice = size / SAMPLE_SLICES;
+    std::vector<uint8_t> sample(slice * SAMPLE_SLICES);
+    for (uint64_t k = 0; k < SAMPLE_SLICES; ++k) {
+        istr.seekg(static_cast<std::streamoff>((total - slice) * k / (SAMPLE_SLICES - 1)));
+        istr.read(reinterpret_cast<char*>(sample.data() + k * slice), static_cast<std::streamsize>(slice));
+    }
+    if (!istr) {
+        throw std::runtime_error("read error while sampling");
+    }
+    return sample;
+}
+
+
+TuneConfig autotune(const uint8_t* data, uint64_t size, std::ostream& out) {
+    if (size == 0) {
+        throw std::runtime_error("autotune: empty sample");
+    }
+    const std::string sample(data, data + size);
+    const TuneConfig saved = tuned_config();
+    set_tuned_config({});
+
+    unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<unsigned> thread_counts;
+    for (unsigned threads = 1; threads < cores; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(cores);
+
+    // Из размеров блока не меньше образца пробуется только наименьший
+    std::vector<std::pair<TuneConfig, Trial>> trials;
+    try {
+        for (uint32_t block_size : TUNE_BLOCK_SIZES) {
+            for (unsigned threads : thread_counts) {
+                Trial trial = run_trial(sample, block_size, threads);
+                out << "block " << block_size << ", threads " << threads
+                    << ": encode " << mib_per_second(size, trial.encode)
+                    << " MiB/s, decode " << mib_per_second(size, trial.decode)
+                    << " MiB/s, ratio " << static_cast<double>(trial.compressed) / size << '\n';
+                trials.push_back({{block_size, threads, 0}, trial});
+            }
+            if (block_size >= size) {
+                break;
+            }
+        }
+
+        uint64_t least = UINT64_MAX;
+        for (const auto& [config, trial] : trials) {
+            least = std::min(least, trial.compressed);
+        }
+        TuneConfig best;
+        double best_time = 0;
+        for (const auto& [config, trial] : trials) {
+            double time = trial.encode + trial.decode;
+            if (trial.compressed <= least * (1 + MAX_RATIO_LOSS) && (best.threads == 0 || time < best_time)) {
+                best = config;
+                best_time = time;
+            }
+        }
+
+        double best_decode = 0;
+        for (unsigned streams : TUNE_STREAMS) {
+            set_tuned_config({0, 0, streams});
+            Trial trial = run_trial(sample, best.block_size, best.threads);
+            out << "block " << best.block_size << ", threads " << best.threads
+                << ", streams " << streams << ": decode "
+                << mib_per_second(size, trial.decode) << " MiB/s\n";
+            if (best.streams == 0 || trial.decode < best_decode) {
+                best.streams = streams;
+                best_decode = trial.decode;
+            }
+        }
+        set_tuned_config(saved);
+        return best;
+    } catch (...) {
+        set_tuned_config(saved);
+        throw;
+    }
+}
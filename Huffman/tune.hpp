@@ -0,0 +1,51 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Настройки, подобранные командой --autotune на данных пользователя.
+//   Читаются из файла config_path() при первом обращении и действуют
+//   по умолчанию в CLI и библиотеке. 0 -- значение не задано: размер
+//   блока DEFAULT_BLOCK_SIZE, потоков по числу ядер, число участков,
+//   декодируемых одним потоком вперемешку, -- по размеру потока.
+//
+//   Файл -- строки "ключ значение" с ключами block_size, threads и
+//   streams; пустые строки и строки с # пропускаются.
+
+struct TuneConfig {
+    uint32_t block_size = 0;
+    unsigned threads = 0;
+    unsigned streams = 0; // наибольшее число участков на поток (1, 2 или 4)
+};
+
+// $HUFFMAN_CONFIG, иначе $HOME/.huffman.conf; пусто, если нет ни того,
+//   ни другого
+std::string config_path();
+
+// Бросает std::runtime_error для неизвестного ключа или плохого числа
+TuneConfig read_config(std::istream& istr);
+void write_config(std::ostream& ostr, const TuneConfig& config);
+
+// Действующие настройки: при первом вызове читаются из config_path(),
+//   если файл есть
+TuneConfig tuned_config();
+
+// Заменяет действующие настройки. Нельзя вызывать одновременно
+//   с кодированием и декодированием.
+void set_tuned_config(const TuneConfig& config);
+
+// Образец данных для autotune и таблиц по образцу (см. stream.hpp): до
+//   size байтов кусками, равномерно разбросанными по istr (istr должен
+//   поддерживать seekg)
+constexpr uint64_t DEFAULT_SAMPLE_SIZE = 8u << 20u;
+std::vector<uint8_t> read_sample(std::istream& istr, uint64_t size);
+
+// Подбирает настройки по скорости кодирования и декодирования потока
+//   блоков из образца в памяти. Сначала перебираются размер блока и число
+//   потоков, затем для лучшей пары -- число участков на поток (только
+//   декодирование). Настройки, сжимающие заметно хуже лучших, не
+//   выбираются. Каждый замер печатается в out; действующие настройки
+//   после вызова не меняются.
+TuneConfig autotune(const uint8_t* sample, uint64_t size, std::ostream& out);
@@ -0,0 +1,288 @@
+#include "wide.hpp"
+#include "canonical.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
+
+namespace {
+
+    constexpr uint8_t MAGIC[4] = {0x03, 'H', '2', 'H'};
+    constexpr size_t WIDE_SYMBOLS = 65536;
+
+
+    // Элемент таблицы декодирования. Если sub_bits > 0, это ссылка на
+    //    подтаблицу из 2^sub_bits элементов, начинающуюся с value, по
+    //    следующим sub_bits битам; иначе value -- символ, length -- полная
+    //    длина его кода (0 -- код не существует).
+    struct WideEntry {
+        uint32_t value;
+        uint8_t length;
+        uint8_t sub_bits;
+    };
+
+
+    // Символы с кодами не длиннее WIDE_ROOT_BITS декодируются первым
+    //    уровнем; коды с общими первыми WIDE_ROOT_BITS битами -- одной
+    //    подтаблицей шириной по самому длинному из них.
+    std::vector<WideEntry> build_wide_table(
+        const std::vector<uint16_t>& symbols,
+        const std::vector<uint8_t>& lengths
+    ) {
+        constexpr size_t root_size = size_t{1} << WIDE_ROOT_BITS;
+        auto codes = canonical_codes(lengths);
+
+        std::vector<uint8_t> sub_bits(root_size);
+        for (size_t i = 0; i < lengths.size(); ++i) {
+            if (lengths[i] > WIDE_ROOT_BITS) {
+                uint8_t extra = lengths[i] - WIDE_ROOT_BITS;
+                auto& bits = sub_bits[codes[i] >> extra];
+                bits = std::max(bits, extra);
+            }
+        }
+
+        std::vector<WideEntry> table(root_size, WideEntry{0, 0, 0}); // NRVO
+        for (size_t prefix = 0; prefix < root_size; ++prefix) {
+            if (sub_bits[prefix] > 0) {
+                table[prefix] = WideEntry{static_cast<uint32_t>(table.size()), 0, sub_bits[prefix]};
+                table.resize(table.size() + (size_t{1} << sub_bits[prefix]), WideEntry{0, 0, 0});
+            }
+        }
+
+        for (size_t i = 0; i < lengths.size(); ++i) {
+            uint8_t length = lengths[i];
+            WideEntry entry{symbols[i], length, 0};
+            size_t first = 0;
+            size_t count = 0;
+            if (length <= WIDE_ROOT_BITS) {
+                first = static_cast<size_t>(codes[i]) << (WIDE_ROOT_BITS - length);
+                count = size_t{1} << (WIDE_ROOT_BITS - length);
+            } else {
+                uint8_t extra = length - WIDE_ROOT_BITS;
+                const WideEntry& link = table[codes[i] >> extra];
+                uint32_t rest = codes[i] & ((1u << extra) - 1);
+                first = link.value + (static_cast<size_t>(rest) << (link.sub_bits - extra));
+                count = size_t{1} << (link.sub_bits - extra);
+            }
+            std::fill(table.begin() + first, table.begin() + first + count, entry);
+        }
+        return table;
+    }
+
+
+    struct WideHeader {
+        uint64_t raw_size = 0;
+        std::vector<uint16_t> symbols;
+        std::vector<uint8_t> lengths;
+        const uint8_t* bits = nullptr; // начало кодов
+    };
+
+
+    WideHeader parse_header(const uint8_t* data, uint64_t size) {
+        const uint8_t* pos = data;
+        const uint8_t* end = data + size;
+        auto fail = [] {
+            throw std::runtime_error("corrupted wide stream");
+        };
+        auto need = [&](uint64_t bytes) {
+            if (static_cast<uint64_t>(end - pos) < bytes) {
+                fail();
+            }
+        };
+        auto get = [&](int bytes) {
+            need(bytes);
+            uint64_t value = 0;
+            for (int i = 0; i < bytes; ++i) {
+                value |= static_cast<uint64_t>(*pos++) << (8u * i);
+            }
+            return value;
+        };
+
+        if (!is_wide_stream(data, size)) {
+            throw std::runtime_error("not a wide stream");
+        }
+        pos += sizeof(MAGIC);
+
+        WideHeader header; // NRVO
+        header.raw_size = get(8);
+        uint64_t count = get(4);
+        if (count > WIDE_SYMBOLS || (count == 0) != (header.raw_size < 2)) {
+            fail();
+        }
+
+        header.symbols.resize(count);
+        uint64_t symbol = 0;
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t gap = 0;
+            for (unsigned shift = 0;; shift += 7) {
+                auto byte = get(1);
+                if (shift > 14) {
+                    fail();
+                }
+                gap |= (byte & 0x7Fu) << shift;
+                if ((byte & 0x80u) == 0) {
+                    break;
+                }
+            }
+            symbol = i == 0 ? gap : symbol + gap + 1;
+            if (symbol >= WIDE_SYMBOLS) {
+                fail();
+            }
+            header.symbols[i] = static_cast<uint16_t>(symbol);
+        }
+
+        // Коды должны помещаться в дерево: сумма 2^-длина не больше 1
+        header.lengths.resize(count);
+        need((count + 1) / 2);
+        uint64_t kraft = 0;
+        for (size_t i = 0; i < count; ++i) {
+            header.lengths[i] = ((i % 2 ? pos[i / 2] >> 4u : pos[i / 2]) & 0xFu) + 1;
+            kraft += uint64_t{1} << (MAX_WIDE_CODE_LENGTH - header.lengths[i]);
+        }
+        if (kraft > (uint64_t{1} << MAX_WIDE_CODE_LENGTH)) {
+            fail();
+        }
+        pos += (count + 1) / 2;
+        if (header.raw_size % 2) {
+            need(1);
+            ++pos;
+        }
+        // Код каждого символа занимает хотя бы бит
+        if (header.raw_size / 2 > 8 * static_cast<uint64_t>(end - pos)) {
+            fail();
+        }
+        header.bits = pos;
+        return header;
+    }
+
+} // \WIDE
+
+
+bool is_wide_stream(const uint8_t* data, uint64_t size) {
+    return size >= sizeof(MAGIC) && std::equal(MAGIC, MAGIC + sizeof(MAGIC), data);
+}
+
+
+std::vector<uint8_t> compress_wide(const uint8_t* data, uint64_t size) {
+    uint64_t pairs = size / 2;
+    std::vector<uint64_t> histogram(WIDE_SYMBOLS);
+    for (uint64_t i = 0; i < pairs; ++i) {
+        ++histogram[data[2 * i] | data[2 * i + 1] << 8u];
+    }
+
+    std::vector<uint16_t> symbols;
+    std::vector<uint64_t> freqs;
+    for (size_t symbol = 0; symbol < WIDE_SYMBOLS; ++symbol) {
+        if (histogram[symbol] > 0) {
+            symbols.push_back(static_cast<uint16_t>(symbol));
+            freqs.push_back(histogram[symbol]);
+        }
+    }
+    std::vector<uint8_t> lengths;
+    if (!freqs.empty()) {
+        lengths = limited_code_lengths(freqs, MAX_WIDE_CODE_LENGTH);
+    }
+    auto codes = canonical_codes(lengths);
+
+    std::vector<uint8_t> compressed(MAGIC, MAGIC + sizeof(MAGIC)); // NRVO
+    auto put = [&](uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; ++i) {
+            compressed.push_back(static_cast<uint8_t>(value >> (8u * i)));
+        }
+    };
+    put(size, 8);
+    put(symbols.size(), 4);
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        uint32_t gap = i == 0 ? symbols[i] : symbols[i] - symbols[i - 1] - 1;
+        while (gap >= 0x80u) {
+            compressed.push_back(static_cast<uint8_t>(gap | 0x80u));
+            gap >>= 7u;
+        }
+        compressed.push_back(static_cast<uint8_t>(gap));
+    }
+    for (size_t i = 0; i < lengths.size(); i += 2) {
+        uint8_t high = i + 1 < lengths.size() ? lengths[i + 1] - 1 : 0;
+        compressed.push_back((lengths[i] - 1) | (high << 4u));
+    }
+    if (size % 2) {
+        compressed.push_back(data[size - 1]);
+    }
+
+    // Коды по значению символа, чтобы не искать его в алфавите
+    std::vector<uint32_t> symbol_codes(WIDE_SYMBOLS);
+    std::vector<uint8_t> symbol_lengths(WIDE_SYMBOLS);
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        symbol_codes[symbols[i]] = codes[i];
+        symbol_lengths[symbols[i]] = lengths[i];
+    }
+    BitWriter writer(&compressed);
+    for (uint64_t i = 0; i < pairs; ++i) {
+        uint16_t symbol = data[2 * i] | data[2 * i + 1] << 8u;
+        writer.put(symbol_codes[symbol], symbol_lengths[symbol]);
+    }
+    writer.flush();
+    return compressed;
+}
+
+
+std::vector<uint8_t> decompress_wide(const uint8_t* data, uint64_t size) {
+    WideHeader header = parse_header(data, size);
+    std::vector<uint8_t> decoded(header.raw_size); // NRVO
+    if (header.symbols.empty()) {
+        if (header.raw_size > 0) {
+            decoded[0] = header.bits[-1];
+        }
+        return decoded;
+    }
+    auto table = build_wide_table(header.symbols, header.lengths);
+
+    uint8_t* out = decoded.data();
+    uint8_t* pairs_end = out + header.raw_size / 2 * 2;
+    BitReader reader(header.bits, data + size - header.bits);
+    while (out < pairs_end) {
+        WideEntry entry = table[reader.peek(WIDE_ROOT_BITS)];
+        if (entry.sub_bits > 0) {
+            uint32_t index = reader.peek(WIDE_ROOT_BITS + entry.sub_bits) & ((1u << entry.sub_bits) - 1);
+            entry = table[entry.value + index];
+        }
+        if (entry.length == 0) {
+            throw std::runtime_error("corrupted wide stream");
+        }
+        reader.skip(entry.length);
+        out[0] = static_cast<uint8_t>(entry.value);
+        out[1] = static_cast<uint8_t>(entry.value >> 8u);
+        out += 2;
+    }
+    if (reader.overrun()) {
+        throw std::runtime_error("corrupted wide stream");
+    }
+    if (header.raw_size % 2) {
+        *out = header.bits[-1];
+    }
+    return decoded;
+}
+
+
+uint64_t wide_table_size(const uint8_t* data, uint64_t size) {
+    return parse_header(data, size).bits - data;
+}
+
+
+uint64_t wide_raw_size(const uint8_t* data, uint64_t size) {
+    return parse_header(data, size).raw_size;
+}
+
+
+void print_wide_codes(const uint8_t* data, uint64_t size, std::ostream& out) {
+    WideHeader header = parse_header(data, size);
+    auto codes = canonical_codes(header.lengths);
+    auto flags = out.flags();
+    for (size_t i = 0; i < header.symbols.size(); ++i) {
+        for (uint8_t bit = header.lengths[i]; bit-- > 0;) {
+            out << ((codes[i] >> bit) & 1u);
+        }
+        out << ' ' << std::hex << std::setw(4) << std::setfill('0') << header.symbols[i]
+            << std::dec << '\n';
+    }
+    out.flags(flags);
+}
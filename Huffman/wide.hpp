@@ -0,0 +1,42 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+// Кодирование 16-битными символами: пары байтов (little-endian) кодируются
+//   как один символ, поэтому текст в UTF-16 и 16-битные отсчеты (звук,
+//   датчики) моделируются целиком, а не двумя независимыми половинами.
+//
+//   Формат:
+//     03 'H' '2' 'H' (не может быть началом потока encode: в нем за
+//         размером алфавита следуют различные символы)
+//     исходный размер(8)
+//     число различных символов(4)
+//     символы по возрастанию: разность с предыдущим минус 1 (для первого --
+//         сам символ) в LEB128, обычно 1 байт на символ
+//     длины кодов символов минус 1, по 4 бита
+//     последний байт, если исходный размер нечетный
+//     коды символов, начиная со старших битов
+//   Числа хранятся в little-endian. В заголовке только встретившиеся
+//   символы.
+
+// Коды ограничены 16 битами (алфавит до 65536 символов). Декодирование --
+//   по таблице первого уровня из 2^WIDE_ROOT_BITS элементов (8 КиБ, в L1)
+//   и, для длинных кодов, по подтаблицам второго уровня.
+constexpr uint8_t MAX_WIDE_CODE_LENGTH = 16;
+constexpr uint8_t WIDE_ROOT_BITS = 10;
+
+bool is_wide_stream(const uint8_t* data, uint64_t size);
+
+std::vector<uint8_t> compress_wide(const uint8_t* data, uint64_t size);
+std::vector<uint8_t> decompress_wide(const uint8_t* data, uint64_t size);
+
+// Размер заголовка (алфавит, длины кодов и последний байт)
+uint64_t wide_table_size(const uint8_t* data, uint64_t size);
+
+// Исходный размер из проверенного заголовка, без декодирования
+uint64_t wide_raw_size(const uint8_t* data, uint64_t size);
+
+// Печатает коды в формате "код символ", символы -- шестнадцатеричные
+void print_wide_codes(const uint8_t* data, uint64_t size, std::ostream& out);
@@ -0,0 +1,261 @@
+#include "words.hpp"
+#include "canonical.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+namespace {
+
+    constexpr uint8_t MAGIC[4] = {0x03, 'H', 'W', 'H'};
+    constexpr size_t BYTE_SYMBOLS = 256;
+    constexpr size_t MAX_TOKEN_LENGTH = 255;
+
+
+    bool is_word_byte(uint8_t byte) {
+        return (byte >= '0' && byte <= '9')
+            || (byte >= 'A' && byte <= 'Z')
+            || (byte >= 'a' && byte <= 'z')
+            || byte >= 0x80; // UTF-8
+    }
+
+
+    // Вызывает f для каждого слова и разделителя
+    template <class F>
+    void for_each_token(const uint8_t* data, uint64_t size, F&& f) {
+        uint64_t begin = 0;
+        while (begin < size) {
+            bool word = is_word_byte(data[begin]);
+            uint64_t end = begin + 1;
+            while (end < size && end - begin < MAX_TOKEN_LENGTH
+                   && is_word_byte(data[end]) == word) {
+                ++end;
+            }
+            f(std::string_view(reinterpret_cast<const char*>(data + begin), end - begin));
+            begin = end;
+        }
+    }
+
+
+    // Выгода слова -- число байтов, которые не придется кодировать
+    //    по одному.
+    std::vector<std::string_view> choose_dictionary(const uint8_t* data, uint64_t size) {
+        std::unordered_map<std::string_view, uint64_t> counts;
+        for_each_token(data, size, [&](std::string_view token) {
+            if (token.size() > 1) {
+                ++counts[token];
+            }
+        });
+
+        std::vector<std::pair<uint64_t, std::string_view>> scored;
+        for (const auto& [token, count] : counts) {
+            if (count > 1) {
+                scored.emplace_back(count * (token.size() - 1), token);
+            }
+        }
+        auto words = std::min(MAX_WORDS, scored.size());
+        std::partial_sort(
+            scored.begin(), scored.begin() + words, scored.end(), std::greater<>()
+        );
+
+        std::vector<std::string_view> dictionary; // NRVO
+        for (size_t i = 0; i < words; ++i) {
+            dictionary.push_back(scored[i].second);
+        }
+        return dictionary;
+    }
+
+
+    struct WordHeader {
+        uint64_t raw_size = 0;
+        std::vector<std::string_view> words;
+        std::vector<uint8_t> lengths;
+        const uint8_t* bits = nullptr; // начало кодов
+    };
+
+
+    WordHeader parse_header(const uint8_t* data, uint64_t size) {
+        const uint8_t* pos = data;
+        const uint8_t* end = data + size;
+        auto need = [&](uint64_t bytes) {
+            if (static_cast<uint64_t>(end - pos) < bytes) {
+                throw std::runtime_error("corrupted word stream");
+            }
+        };
+        auto get = [&](int bytes) {
+            need(bytes);
+            uint64_t value = 0;
+            for (int i = 0; i < bytes; ++i) {
+                value |= static_cast<uint64_t>(*pos++) << (8u * i);
+            }
+            return value;
+        };
+
+        if (!is_word_stream(data, size)) {
+            throw std::runtime_error("not a word stream");
+        }
+        pos += sizeof(MAGIC);
+
+        WordHeader header; // NRVO
+        header.raw_size = get(8);
+        header.words.resize(get(2));
+        if (header.words.size() > MAX_WORDS) {
+            throw std::runtime_error("corrupted word stream");
+        }
+        uint64_t longest = 1;
+        for (auto& word : header.words) {
+            auto length = get(1);
+            need(length);
+            word = std::string_view(reinterpret_cast<const char*>(pos), length);
+            pos += length;
+            longest = std::max(longest, length);
+        }
+
+        // Коды должны помещаться в дерево: сумма 2^-длина не больше 1
+        header.lengths.resize(BYTE_SYMBOLS + header.words.size());
+        need((header.lengths.size() + 1) / 2);
+        uint64_t kraft = 0;
+        for (size_t symbol = 0; symbol < header.lengths.size(); ++symbol) {
+            uint8_t length = (symbol % 2 ? pos[symbol / 2] >> 4u : pos[symbol / 2]) & 0xFu;
+            if (length > MAX_WORD_CODE_LENGTH) {
+                throw std::runtime_error("corrupted word stream");
+            }
+            if (length > 0) {
+                kraft += uint64_t{1} << (MAX_WORD_CODE_LENGTH - length);
+            }
+            header.lengths[symbol] = length;
+        }
+        if (kraft > (uint64_t{1} << MAX_WORD_CODE_LENGTH)) {
+            throw std::runtime_error("corrupted word stream");
+        }
+        pos += (header.lengths.size() + 1) / 2;
+        // Код каждого символа занимает хотя бы бит и дает не больше
+        //   longest байтов
+        if (header.raw_size / longest > 8 * static_cast<uint64_t>(end - pos)) {
+            throw std::runtime_error("corrupted word stream");
+        }
+        header.bits = pos;
+        return header;
+    }
+
+} // \WORDS
+
+
+bool is_word_stream(const uint8_t* data, uint64_t size) {
+    return size >= sizeof(MAGIC) && std::equal(MAGIC, MAGIC + sizeof(MAGIC), data);
+}
+
+
+std::vector<uint8_t> compress_words(const uint8_t* data, uint64_t size) {
+    auto dictionary = choose_dictionary(data, size);
+    std::unordered_map<std::string_view, uint16_t> index;
+    for (size_t i = 0; i < dictionary.size(); ++i) {
+        index[dictionary[i]] = static_cast<uint16_t>(BYTE_SYMBOLS + i);
+    }
+
+    std::vector<uint16_t> symbols;
+    std::vector<uint64_t> freqs(BYTE_SYMBOLS + dictionary.size());
+    for_each_token(data, size, [&](std::string_view token) {
+        auto it = index.find(token);
+        if (it != index.end()) {
+            symbols.push_back(it->second);
+        } else {
+            for (char byte : token) {
+                symbols.push_back(static_cast<uint8_t>(byte));
+            }
+        }
+    });
+    for (uint16_t symbol : symbols) {
+        ++freqs[symbol];
+    }
+    auto lengths = limited_code_lengths(freqs, MAX_WORD_CODE_LENGTH);
+    auto codes = canonical_codes(lengths);
+
+    std::vector<uint8_t> compressed(MAGIC, MAGIC + sizeof(MAGIC)); // NRVO
+    auto put = [&](uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; ++i) {
+            compressed.push_back(static_cast<uint8_t>(value >> (8u * i)));
+        }
+    };
+    put(size, 8);
+    put(dictionary.size(), 2);
+    for (auto word : dictionary) {
+        put(word.size(), 1);
+        compressed.insert(compressed.end(), word.begin(), word.end());
+    }
+    for (size_t symbol = 0; symbol < lengths.size(); symbol += 2) {
+        uint8_t high = symbol + 1 < lengths.size() ? lengths[symbol + 1] : 0;
+        compressed.push_back(lengths[symbol] | (high << 4u));
+    }
+
+    BitWriter writer(&compressed);
+    for (uint16_t symbol : symbols) {
+        writer.put(codes[symbol], lengths[symbol]);
+    }
+    writer.flush();
+    return compressed;
+}
+
+
+std::vector<uint8_t> decompress_words(const uint8_t* data, uint64_t size) {
+    WordHeader header = parse_header(data, size);
+    auto table = build_decode_table(header.lengths, MAX_WORD_CODE_LENGTH);
+
+    std::vector<uint8_t> decoded(header.raw_size); // NRVO
+    uint8_t* out = decoded.data();
+    uint8_t* out_end = out + decoded.size();
+    BitReader reader(header.bits, data + size - header.bits);
+    while (out < out_end) {
+        DecodeEntry entry = table[reader.peek(MAX_WORD_CODE_LENGTH)];
+        if (entry.length == 0) {
+            throw std::runtime_error("corrupted word stream");
+        }
+        reader.skip(entry.length);
+        if (entry.symbol < BYTE_SYMBOLS) {
+            *out++ = static_cast<uint8_t>(entry.symbol);
+            continue;
+        }
+        auto word = header.words[entry.symbol - BYTE_SYMBOLS];
+        if (word.size() > static_cast<size_t>(out_end - out)) {
+            throw std::runtime_error("corrupted word stream");
+        }
+        std::memcpy(out, word.data(), word.size());
+        out += word.size();
+    }
+    if (reader.overrun()) {
+        throw std::runtime_error("corrupted word stream");
+    }
+    return decoded;
+}
+
+
+uint64_t word_table_size(const uint8_t* data, uint64_t size) {
+    return parse_header(data, size).bits - data;
+}
+
+
+uint64_t word_raw_size(const uint8_t* data, uint64_t size) {
+    return parse_header(data, size).raw_size;
+}
+
+
+void print_word_codes(const uint8_t* data, uint64_t size, std::ostream& out) {
+    WordHeader header = parse_header(data, size);
+    auto codes = canonical_codes(header.lengths);
+    for (size_t symbol = 0; symbol < header.lengths.size(); ++symbol) {
+        uint8_t length = header.lengths[symbol];
+        if (length == 0) {
+            continue;
+        }
+        for (uint8_t bit = length; bit-- > 0;) {
+            out << ((codes[symbol] >> bit) & 1u);
+        }
+        if (symbol < BYTE_SYMBOLS) {
+            out << ' ' << symbol << '\n';
+        } else {
+            out << " \"" << header.words[symbol - BYTE_SYMBOLS] << "\"\n";
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+// Кодирование текста словами: символами алфавита служат байты и самые
+//   выгодные слова и разделители (максимальные последовательности букв
+//   или не-букв) из словаря, хранящегося в заголовке.
+//
+//   Формат:
+//     03 'H' 'W' 'H' (не может быть началом потока encode: в нем за
+//         размером алфавита следуют различные символы)
+//     исходный размер(8)
+//     число слов(2), для каждого слова: длина(1) байты
+//     длины кодов 256 байтов и слов, по 4 бита
+//     коды символов, начиная со старших битов
+//   Числа хранятся в little-endian.
+
+// Размер алфавита ограничен, чтобы таблица декодирования
+//   (2^MAX_WORD_CODE_LENGTH элементов) помещалась в L1.
+constexpr size_t MAX_WORDS = 2048 - 256;
+constexpr uint8_t MAX_WORD_CODE_LENGTH = 12;
+
+bool is_word_stream(const uint8_t* data, uint64_t size);
+
+std::vector<uint8_t> compress_words(const uint8_t* data, uint64_t size);
+std::vector<uint8_t> decompress_words(const uint8_t* data, uint64_t size);
+
+// Размер заголовка (словарь и длины кодов)
+uint64_t word_table_size(const uint8_t* data, uint64_t size);
+
+// Исходный размер из проверенного заголовка, без декодирования
+uint64_t word_raw_size(const uint8_t* data, uint64_t size);
+
+// Печатает коды в формате "код символ", слова -- в кавычках
+void print_word_codes(const uint8_t* data, uint64_t size, std::ostream& out);